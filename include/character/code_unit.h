@@ -3,9 +3,24 @@
 #include <string.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "basic/likely_unlikely.h"
 
 // this lib is intended to work with either char or wchar_t.
+//
+// USE_UTF8 is a third configuration. the code unit is char (sharing everything
+// with the char build, including the subject buffer), but the pattern and
+// subject are interpreted as UTF-8: literals are matched as their encoded byte
+// sequences, and functions which inspect characters (arith) decode the code
+// point at the position being tested.
+
+#if defined(USE_WCHAR) && defined(USE_UTF8)
+#error "USE_WCHAR and USE_UTF8 are mutually exclusive"
+#endif
+
+#ifdef USE_UTF8
+#include "character/utf8.h"
+#endif
 
 #ifdef USE_WCHAR
 #include <wchar.h>
@@ -17,36 +32,10 @@ size_t code_unit_strlen(const CODE_UNIT* s) {
   return wcslen(s);
 }
 
-int code_unit_memcmp(const CODE_UNIT* str1, const CODE_UNIT* str2, size_t n) {
-  return wmemcmp(str1, str2, n);
-}
-
 int code_unit_strcmp(const CODE_UNIT* str1, const CODE_UNIT* str2) {
   return wcscmp(str1, str2);
 }
 
-const CODE_UNIT* code_unit_memmem(const CODE_UNIT* haystack, size_t haystack_len, const CODE_UNIT* needle, size_t needle_len) {
-  // It's surprising that this function doesn't exist in the standard lib.
-
-  if (unlikely(haystack_len < needle_len)) {
-    return NULL;
-  }
-
-  const CODE_UNIT* last_position = haystack + haystack_len - needle_len;
-
-  while(1) {
-    if (wmemcmp(haystack, needle, needle_len) == 0) {
-      return haystack;
-    }
-    ++haystack;
-    if (haystack > last_position) return NULL;
-  }
-}
-
-const CODE_UNIT* code_unit_memchr(const CODE_UNIT *ptr, CODE_UNIT value, size_t num) {
-  return (const CODE_UNIT*)wmemchr((const void*)ptr, value, num);
-}
-
 #else
 typedef char CODE_UNIT;
 
@@ -56,22 +45,65 @@ size_t code_unit_strlen(const CODE_UNIT* s) {
   return strlen(s);
 }
 
+int code_unit_strcmp(const CODE_UNIT* str1, const CODE_UNIT* str2) {
+  return strcmp(str1, str2);
+}
+#endif
+
+// memcmp, memmem, the memchr family, the incomplete suffix search and UTF-8
+// decoding are bound at startup to the best implementation for the cpu
+#include "character/code_unit_dispatch.h"
+
 int code_unit_memcmp(const CODE_UNIT* str1, const CODE_UNIT* str2, size_t n) {
-  return memcmp(str1, str2, n);
+  return code_unit_kernels.memcmp(str1, str2, n);
 }
 
-int code_unit_strcmp(const CODE_UNIT* str1, const CODE_UNIT* str2) {
-  return strcmp(str1, str2);
+// an empty needle is found at the beginning of the haystack
+const CODE_UNIT* code_unit_memmem(const CODE_UNIT* haystack, size_t haystack_len, const CODE_UNIT* needle, size_t needle_len) {
+  return code_unit_kernels.memmem(haystack, haystack_len, needle, needle_len);
 }
 
-const CODE_UNIT* code_unit_memmem(const CODE_UNIT* haystack, size_t haystacklen, const CODE_UNIT* needle, size_t needlelen) {
-    return (const CODE_UNIT*)memmem((void*)haystack, haystacklen, (void*)needle, needlelen);
+const CODE_UNIT* code_unit_memchr(const CODE_UNIT* ptr, CODE_UNIT value, size_t num) {
+  return code_unit_kernels.memchr(ptr, value, num);
 }
 
-const CODE_UNIT* code_unit_memchr(const CODE_UNIT *ptr, CODE_UNIT value, size_t num) {
-  return (const CODE_UNIT*)memchr((const void*)ptr, value, num);
+// the first occurrence of either value
+const CODE_UNIT* code_unit_memchr2(const CODE_UNIT* ptr, CODE_UNIT value1, CODE_UNIT value2, size_t num) {
+  return code_unit_kernels.memchr2(ptr, value1, value2, num);
 }
+
+// the first occurrence of any of the three values
+const CODE_UNIT* code_unit_memchr3(const CODE_UNIT* ptr, CODE_UNIT value1, CODE_UNIT value2, CODE_UNIT value3, size_t num) {
+  return code_unit_kernels.memchr3(ptr, value1, value2, value3, num);
+}
+
+// units points to num_units elements, at most CODE_UNIT_SET_CAPACITY.
+// duplicates are allowed
+void code_unit_set_init(code_unit_set* set, const CODE_UNIT* units, size_t num_units) {
+  assert(num_units <= CODE_UNIT_SET_CAPACITY);
+  memset(set, 0, sizeof(*set));
+  for (size_t i = 0; i < num_units; ++i) {
+    set->units[i] = units[i];
+#ifndef USE_WCHAR
+    unsigned char byte = (unsigned char)units[i];
+    unsigned char bit = 1 << ((byte >> 4) & 7);
+    set->nibble_low[byte & 0xF] |= bit;
+    set->nibble_high[byte >> 4] = bit;
+    set->bitmap[byte >> 6] |= (uint64_t)1 << (byte & 63);
 #endif
+  }
+  set->num_units = num_units;
+}
+
+// the first occurrence of any unit in the set
+const CODE_UNIT* code_unit_memchr_set(const CODE_UNIT* ptr, const code_unit_set* set, size_t num) {
+  return code_unit_kernels.memchr_set(ptr, set, num);
+}
+
+// the number of occurrences of value
+size_t code_unit_memcount(const CODE_UNIT* ptr, CODE_UNIT value, size_t num) {
+  return code_unit_kernels.memcount(ptr, value, num);
+}
 
 // a comparison function suitable for sorting code unit ranges
 int code_unit_range_cmp(const CODE_UNIT* begin1, const CODE_UNIT* end1, const CODE_UNIT* begin2, const CODE_UNIT* end2) {
@@ -116,3 +148,30 @@ const CODE_UNIT* code_unit_incomplete_suffix(const CODE_UNIT* haystack, size_t h
       }
   }
 }
+
+// the failure function of the needle, as used by the Knuth-Morris-Pratt
+// algorithm: element i is the length of the longest proper prefix of
+// needle[0, i] which is also a suffix of it. failure points to needle_len
+// elements
+void code_unit_failure_table(const CODE_UNIT* needle, size_t needle_len, size_t* failure) {
+  if (needle_len == 0) {
+    return;
+  }
+  failure[0] = 0;
+  size_t matched = 0;
+  for (size_t i = 1; i < needle_len; ++i) {
+    while (matched != 0 && needle[i] != needle[matched]) {
+      matched = failure[matched - 1];
+    }
+    if (needle[i] == needle[matched]) {
+      ++matched;
+    }
+    failure[i] = matched;
+  }
+}
+
+// same as code_unit_incomplete_suffix, but in linear time, with the needle's
+// failure table from code_unit_failure_table
+const CODE_UNIT* code_unit_incomplete_suffix_kmp(const CODE_UNIT* haystack, size_t haystack_len, const CODE_UNIT* needle, size_t needle_len, const size_t* failure) {
+  return code_unit_kernels.incomplete_suffix(haystack, haystack_len, needle, needle_len, failure);
+}
@@ -0,0 +1,968 @@
+#pragma once
+
+// this is included from code_unit.h, after CODE_UNIT is defined.
+//
+// the code unit primitives are implemented by several kernels; one set for
+// each instruction set. the best set which the cpu supports is bound once at
+// startup (cpuid), so a single binary works on any x86-64 cpu while using
+// what's available.
+//
+// the environment variable CODE_UNIT_ISA limits the kernels which are used.
+// it's one of "scalar", "sse2", "avx2", "avx512bw". "scalar" uses only
+// portable code (no SIMD, and not libc's implementations either), so the tests
+// can cover every variant.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CODE_UNIT_DISPATCH_X86
+#include <immintrin.h>
+#endif
+
+typedef enum {
+  CODE_UNIT_ISA_SCALAR,
+  CODE_UNIT_ISA_SSE2,
+  CODE_UNIT_ISA_AVX2,
+  CODE_UNIT_ISA_AVX512BW,
+} code_unit_isa;
+
+// the maximum number of units in a code_unit_set
+#define CODE_UNIT_SET_CAPACITY 16
+
+// a small set of code units, which is searched for with code_unit_memchr_set.
+// see code_unit_set_init
+typedef struct {
+  CODE_UNIT units[CODE_UNIT_SET_CAPACITY];
+  size_t num_units;
+#ifndef USE_WCHAR
+  // a byte is a candidate if nibble_low[byte & 0xF] & nibble_high[byte >> 4]
+  // is nonzero (for pshufb). each high nibble is given the bit (nibble & 7),
+  // so two high nibbles can share a bit; candidates are checked with bitmap
+  unsigned char nibble_low[16];
+  unsigned char nibble_high[16];
+  uint64_t bitmap[4];
+#endif
+} code_unit_set;
+
+typedef struct {
+  code_unit_isa isa;
+  int (*memcmp)(const CODE_UNIT* str1, const CODE_UNIT* str2, size_t n);
+  const CODE_UNIT* (*memmem)(const CODE_UNIT* haystack, size_t haystack_len, const CODE_UNIT* needle, size_t needle_len);
+  const CODE_UNIT* (*memchr)(const CODE_UNIT* ptr, CODE_UNIT value, size_t num);
+  const CODE_UNIT* (*memchr2)(const CODE_UNIT* ptr, CODE_UNIT value1, CODE_UNIT value2, size_t num);
+  const CODE_UNIT* (*memchr3)(const CODE_UNIT* ptr, CODE_UNIT value1, CODE_UNIT value2, CODE_UNIT value3, size_t num);
+  const CODE_UNIT* (*memchr_set)(const CODE_UNIT* ptr, const code_unit_set* set, size_t num);
+  size_t (*memcount)(const CODE_UNIT* ptr, CODE_UNIT value, size_t num);
+  const CODE_UNIT* (*incomplete_suffix)(const CODE_UNIT* haystack, size_t haystack_len, const CODE_UNIT* needle, size_t needle_len, const size_t* failure);
+  const unsigned char* (*utf8_decode)(const unsigned char* begin, const unsigned char* end, wchar_t** out);
+} code_unit_kernel_set;
+
+// ================================= scalar ====================================
+
+static int code_unit_memcmp_scalar(const CODE_UNIT* str1, const CODE_UNIT* str2, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    if (str1[i] != str2[i]) {
+#ifdef USE_WCHAR
+      return str1[i] < str2[i] ? -1 : 1;
+#else
+      // same as memcmp
+      return (unsigned char)str1[i] < (unsigned char)str2[i] ? -1 : 1;
+#endif
+    }
+  }
+  return 0;
+}
+
+static const CODE_UNIT* code_unit_memchr_scalar(const CODE_UNIT* ptr, CODE_UNIT value, size_t num) {
+  for (size_t i = 0; i < num; ++i) {
+    if (ptr[i] == value) {
+      return ptr + i;
+    }
+  }
+  return NULL;
+}
+
+static const CODE_UNIT* code_unit_memchr2_scalar(const CODE_UNIT* ptr, CODE_UNIT value1, CODE_UNIT value2, size_t num) {
+  for (size_t i = 0; i < num; ++i) {
+    if (ptr[i] == value1 || ptr[i] == value2) {
+      return ptr + i;
+    }
+  }
+  return NULL;
+}
+
+static const CODE_UNIT* code_unit_memchr3_scalar(const CODE_UNIT* ptr, CODE_UNIT value1, CODE_UNIT value2, CODE_UNIT value3, size_t num) {
+  for (size_t i = 0; i < num; ++i) {
+    if (ptr[i] == value1 || ptr[i] == value2 || ptr[i] == value3) {
+      return ptr + i;
+    }
+  }
+  return NULL;
+}
+
+// private. compares against each of the set's units, so it only requires
+// units and num_units to be set
+static const CODE_UNIT* code_unit_memchr_units_scalar(const CODE_UNIT* ptr, const code_unit_set* set, size_t num) {
+  for (size_t i = 0; i < num; ++i) {
+    for (size_t j = 0; j < set->num_units; ++j) {
+      if (ptr[i] == set->units[j]) {
+        return ptr + i;
+      }
+    }
+  }
+  return NULL;
+}
+
+// private
+static bool code_unit_set_contains(const code_unit_set* set, CODE_UNIT unit) {
+#ifdef USE_WCHAR
+  for (size_t i = 0; i < set->num_units; ++i) {
+    if (set->units[i] == unit) {
+      return true;
+    }
+  }
+  return false;
+#else
+  unsigned char byte = (unsigned char)unit;
+  return (set->bitmap[byte >> 6] >> (byte & 63)) & 1;
+#endif
+}
+
+static const CODE_UNIT* code_unit_memchr_set_scalar(const CODE_UNIT* ptr, const code_unit_set* set, size_t num) {
+  for (size_t i = 0; i < num; ++i) {
+    if (code_unit_set_contains(set, ptr[i])) {
+      return ptr + i;
+    }
+  }
+  return NULL;
+}
+
+static size_t code_unit_memcount_scalar(const CODE_UNIT* ptr, CODE_UNIT value, size_t num) {
+  size_t ret = 0;
+  for (size_t i = 0; i < num; ++i) {
+    ret += ptr[i] == value;
+  }
+  return ret;
+}
+
+// private. the critical factorization of the needle, for the two-way string
+// matching algorithm (Crochemore & Perrin). returns the position at which the
+// needle is split, and gives the period of the needle's right half
+static size_t code_unit_critical_factorization(const CODE_UNIT* needle, size_t needle_len, size_t* period) {
+  // note that SIZE_MAX + k wraps to k - 1
+
+  // maximal suffix by <
+  size_t max_suffix = SIZE_MAX;
+  size_t j = 0;
+  size_t k = 1;
+  size_t p = 1;
+  while (j + k < needle_len) {
+    CODE_UNIT a = needle[j + k];
+    CODE_UNIT b = needle[max_suffix + k];
+    if (a < b) {
+      // suffix is smaller. period is the entire prefix so far
+      j += k;
+      k = 1;
+      p = j - max_suffix;
+    } else if (a == b) {
+      // advance through repetition of the current period
+      if (k != p) {
+        ++k;
+      } else {
+        j += p;
+        k = 1;
+      }
+    } else {
+      // suffix is larger. start over from here
+      max_suffix = j++;
+      k = p = 1;
+    }
+  }
+  *period = p;
+
+  // maximal suffix by >
+  size_t max_suffix_rev = SIZE_MAX;
+  j = 0;
+  k = p = 1;
+  while (j + k < needle_len) {
+    CODE_UNIT a = needle[j + k];
+    CODE_UNIT b = needle[max_suffix_rev + k];
+    if (b < a) {
+      j += k;
+      k = 1;
+      p = j - max_suffix_rev;
+    } else if (a == b) {
+      if (k != p) {
+        ++k;
+      } else {
+        j += p;
+        k = 1;
+      }
+    } else {
+      max_suffix_rev = j++;
+      k = p = 1;
+    }
+  }
+
+  // the later of the two is the critical factorization
+  if (max_suffix_rev + 1 < max_suffix + 1) {
+    return max_suffix + 1;
+  }
+  *period = p;
+  return max_suffix_rev + 1;
+}
+
+// private. the two-way string matching algorithm. linear time in the worst
+// case, with constant space
+static const CODE_UNIT* code_unit_memmem_two_way(const CODE_UNIT* haystack, size_t haystack_len, const CODE_UNIT* needle, size_t needle_len) {
+  if (haystack_len < needle_len) {
+    return NULL;
+  }
+  size_t last_position = haystack_len - needle_len;
+  size_t period;
+  size_t suffix = code_unit_critical_factorization(needle, needle_len, &period);
+  size_t i;
+  size_t j = 0;
+
+  if (code_unit_memcmp_scalar(needle, needle + period, suffix) == 0) {
+    // the needle is periodic. a mismatch can only advance by the period, so
+    // remember how much of the period has already been matched, rather than
+    // comparing it again
+    size_t memory = 0;
+    while (j <= last_position) {
+      // right half
+      i = suffix > memory ? suffix : memory;
+      while (i < needle_len && needle[i] == haystack[i + j]) {
+        ++i;
+      }
+      if (i < needle_len) {
+        j += i - suffix + 1;
+        memory = 0;
+        continue;
+      }
+      // left half
+      i = suffix - 1;
+      while (memory < i + 1 && needle[i] == haystack[i + j]) {
+        --i;
+      }
+      if (i + 1 < memory + 1) {
+        return haystack + j;
+      }
+      j += period;
+      memory = needle_len - period;
+    }
+  } else {
+    // the halves are distinct. any mismatch gives a maximal shift
+    period = (suffix > needle_len - suffix ? suffix : needle_len - suffix) + 1;
+    while (j <= last_position) {
+      // right half
+      i = suffix;
+      while (i < needle_len && needle[i] == haystack[i + j]) {
+        ++i;
+      }
+      if (i < needle_len) {
+        j += i - suffix + 1;
+        continue;
+      }
+      // left half
+      i = suffix - 1;
+      while (i != SIZE_MAX && needle[i] == haystack[i + j]) {
+        --i;
+      }
+      if (i == SIZE_MAX) {
+        return haystack + j;
+      }
+      j += period;
+    }
+  }
+  return NULL;
+}
+
+static const CODE_UNIT* code_unit_memmem_scalar(const CODE_UNIT* haystack, size_t haystack_len, const CODE_UNIT* needle, size_t needle_len) {
+  if (needle_len == 0) {
+    return haystack;
+  }
+  return code_unit_memmem_two_way(haystack, haystack_len, needle, needle_len);
+}
+
+// the KMP automaton is run over the end of the haystack. it's inherently
+// serial, so this is the only kernel
+static const CODE_UNIT* code_unit_incomplete_suffix_scalar(const CODE_UNIT* haystack, size_t haystack_len, const CODE_UNIT* needle, size_t needle_len, const size_t* failure) {
+
+  if (unlikely(needle_len == 0)) {
+    return NULL;
+  }
+  // an incomplete needle is at most needle_len - 1 long, so only that much of
+  // the end of the haystack is considered
+  size_t window = needle_len - 1;
+  const CODE_UNIT* pos = haystack_len < window ? haystack : haystack + haystack_len - window;
+  const CODE_UNIT* end = haystack + haystack_len;
+  size_t matched = 0; // number of needle elements matched ending at pos
+  for (; pos != end; ++pos) {
+    while (matched != 0 && *pos != needle[matched]) {
+      matched = failure[matched - 1];
+    }
+    if (*pos == needle[matched]) {
+      ++matched;
+    }
+  }
+  return matched == 0 ? NULL : end - matched;
+}
+
+// ================================== libc =====================================
+
+// libc's own memcmp and memchr already select an implementation for the cpu
+
+static int code_unit_memcmp_libc(const CODE_UNIT* str1, const CODE_UNIT* str2, size_t n) {
+#ifdef USE_WCHAR
+  return wmemcmp(str1, str2, n);
+#else
+  return memcmp(str1, str2, n);
+#endif
+}
+
+static const CODE_UNIT* code_unit_memchr_libc(const CODE_UNIT* ptr, CODE_UNIT value, size_t num) {
+#ifdef USE_WCHAR
+  return wmemchr(ptr, value, num);
+#else
+  return (const CODE_UNIT*)memchr(ptr, value, num);
+#endif
+}
+
+// ============================ candidate filter ===============================
+
+// private. positions at which the first and last unit of the needle both match
+// are candidates, which are then verified. for typical text, there are few
+// candidates, and this is fast. however, repetitive text can give a candidate
+// at nearly every position, so once the verification work outgrows the text
+// scanned, the rest is searched with the two-way algorithm (linear time).
+//
+// candidates gives a bit for each of the lanes positions starting at pos.
+// this is inlined into each kernel, so that candidates is inlined as well
+static inline __attribute__((always_inline)) const CODE_UNIT* code_unit_memmem_filtered(
+    const CODE_UNIT* haystack,
+    size_t haystack_len,
+    const CODE_UNIT* needle,
+    size_t needle_len,
+    ptrdiff_t lanes,
+    uint64_t (*candidates)(const CODE_UNIT* pos, size_t needle_len, CODE_UNIT first, CODE_UNIT last)) {
+  if (unlikely(haystack_len < needle_len)) {
+    return NULL;
+  }
+  if (needle_len <= 1) {
+    return needle_len == 0 ? haystack : code_unit_memchr_libc(haystack, needle[0], haystack_len);
+  }
+
+  const CODE_UNIT* pos = haystack;
+  const CODE_UNIT* last_position = haystack + haystack_len - needle_len;
+  CODE_UNIT first = needle[0];
+  CODE_UNIT last = needle[needle_len - 1];
+  size_t verify_work = 0;
+#define CODE_UNIT_MEMMEM_VERIFY(candidate)                                                         \
+  do {                                                                                             \
+    if (code_unit_memcmp_libc((candidate) + 1, needle + 1, needle_len - 2) == 0) return (candidate); \
+    verify_work += needle_len;                                                                     \
+    if (unlikely(verify_work > 2 * (size_t)((candidate) - haystack) + 8 * needle_len)) {           \
+      const CODE_UNIT* next = (candidate) + 1;                                                     \
+      return code_unit_memmem_two_way(next, haystack_len - (next - haystack), needle, needle_len); \
+    }                                                                                              \
+  } while (0)
+
+  // the last lane's last unit is at most the end of the haystack
+  while (last_position - pos >= lanes - 1) {
+    uint64_t found = candidates(pos, needle_len, first, last);
+    while (found != 0) {
+      CODE_UNIT_MEMMEM_VERIFY(pos + __builtin_ctzll(found));
+      found &= found - 1;
+    }
+    pos += lanes;
+  }
+  for (; pos <= last_position; ++pos) {
+    if (*pos == first && pos[needle_len - 1] == last) {
+      CODE_UNIT_MEMMEM_VERIFY(pos);
+    }
+  }
+#undef CODE_UNIT_MEMMEM_VERIFY
+  return NULL;
+}
+
+// ============================ multi-value memchr =============================
+
+// private. mask gives a bit for each of the lanes positions starting at pos
+// which might be in the set. if exact, each bit is a match; otherwise each is
+// checked against the set. the rest (fewer than lanes) is given to tail.
+//
+// like code_unit_memmem_filtered, this is inlined into each kernel
+static inline __attribute__((always_inline)) const CODE_UNIT* code_unit_memchr_masked(
+    const CODE_UNIT* ptr,
+    const code_unit_set* set,
+    size_t num,
+    size_t lanes,
+    bool exact,
+    uint64_t (*mask)(const CODE_UNIT* pos, const code_unit_set* set),
+    const CODE_UNIT* (*tail)(const CODE_UNIT* ptr, const code_unit_set* set, size_t num)) {
+  size_t i = 0;
+  for (; num - i >= lanes; i += lanes) {
+    uint64_t found = mask(ptr + i, set);
+    while (found != 0) {
+      const CODE_UNIT* pos = ptr + i + __builtin_ctzll(found);
+      if (exact || code_unit_set_contains(set, *pos)) {
+        return pos;
+      }
+      found &= found - 1;
+    }
+  }
+  return tail(ptr + i, set, num - i);
+}
+
+// private. counts the positions in mask, lanes at a time, with a set of only
+// value. the rest is counted by the scalar kernel.
+//
+// like code_unit_memchr_masked, this is inlined into each kernel
+static inline __attribute__((always_inline)) size_t code_unit_memcount_masked(
+    const CODE_UNIT* ptr,
+    CODE_UNIT value,
+    size_t num,
+    size_t lanes,
+    uint64_t (*mask)(const CODE_UNIT* pos, const code_unit_set* set)) {
+  code_unit_set set; // only the units are used
+  set.units[0] = value;
+  set.num_units = 1;
+  size_t ret = 0;
+  size_t i = 0;
+  for (; num - i >= lanes; i += lanes) {
+    ret += __builtin_popcountll(mask(ptr + i, &set));
+  }
+  return ret + code_unit_memcount_scalar(ptr + i, value, num - i);
+}
+
+#ifdef CODE_UNIT_DISPATCH_X86
+
+// each units mask compares against every unit in the set. for wide code units
+// this is also the set mask, as the nibble tables only apply to bytes
+
+__attribute__((target("sse2"))) static uint64_t code_unit_units_mask_sse2(const CODE_UNIT* pos, const code_unit_set* set) {
+  __m128i v = _mm_loadu_si128((const __m128i*)pos);
+  __m128i eq = _mm_setzero_si128();
+  for (size_t i = 0; i < set->num_units; ++i) {
+#ifdef USE_WCHAR
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(v, _mm_set1_epi32(set->units[i])));
+#else
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, _mm_set1_epi8(set->units[i])));
+#endif
+  }
+#ifdef USE_WCHAR
+  return (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(eq));
+#else
+  return (unsigned int)_mm_movemask_epi8(eq);
+#endif
+}
+
+__attribute__((target("sse2"))) static const CODE_UNIT* code_unit_memchr2_sse2(const CODE_UNIT* ptr, CODE_UNIT value1, CODE_UNIT value2, size_t num) {
+  code_unit_set set; // only the units are used
+  set.units[0] = value1;
+  set.units[1] = value2;
+  set.num_units = 2;
+  return code_unit_memchr_masked(ptr, &set, num, 16 / sizeof(CODE_UNIT), true, code_unit_units_mask_sse2, code_unit_memchr_units_scalar);
+}
+
+__attribute__((target("sse2"))) static const CODE_UNIT* code_unit_memchr3_sse2(const CODE_UNIT* ptr, CODE_UNIT value1, CODE_UNIT value2, CODE_UNIT value3, size_t num) {
+  code_unit_set set; // only the units are used
+  set.units[0] = value1;
+  set.units[1] = value2;
+  set.units[2] = value3;
+  set.num_units = 3;
+  return code_unit_memchr_masked(ptr, &set, num, 16 / sizeof(CODE_UNIT), true, code_unit_units_mask_sse2, code_unit_memchr_units_scalar);
+}
+
+__attribute__((target("sse2"))) static const CODE_UNIT* code_unit_memchr_set_sse2(const CODE_UNIT* ptr, const code_unit_set* set, size_t num) {
+  // pshufb is ssse3, so this compares against each unit
+  return code_unit_memchr_masked(ptr, set, num, 16 / sizeof(CODE_UNIT), true, code_unit_units_mask_sse2, code_unit_memchr_set_scalar);
+}
+
+__attribute__((target("sse2"))) static size_t code_unit_memcount_sse2(const CODE_UNIT* ptr, CODE_UNIT value, size_t num) {
+  return code_unit_memcount_masked(ptr, value, num, 16 / sizeof(CODE_UNIT), code_unit_units_mask_sse2);
+}
+
+__attribute__((target("avx2"))) static uint64_t code_unit_units_mask_avx2(const CODE_UNIT* pos, const code_unit_set* set) {
+  __m256i v = _mm256_loadu_si256((const __m256i*)pos);
+  __m256i eq = _mm256_setzero_si256();
+  for (size_t i = 0; i < set->num_units; ++i) {
+#ifdef USE_WCHAR
+    eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(v, _mm256_set1_epi32(set->units[i])));
+#else
+    eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(set->units[i])));
+#endif
+  }
+#ifdef USE_WCHAR
+  return (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(eq));
+#else
+  return (unsigned int)_mm256_movemask_epi8(eq);
+#endif
+}
+
+#ifndef USE_WCHAR
+// each byte is looked up by its low and high nibble, regardless of the size
+// of the set
+__attribute__((target("avx2"))) static uint64_t code_unit_nibble_mask_avx2(const CODE_UNIT* pos, const code_unit_set* set) {
+  __m256i v = _mm256_loadu_si256((const __m256i*)pos);
+  __m256i low_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set->nibble_low));
+  __m256i high_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set->nibble_high));
+  __m256i nibble = _mm256_set1_epi8(0x0F);
+  __m256i low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(v, nibble));
+  __m256i high = _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+  __m256i none = _mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256());
+  return ~(unsigned int)_mm256_movemask_epi8(none);
+}
+#endif
+
+__attribute__((target("avx2"))) static const CODE_UNIT* code_unit_memchr2_avx2(const CODE_UNIT* ptr, CODE_UNIT value1, CODE_UNIT value2, size_t num) {
+  code_unit_set set; // only the units are used
+  set.units[0] = value1;
+  set.units[1] = value2;
+  set.num_units = 2;
+  return code_unit_memchr_masked(ptr, &set, num, 32 / sizeof(CODE_UNIT), true, code_unit_units_mask_avx2, code_unit_memchr_units_scalar);
+}
+
+__attribute__((target("avx2"))) static const CODE_UNIT* code_unit_memchr3_avx2(const CODE_UNIT* ptr, CODE_UNIT value1, CODE_UNIT value2, CODE_UNIT value3, size_t num) {
+  code_unit_set set; // only the units are used
+  set.units[0] = value1;
+  set.units[1] = value2;
+  set.units[2] = value3;
+  set.num_units = 3;
+  return code_unit_memchr_masked(ptr, &set, num, 32 / sizeof(CODE_UNIT), true, code_unit_units_mask_avx2, code_unit_memchr_units_scalar);
+}
+
+__attribute__((target("avx2"))) static const CODE_UNIT* code_unit_memchr_set_avx2(const CODE_UNIT* ptr, const code_unit_set* set, size_t num) {
+#ifdef USE_WCHAR
+  return code_unit_memchr_masked(ptr, set, num, 32 / sizeof(CODE_UNIT), true, code_unit_units_mask_avx2, code_unit_memchr_set_scalar);
+#else
+  return code_unit_memchr_masked(ptr, set, num, 32, false, code_unit_nibble_mask_avx2, code_unit_memchr_set_scalar);
+#endif
+}
+
+__attribute__((target("avx2"))) static size_t code_unit_memcount_avx2(const CODE_UNIT* ptr, CODE_UNIT value, size_t num) {
+  return code_unit_memcount_masked(ptr, value, num, 32 / sizeof(CODE_UNIT), code_unit_units_mask_avx2);
+}
+
+__attribute__((target("avx512bw"))) static uint64_t code_unit_units_mask_avx512bw(const CODE_UNIT* pos, const code_unit_set* set) {
+  __m512i v = _mm512_loadu_si512((const void*)pos);
+  uint64_t eq = 0;
+  for (size_t i = 0; i < set->num_units; ++i) {
+#ifdef USE_WCHAR
+    eq |= _mm512_cmpeq_epi32_mask(v, _mm512_set1_epi32(set->units[i]));
+#else
+    eq |= _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(set->units[i]));
+#endif
+  }
+  return eq;
+}
+
+#ifndef USE_WCHAR
+__attribute__((target("avx512bw"))) static uint64_t code_unit_nibble_mask_avx512bw(const CODE_UNIT* pos, const code_unit_set* set) {
+  __m512i v = _mm512_loadu_si512((const void*)pos);
+  __m512i low_table = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)set->nibble_low));
+  __m512i high_table = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)set->nibble_high));
+  __m512i nibble = _mm512_set1_epi8(0x0F);
+  __m512i low = _mm512_shuffle_epi8(low_table, _mm512_and_si512(v, nibble));
+  __m512i high = _mm512_shuffle_epi8(high_table, _mm512_and_si512(_mm512_srli_epi16(v, 4), nibble));
+  __m512i both = _mm512_and_si512(low, high);
+  return _mm512_test_epi8_mask(both, both);
+}
+
+#endif
+
+__attribute__((target("avx512bw"))) static const CODE_UNIT* code_unit_memchr2_avx512bw(const CODE_UNIT* ptr, CODE_UNIT value1, CODE_UNIT value2, size_t num) {
+  code_unit_set set; // only the units are used
+  set.units[0] = value1;
+  set.units[1] = value2;
+  set.num_units = 2;
+  return code_unit_memchr_masked(ptr, &set, num, 64 / sizeof(CODE_UNIT), true, code_unit_units_mask_avx512bw, code_unit_memchr_units_scalar);
+}
+
+__attribute__((target("avx512bw"))) static const CODE_UNIT* code_unit_memchr3_avx512bw(const CODE_UNIT* ptr, CODE_UNIT value1, CODE_UNIT value2, CODE_UNIT value3, size_t num) {
+  code_unit_set set; // only the units are used
+  set.units[0] = value1;
+  set.units[1] = value2;
+  set.units[2] = value3;
+  set.num_units = 3;
+  return code_unit_memchr_masked(ptr, &set, num, 64 / sizeof(CODE_UNIT), true, code_unit_units_mask_avx512bw, code_unit_memchr_units_scalar);
+}
+
+__attribute__((target("avx512bw"))) static const CODE_UNIT* code_unit_memchr_set_avx512bw(const CODE_UNIT* ptr, const code_unit_set* set, size_t num) {
+#ifdef USE_WCHAR
+  return code_unit_memchr_masked(ptr, set, num, 64 / sizeof(CODE_UNIT), true, code_unit_units_mask_avx512bw, code_unit_memchr_set_scalar);
+#else
+  return code_unit_memchr_masked(ptr, set, num, 64, false, code_unit_nibble_mask_avx512bw, code_unit_memchr_set_scalar);
+#endif
+}
+
+__attribute__((target("avx512bw"))) static size_t code_unit_memcount_avx512bw(const CODE_UNIT* ptr, CODE_UNIT value, size_t num) {
+  return code_unit_memcount_masked(ptr, value, num, 64 / sizeof(CODE_UNIT), code_unit_units_mask_avx512bw);
+}
+
+__attribute__((target("sse2"))) static uint64_t code_unit_candidates_sse2(const CODE_UNIT* pos, size_t needle_len, CODE_UNIT first, CODE_UNIT last) {
+  __m128i a = _mm_loadu_si128((const __m128i*)pos);
+  __m128i b = _mm_loadu_si128((const __m128i*)(pos + needle_len - 1));
+#ifdef USE_WCHAR
+  __m128i eq = _mm_and_si128(_mm_cmpeq_epi32(a, _mm_set1_epi32(first)), _mm_cmpeq_epi32(b, _mm_set1_epi32(last)));
+  return (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(eq));
+#else
+  __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8(first)), _mm_cmpeq_epi8(b, _mm_set1_epi8(last)));
+  return (unsigned int)_mm_movemask_epi8(eq);
+#endif
+}
+
+__attribute__((target("sse2"))) static const CODE_UNIT* code_unit_memmem_sse2(const CODE_UNIT* haystack, size_t haystack_len, const CODE_UNIT* needle, size_t needle_len) {
+  return code_unit_memmem_filtered(haystack, haystack_len, needle, needle_len, 16 / sizeof(CODE_UNIT), code_unit_candidates_sse2);
+}
+
+__attribute__((target("avx2"))) static uint64_t code_unit_candidates_avx2(const CODE_UNIT* pos, size_t needle_len, CODE_UNIT first, CODE_UNIT last) {
+  __m256i a = _mm256_loadu_si256((const __m256i*)pos);
+  __m256i b = _mm256_loadu_si256((const __m256i*)(pos + needle_len - 1));
+#ifdef USE_WCHAR
+  __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi32(a, _mm256_set1_epi32(first)), _mm256_cmpeq_epi32(b, _mm256_set1_epi32(last)));
+  return (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(eq));
+#else
+  __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(a, _mm256_set1_epi8(first)), _mm256_cmpeq_epi8(b, _mm256_set1_epi8(last)));
+  return (unsigned int)_mm256_movemask_epi8(eq);
+#endif
+}
+
+__attribute__((target("avx2"))) static const CODE_UNIT* code_unit_memmem_avx2(const CODE_UNIT* haystack, size_t haystack_len, const CODE_UNIT* needle, size_t needle_len) {
+  return code_unit_memmem_filtered(haystack, haystack_len, needle, needle_len, 32 / sizeof(CODE_UNIT), code_unit_candidates_avx2);
+}
+
+__attribute__((target("avx512bw"))) static uint64_t code_unit_candidates_avx512bw(const CODE_UNIT* pos, size_t needle_len, CODE_UNIT first, CODE_UNIT last) {
+  __m512i a = _mm512_loadu_si512((const void*)pos);
+  __m512i b = _mm512_loadu_si512((const void*)(pos + needle_len - 1));
+#ifdef USE_WCHAR
+  return _mm512_cmpeq_epi32_mask(a, _mm512_set1_epi32(first)) & _mm512_cmpeq_epi32_mask(b, _mm512_set1_epi32(last));
+#else
+  return _mm512_cmpeq_epi8_mask(a, _mm512_set1_epi8(first)) & _mm512_cmpeq_epi8_mask(b, _mm512_set1_epi8(last));
+#endif
+}
+
+__attribute__((target("avx512bw"))) static const CODE_UNIT* code_unit_memmem_avx512bw(const CODE_UNIT* haystack, size_t haystack_len, const CODE_UNIT* needle, size_t needle_len) {
+  return code_unit_memmem_filtered(haystack, haystack_len, needle, needle_len, 64 / sizeof(CODE_UNIT), code_unit_candidates_avx512bw);
+}
+
+#endif
+
+// ============================= utf-8 decoding ================================
+
+// these decode a prefix of UTF-8 input to characters (see
+// convert_subject_to_wchar_range). the prefix consists only of complete, valid
+// sequences; the end of the prefix is returned, which can be begin. the caller
+// decodes the rest (including any invalid bytes) one sequence at a time.
+// *out is moved forward by the number of characters written
+
+// the portable kernel widens ASCII bytes, up to the first non-ASCII byte
+static const unsigned char* code_unit_utf8_decode_scalar(const unsigned char* begin, const unsigned char* end, wchar_t** out) {
+  wchar_t* pos = *out;
+  while (begin != end && *begin < 0x80) {
+    *pos++ = *begin++;
+  }
+  *out = pos;
+  return begin;
+}
+
+// the vectorized kernels widen to 32 bit characters
+#if defined(CODE_UNIT_DISPATCH_X86) && __SIZEOF_WCHAR_T__ == 4
+
+// widens 16 bytes at a time while they're all ASCII. there's no pshufb in
+// sse2, so multibyte sequences aren't validated here
+__attribute__((target("sse2"))) static const unsigned char* code_unit_utf8_decode_sse2(const unsigned char* begin, const unsigned char* end, wchar_t** out) {
+  const __m128i zero = _mm_setzero_si128();
+  while (end - begin >= 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)begin);
+    int non_ascii = _mm_movemask_epi8(bytes); // top bit of each byte
+    if (non_ascii != 0) {
+      // widen the ASCII prefix before the first non-ASCII byte
+      size_t num_ascii = __builtin_ctz(non_ascii);
+      for (size_t i = 0; i < num_ascii; ++i) {
+        (*out)[i] = begin[i];
+      }
+      *out += num_ascii;
+      return begin + num_ascii;
+    }
+    __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+    __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+    _mm_storeu_si128((__m128i*)(*out + 0), _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128((__m128i*)(*out + 4), _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128((__m128i*)(*out + 8), _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128((__m128i*)(*out + 12), _mm_unpackhi_epi16(hi, zero));
+    *out += 16;
+    begin += 16;
+  }
+  return begin;
+}
+
+// error classes for the avx2 validation. each pair of adjacent bytes is
+// looked up by the high nibble of the first, the low nibble of the first, and
+// the high nibble of the second. the pair is an error if a class is in all
+// three (Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per
+// Byte")
+#define CODE_UNIT_UTF8_TOO_SHORT (1 << 0)      // lead, then a non-continuation
+#define CODE_UNIT_UTF8_TOO_LONG (1 << 1)       // ASCII, then a continuation
+#define CODE_UNIT_UTF8_OVERLONG_3 (1 << 2)     // E0, then 80..9F
+#define CODE_UNIT_UTF8_TOO_LARGE (1 << 3)      // F4, then 90..BF; or F5..FF
+#define CODE_UNIT_UTF8_SURROGATE (1 << 4)      // ED, then A0..BF
+#define CODE_UNIT_UTF8_OVERLONG_2 (1 << 5)     // C0 or C1
+#define CODE_UNIT_UTF8_TOO_LARGE_1000 (1 << 6) // F5..FF, then 80..8F
+#define CODE_UNIT_UTF8_OVERLONG_4 (1 << 6)     // F0, then 80..8F
+#define CODE_UNIT_UTF8_TWO_CONTS (1 << 7)      // continuation, then continuation
+#define CODE_UNIT_UTF8_CARRY (CODE_UNIT_UTF8_TOO_SHORT | CODE_UNIT_UTF8_TOO_LONG | CODE_UNIT_UTF8_TWO_CONTS)
+
+// private. a table for pshufb, in each lane
+#define CODE_UNIT_UTF8_TABLE(...) _mm256_broadcastsi128_si256(_mm_setr_epi8(__VA_ARGS__))
+
+// private. true iff the 32 bytes aren't valid UTF-8, given that they begin
+// at a character boundary. a sequence which is cut off by the end of the
+// bytes isn't an error here
+__attribute__((target("avx2"))) static bool code_unit_utf8_invalid_avx2(__m256i input) {
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  // the bytes before the block are treated as ASCII (zero), as the block
+  // begins at a character boundary. lane crossing: the low lane of input is
+  // moved to the high lane, so alignr can reach the previous bytes
+  __m256i before = _mm256_permute2x128_si256(input, input, 0x08);
+  __m256i prev1 = _mm256_alignr_epi8(input, before, 15);
+  __m256i prev2 = _mm256_alignr_epi8(input, before, 14);
+  __m256i prev3 = _mm256_alignr_epi8(input, before, 13);
+
+  const __m256i byte_1_high_table = CODE_UNIT_UTF8_TABLE(
+      // 0_______ (ASCII)
+      CODE_UNIT_UTF8_TOO_LONG, CODE_UNIT_UTF8_TOO_LONG, CODE_UNIT_UTF8_TOO_LONG, CODE_UNIT_UTF8_TOO_LONG,
+      CODE_UNIT_UTF8_TOO_LONG, CODE_UNIT_UTF8_TOO_LONG, CODE_UNIT_UTF8_TOO_LONG, CODE_UNIT_UTF8_TOO_LONG,
+      // 10______ (continuation)
+      (char)CODE_UNIT_UTF8_TWO_CONTS, (char)CODE_UNIT_UTF8_TWO_CONTS, (char)CODE_UNIT_UTF8_TWO_CONTS, (char)CODE_UNIT_UTF8_TWO_CONTS,
+      // 1100____, 1101____ (two byte lead)
+      CODE_UNIT_UTF8_TOO_SHORT | CODE_UNIT_UTF8_OVERLONG_2,
+      CODE_UNIT_UTF8_TOO_SHORT,
+      // 1110____ (three byte lead)
+      CODE_UNIT_UTF8_TOO_SHORT | CODE_UNIT_UTF8_OVERLONG_3 | CODE_UNIT_UTF8_SURROGATE,
+      // 1111____ (four byte lead)
+      CODE_UNIT_UTF8_TOO_SHORT | CODE_UNIT_UTF8_TOO_LARGE | CODE_UNIT_UTF8_TOO_LARGE_1000 | CODE_UNIT_UTF8_OVERLONG_4);
+  const __m256i byte_1_low_table = CODE_UNIT_UTF8_TABLE(
+      // ____0000
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_OVERLONG_3 | CODE_UNIT_UTF8_OVERLONG_2 | CODE_UNIT_UTF8_OVERLONG_4),
+      // ____0001
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_OVERLONG_2),
+      // ____001_
+      (char)CODE_UNIT_UTF8_CARRY, (char)CODE_UNIT_UTF8_CARRY,
+      // ____0100
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_TOO_LARGE),
+      // ____0101 .. ____1100
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_TOO_LARGE | CODE_UNIT_UTF8_TOO_LARGE_1000),
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_TOO_LARGE | CODE_UNIT_UTF8_TOO_LARGE_1000),
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_TOO_LARGE | CODE_UNIT_UTF8_TOO_LARGE_1000),
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_TOO_LARGE | CODE_UNIT_UTF8_TOO_LARGE_1000),
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_TOO_LARGE | CODE_UNIT_UTF8_TOO_LARGE_1000),
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_TOO_LARGE | CODE_UNIT_UTF8_TOO_LARGE_1000),
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_TOO_LARGE | CODE_UNIT_UTF8_TOO_LARGE_1000),
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_TOO_LARGE | CODE_UNIT_UTF8_TOO_LARGE_1000),
+      // ____1101
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_TOO_LARGE | CODE_UNIT_UTF8_TOO_LARGE_1000 | CODE_UNIT_UTF8_SURROGATE),
+      // ____111_
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_TOO_LARGE | CODE_UNIT_UTF8_TOO_LARGE_1000),
+      (char)(CODE_UNIT_UTF8_CARRY | CODE_UNIT_UTF8_TOO_LARGE | CODE_UNIT_UTF8_TOO_LARGE_1000));
+  const __m256i byte_2_high_table = CODE_UNIT_UTF8_TABLE(
+      // 0_______ (ASCII)
+      CODE_UNIT_UTF8_TOO_SHORT, CODE_UNIT_UTF8_TOO_SHORT, CODE_UNIT_UTF8_TOO_SHORT, CODE_UNIT_UTF8_TOO_SHORT,
+      CODE_UNIT_UTF8_TOO_SHORT, CODE_UNIT_UTF8_TOO_SHORT, CODE_UNIT_UTF8_TOO_SHORT, CODE_UNIT_UTF8_TOO_SHORT,
+      // 1000____
+      (char)(CODE_UNIT_UTF8_TOO_LONG | CODE_UNIT_UTF8_OVERLONG_2 | CODE_UNIT_UTF8_TWO_CONTS | CODE_UNIT_UTF8_OVERLONG_3 | CODE_UNIT_UTF8_TOO_LARGE_1000 | CODE_UNIT_UTF8_OVERLONG_4),
+      // 1001____
+      (char)(CODE_UNIT_UTF8_TOO_LONG | CODE_UNIT_UTF8_OVERLONG_2 | CODE_UNIT_UTF8_TWO_CONTS | CODE_UNIT_UTF8_OVERLONG_3 | CODE_UNIT_UTF8_TOO_LARGE),
+      // 101_____
+      (char)(CODE_UNIT_UTF8_TOO_LONG | CODE_UNIT_UTF8_OVERLONG_2 | CODE_UNIT_UTF8_TWO_CONTS | CODE_UNIT_UTF8_SURROGATE | CODE_UNIT_UTF8_TOO_LARGE),
+      (char)(CODE_UNIT_UTF8_TOO_LONG | CODE_UNIT_UTF8_OVERLONG_2 | CODE_UNIT_UTF8_TWO_CONTS | CODE_UNIT_UTF8_SURROGATE | CODE_UNIT_UTF8_TOO_LARGE),
+      // 11______ (lead)
+      CODE_UNIT_UTF8_TOO_SHORT, CODE_UNIT_UTF8_TOO_SHORT, CODE_UNIT_UTF8_TOO_SHORT, CODE_UNIT_UTF8_TOO_SHORT);
+
+  __m256i byte_1_high = _mm256_shuffle_epi8(byte_1_high_table, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+  __m256i byte_1_low = _mm256_shuffle_epi8(byte_1_low_table, _mm256_and_si256(prev1, nibble));
+  __m256i byte_2_high = _mm256_shuffle_epi8(byte_2_high_table, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+  __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+  // the third and fourth bytes of a sequence must be continuations. those are
+  // the bytes with TWO_CONTS, so a mismatch in either direction is an error
+  __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+  __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+  __m256i must_be_continuation = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+  __m256i error = _mm256_xor_si256(must_be_continuation, special);
+  return !_mm256_testz_si256(error, error);
+}
+
+// 32 bytes are checked at a time. ASCII blocks are widened; other blocks are
+// validated, then each complete sequence in the block is decoded without
+// checks. a block which isn't valid is left to the caller
+__attribute__((target("avx2"))) static const unsigned char* code_unit_utf8_decode_avx2(const unsigned char* begin, const unsigned char* end, wchar_t** out) {
+  wchar_t* pos = *out;
+  while (end - begin >= 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i*)begin);
+    if (_mm256_movemask_epi8(bytes) == 0) {
+      _mm256_storeu_si256((__m256i*)(pos + 0), _mm256_cvtepu8_epi32(_mm256_castsi256_si128(bytes)));
+      _mm256_storeu_si256((__m256i*)(pos + 8), _mm256_cvtepu8_epi32(_mm_srli_si128(_mm256_castsi256_si128(bytes), 8)));
+      _mm256_storeu_si256((__m256i*)(pos + 16), _mm256_cvtepu8_epi32(_mm256_extracti128_si256(bytes, 1)));
+      _mm256_storeu_si256((__m256i*)(pos + 24), _mm256_cvtepu8_epi32(_mm_srli_si128(_mm256_extracti128_si256(bytes, 1), 8)));
+      pos += 32;
+      begin += 32;
+      continue;
+    }
+    if (code_unit_utf8_invalid_avx2(bytes)) break;
+    // a sequence cut off by the end of the block is left for the next block.
+    // the block begins with a complete sequence, so there's progress
+    const unsigned char* block_end = begin + 32;
+    while (begin != block_end) {
+      unsigned char b0 = begin[0];
+      if (b0 < 0x80) {
+        *pos++ = b0;
+        begin += 1;
+        continue;
+      }
+      size_t len = b0 < 0xE0 ? 2 : b0 < 0xF0 ? 3 : 4;
+      if ((size_t)(block_end - begin) < len) break;
+      wchar_t ch = b0 & (0x7F >> len);
+      for (size_t i = 1; i < len; ++i) {
+        ch = (ch << 6) | (begin[i] & 0x3F);
+      }
+      *pos++ = ch;
+      begin += len;
+    }
+  }
+  *out = pos;
+  return begin;
+}
+
+#else
+#define code_unit_utf8_decode_sse2 code_unit_utf8_decode_scalar
+#define code_unit_utf8_decode_avx2 code_unit_utf8_decode_scalar
+#endif
+
+// ================================ dispatch ===================================
+
+static const code_unit_kernel_set code_unit_kernels_scalar = {
+    CODE_UNIT_ISA_SCALAR,
+    code_unit_memcmp_scalar,
+    code_unit_memmem_scalar,
+    code_unit_memchr_scalar,
+    code_unit_memchr2_scalar,
+    code_unit_memchr3_scalar,
+    code_unit_memchr_set_scalar,
+    code_unit_memcount_scalar,
+    code_unit_incomplete_suffix_scalar,
+    code_unit_utf8_decode_scalar,
+};
+
+#ifdef CODE_UNIT_DISPATCH_X86
+static const code_unit_kernel_set code_unit_kernels_sse2 = {
+    CODE_UNIT_ISA_SSE2,
+    code_unit_memcmp_libc,
+    code_unit_memmem_sse2,
+    code_unit_memchr_libc,
+    code_unit_memchr2_sse2,
+    code_unit_memchr3_sse2,
+    code_unit_memchr_set_sse2,
+    code_unit_memcount_sse2,
+    code_unit_incomplete_suffix_scalar,
+    code_unit_utf8_decode_sse2,
+};
+
+static const code_unit_kernel_set code_unit_kernels_avx2 = {
+    CODE_UNIT_ISA_AVX2,
+    code_unit_memcmp_libc,
+    code_unit_memmem_avx2,
+    code_unit_memchr_libc,
+    code_unit_memchr2_avx2,
+    code_unit_memchr3_avx2,
+    code_unit_memchr_set_avx2,
+    code_unit_memcount_avx2,
+    code_unit_incomplete_suffix_scalar,
+    code_unit_utf8_decode_avx2,
+};
+
+static const code_unit_kernel_set code_unit_kernels_avx512bw = {
+    CODE_UNIT_ISA_AVX512BW,
+    code_unit_memcmp_libc,
+    code_unit_memmem_avx512bw,
+    code_unit_memchr_libc,
+    code_unit_memchr2_avx512bw,
+    code_unit_memchr3_avx512bw,
+    code_unit_memchr_set_avx512bw,
+    code_unit_memcount_avx512bw,
+    code_unit_incomplete_suffix_scalar,
+    code_unit_utf8_decode_avx2,
+};
+#endif
+
+// the bound kernels. before startup dispatch, the portable ones
+code_unit_kernel_set code_unit_kernels = {
+    CODE_UNIT_ISA_SCALAR,
+    code_unit_memcmp_scalar,
+    code_unit_memmem_scalar,
+    code_unit_memchr_scalar,
+    code_unit_memchr2_scalar,
+    code_unit_memchr3_scalar,
+    code_unit_memchr_set_scalar,
+    code_unit_memcount_scalar,
+    code_unit_incomplete_suffix_scalar,
+    code_unit_utf8_decode_scalar,
+};
+
+// the best instruction set which the cpu supports
+code_unit_isa code_unit_isa_detect() {
+#ifdef CODE_UNIT_DISPATCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw")) return CODE_UNIT_ISA_AVX512BW;
+  if (__builtin_cpu_supports("avx2")) return CODE_UNIT_ISA_AVX2;
+  if (__builtin_cpu_supports("sse2")) return CODE_UNIT_ISA_SSE2;
+#endif
+  return CODE_UNIT_ISA_SCALAR;
+}
+
+// the limit given by the environment variable CODE_UNIT_ISA, or the last if
+// it's not set (or not recognized)
+code_unit_isa code_unit_isa_from_env() {
+  const char* value = getenv("CODE_UNIT_ISA");
+  if (value == NULL) return CODE_UNIT_ISA_AVX512BW;
+  if (strcmp(value, "scalar") == 0) return CODE_UNIT_ISA_SCALAR;
+  if (strcmp(value, "sse2") == 0) return CODE_UNIT_ISA_SSE2;
+  if (strcmp(value, "avx2") == 0) return CODE_UNIT_ISA_AVX2;
+  return CODE_UNIT_ISA_AVX512BW;
+}
+
+// bind the best kernels which the cpu supports, up to limit. returns the
+// instruction set which was bound.
+//
+// this isn't thread safe; it's done at startup, or else before any other
+// threads use the primitives
+code_unit_isa code_unit_dispatch(code_unit_isa limit) {
+  code_unit_isa isa = code_unit_isa_detect();
+  if (isa > limit) isa = limit;
+  switch (isa) {
+#ifdef CODE_UNIT_DISPATCH_X86
+    case CODE_UNIT_ISA_AVX512BW:
+      code_unit_kernels = code_unit_kernels_avx512bw;
+      break;
+    case CODE_UNIT_ISA_AVX2:
+      code_unit_kernels = code_unit_kernels_avx2;
+      break;
+    case CODE_UNIT_ISA_SSE2:
+      code_unit_kernels = code_unit_kernels_sse2;
+      break;
+#endif
+    default:
+      code_unit_kernels = code_unit_kernels_scalar;
+      break;
+  }
+  return code_unit_kernels.isa;
+}
+
+// private
+__attribute__((constructor)) static void code_unit_dispatch_at_startup(void) {
+  code_unit_dispatch(code_unit_isa_from_env());
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <stddef.h>
+#include "character/code_unit.h"
+
+// a literal needle is searched for by its rarest code unit: the haystack is
+// scanned for that unit (with the vectorized code_unit_memchr), and the full
+// needle is verified around each hit. for needles of common letters, this
+// gives far fewer candidates than the needle's first unit would.
+//
+// how rare a unit is comes from a table of byte frequencies, which is built in
+// for typical text (english, source code, logs), and can instead be computed
+// from a sample of the text to be searched (code_unit_frequency_from_sample)
+
+// the rank of each byte value by how common it is: 255 is the most common and
+// 0 is the rarest
+unsigned char code_unit_frequency_rank[256] = {
+     29,  28,  27,  26,  25,  24,  23,  22,  21, 178, 228,  20,  19, 158,  18,  17, // 0x00
+     16,  15,  14,  13,  12,  11,  10,   9,   8,   7,   6,   5,   4,   3,   2,   1, // 0x10
+    255, 165, 184, 171, 168, 167, 169, 183, 182, 181, 173, 172, 226, 221, 227, 219, // 0x20
+    225, 224, 223, 218, 217, 216, 215, 214, 213, 212, 222, 177, 174, 185, 176, 166, // 0x30
+    170, 208, 194, 202, 201, 211, 196, 195, 197, 207, 188, 190, 203, 200, 205, 204, // 0x40
+    199, 187, 206, 209, 210, 198, 192, 193, 189, 191, 186, 180, 162, 179, 160, 220, // 0x50
+    159, 252, 235, 243, 244, 254, 240, 238, 246, 250, 231, 233, 245, 241, 249, 251, // 0x60
+    239, 230, 247, 248, 253, 242, 234, 237, 232, 236, 229, 164, 175, 163, 161,   0, // 0x70
+    155, 149, 148, 147, 146, 145, 144, 143, 142, 141, 140, 139, 138, 137, 136, 135, // 0x80
+    134, 133, 132, 131, 130, 129, 128, 127, 126, 152, 125, 124, 154, 153, 123, 122, // 0x90
+    150, 121, 120, 119, 118, 117, 116, 115, 114, 151, 113, 112, 111, 110, 109, 108, // 0xA0
+    107, 106, 105, 104, 103, 102, 101, 100,  99,  98,  97,  96,  95,  94,  93,  92, // 0xB0
+     91,  90,  89, 157,  88,  87,  86,  85,  84,  83,  82,  81,  80,  79,  78,  77, // 0xC0
+     76,  75,  74,  73,  72,  71,  70,  69,  68,  67,  66,  65,  64,  63,  62,  61, // 0xD0
+     60,  59, 156,  58,  57,  56,  55,  54,  53,  52,  51,  50,  49,  48,  47,  46, // 0xE0
+     45,  44,  43,  42,  41,  40,  39,  38,  37,  36,  35,  34,  33,  32,  31,  30, // 0xF0
+};
+
+// wide code units beyond a byte aren't in the table. they're assumed rare
+#define CODE_UNIT_FREQUENCY_WIDE 16
+
+unsigned char code_unit_frequency(CODE_UNIT unit) {
+#ifdef USE_WCHAR
+  if ((unsigned long)unit > 0xFF) {
+    return CODE_UNIT_FREQUENCY_WIDE;
+  }
+#endif
+  return code_unit_frequency_rank[(unsigned char)unit];
+}
+
+// how unlikely the unit is at a given position, as -log2 of its probability
+// in sixteenths of a bit. the ranks are taken as a geometric scale: the most
+// common unit is about one in seven, and each rank below is rarer by a
+// sixteenth of a bit. this is only used to compare parts of a pattern
+size_t code_unit_rarity(CODE_UNIT unit) {
+  return 44 + (255 - code_unit_frequency(unit));
+}
+
+// replace the ranks with those computed from a sample of the text to be
+// searched. bytes which have the same count in the sample keep their previous
+// relative order. this affects patterns which are set up afterward
+void code_unit_frequency_from_sample(const char* sample, size_t sample_len) {
+  size_t counts[256] = {0};
+  for (size_t i = 0; i < sample_len; ++i) {
+    ++counts[(unsigned char)sample[i]];
+  }
+
+  // byte values from rarest to most common. insertion sort; it's only 256
+  unsigned char order[256];
+  for (size_t i = 0; i < 256; ++i) {
+    size_t j = i;
+    while (j != 0) {
+      unsigned char prev = order[j - 1];
+      bool less = counts[i] != counts[prev] ? counts[i] < counts[prev] //
+                                             : code_unit_frequency_rank[i] < code_unit_frequency_rank[prev];
+      if (!less) break;
+      order[j] = prev;
+      --j;
+    }
+    order[j] = (unsigned char)i;
+  }
+  for (size_t i = 0; i < 256; ++i) {
+    code_unit_frequency_rank[order[i]] = (unsigned char)i;
+  }
+}
+
+// choose the rarest unit in the needle, and the rarest unit which differs from
+// it (or if there isn't one, any other position). gives their positions in
+// the needle. needle_len must be nonzero
+void code_unit_rarest_pair(const CODE_UNIT* needle, size_t needle_len, size_t* rare1, size_t* rare2) {
+  assert(needle_len != 0);
+  size_t first = 0;
+  for (size_t i = 1; i < needle_len; ++i) {
+    if (code_unit_frequency(needle[i]) < code_unit_frequency(needle[first])) {
+      first = i;
+    }
+  }
+  size_t second = first == 0 ? needle_len - 1 : 0;
+  bool second_differs = false;
+  for (size_t i = 0; i < needle_len; ++i) {
+    if (i == first || needle[i] == needle[first]) continue;
+    if (!second_differs || code_unit_frequency(needle[i]) < code_unit_frequency(needle[second])) {
+      second = i;
+      second_differs = true;
+    }
+  }
+  *rare1 = first;
+  *rare2 = second;
+}
+
+// same as code_unit_memmem, but anchored on the needle's rarest units (see
+// code_unit_rarest_pair). if the rare unit turns out to be common in this
+// haystack, the rest is left to code_unit_memmem
+const CODE_UNIT* code_unit_memmem_rare(const CODE_UNIT* haystack, //
+                                       size_t haystack_len,
+                                       const CODE_UNIT* needle,
+                                       size_t needle_len,
+                                       size_t rare1,
+                                       size_t rare2) {
+  if (needle_len <= 1 || haystack_len < needle_len) {
+    return code_unit_memmem(haystack, haystack_len, needle, needle_len);
+  }
+  assert(rare1 < needle_len && rare2 < needle_len);
+  CODE_UNIT unit1 = needle[rare1];
+  CODE_UNIT unit2 = needle[rare2];
+  const CODE_UNIT* pos = haystack; // the next candidate to consider
+  const CODE_UNIT* last_position = haystack + haystack_len - needle_len;
+  size_t num_hits = 0;
+  size_t verify_work = 0;
+  while (pos <= last_position) {
+    const CODE_UNIT* hit = code_unit_memchr(pos + rare1, unit1, last_position - pos + 1);
+    if (hit == NULL) {
+      return NULL;
+    }
+    const CODE_UNIT* candidate = hit - rare1;
+    if (candidate[rare2] == unit2) {
+      if (code_unit_memcmp(candidate, needle, needle_len) == 0) {
+        return candidate;
+      }
+      verify_work += needle_len;
+    }
+    pos = candidate + 1;
+    size_t scanned = pos - haystack;
+    if (unlikely(++num_hits > 8 + scanned / 8 || verify_work > 2 * scanned + 8 * needle_len)) {
+      // too many hits; each costs a call
+      return code_unit_memmem(pos, haystack_len - scanned, needle, needle_len);
+    }
+  }
+  return NULL;
+}
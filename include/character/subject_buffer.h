@@ -3,7 +3,14 @@
 #include <stdio.h>
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "code_unit.h"
 
 #include "basic/likely_unlikely.h"
@@ -37,16 +44,61 @@ extern size_t fread_wrapper(void* ptr, size_t size, size_t nmemb, FILE* stream)
   fread_wrapper_data += num_bytes_to_give;
   return num_bytes_to_give;
 }
+
+// same mock data as fread_wrapper. gives at most read_wrapper_max_chunk bytes
+// per call, to mimic the short reads from a pipe
+extern size_t read_wrapper_max_chunk;
+
+extern ssize_t read_wrapper(int fd, void* ptr, size_t count) {
+  assert(fd == -1);
+  #ifdef NDEBUG
+    (void)(fd);
+  #endif
+  if (count > read_wrapper_max_chunk) {
+    count = read_wrapper_max_chunk;
+  }
+  return fread_wrapper(ptr, sizeof(char), count, NULL);
+}
 #else
 size_t fread_wrapper(void* ptr, size_t size, size_t nmemb, FILE* stream) {
   return fread(ptr, size, nmemb, stream);
 }
+
+ssize_t read_wrapper(int fd, void* ptr, size_t count) {
+  return read(fd, ptr, count);
+}
 #endif
 
+// where the subject buffer's content comes from
+typedef enum {
+  SUBJECT_BUFFER_SOURCE_FILE, // streamed from input_file with fread_wrapper
+  SUBJECT_BUFFER_SOURCE_FD,   // streamed from input_fd with read_wrapper
+  SUBJECT_BUFFER_SOURCE_MMAP, // regular file which is mapped in its entirety
+  SUBJECT_BUFFER_SOURCE_CALLBACK, // characters produced by input_callback
+} subject_buffer_source;
+
+// gives up to n characters of input into dst. returns the number given, which
+// is less than n only at the end of the input
+typedef size_t (*subject_buffer_input_callback)(void* ctx, CODE_UNIT* dst, size_t n);
+
+// subject_buffer_state pin, when nothing is pinned
+#define SUBJECT_BUFFER_NO_PIN UINT64_MAX
+
+// called before the subject buffer shifts, after which anything before the
+// match offset minus the lookbehind is discarded, and the rest might be moved
+typedef void (*subject_buffer_shift_callback)(void* ctx);
+
+struct subject_buffer_prefetch; // forward declare
+
 // the subject is the input to be processed by a pattern
 // this handles the state of that buffer.
 typedef struct {
-  FILE* input_file;
+  subject_buffer_source source;
+  FILE* input_file;      // SUBJECT_BUFFER_SOURCE_FILE
+  int input_fd;          // SUBJECT_BUFFER_SOURCE_FD
+  // SUBJECT_BUFFER_SOURCE_CALLBACK
+  subject_buffer_input_callback input_callback;
+  void* input_callback_ctx;
   size_t capacity;       // the number of bytes to read at a time from the file
   size_t max_lookbehind; // the number of characters before the match offset that the pattern might evaluate
 
@@ -54,6 +106,27 @@ typedef struct {
   // points to capacity elements
   char* byte_buffer___;
 
+  // SUBJECT_BUFFER_SOURCE_MMAP. the mapping of the entire input file.
+  // mapping_pos___ is the number of bytes of the mapping which have been
+  // consumed (only moves when decoding to wchar_t)
+  char* mapping___;
+  size_t mapping_size___;
+  size_t mapping_pos___;
+
+  // ring buffer (see init_subject_buffer_ring). points to the reservation of
+  // both adjacent mappings of the subject buffer, or NULL if not used.
+  // ring_begin___ is the index within the subject buffer at which the subject
+  // segment begins
+  void* ring___;
+  size_t ring_begin___;
+
+  // see subject_buffer_start_prefetch. NULL if not used
+  struct subject_buffer_prefetch* prefetch___;
+
+  // NULL if not used
+  subject_buffer_shift_callback shift_callback;
+  void* shift_callback_ctx;
+
 #ifdef USE_WCHAR
   // if using wchar_t, the bytes from byte_buffer___ are transformed into
   // characters and placed here. points to capacity elements
@@ -61,8 +134,13 @@ typedef struct {
 
   // decode state when converting bytes from the byte buffer to characters in
   // the character_buffer___
-  mbstate_t ps;
+  utf8_decode_state ps;
   bool skip_invalid;
+  // characters which were decoded, but which didn't fit in the segment.
+  // they're given first on the next fill
+  wchar_t carry___[4];
+  size_t carry_begin___;
+  size_t num_carry___;
 #endif
 
 #ifdef USE_WCHAR
@@ -77,6 +155,16 @@ typedef struct {
 
   // match offset within the subject buffer
   size_t offset;
+
+  // the number of characters of the input which were discarded before the
+  // beginning of the subject segment. the position of the match offset within
+  // the entire input is stream_offset + offset
+  uint64_t stream_offset;
+
+  // a position within the entire input, from which the content is retained
+  // when shifting even if it's before the lookbehind (see
+  // subject_buffer_shift_and_get_input). SUBJECT_BUFFER_NO_PIN if not used
+  uint64_t pin;
 } subject_buffer_state;
 
 // the number of characters within the buffer that is at or after the match offset
@@ -90,9 +178,9 @@ CODE_UNIT* subject_buffer_start(subject_buffer_state* buf) {
   assert(buf->offset <= buf->size);
   assert(buf->size <= buf->capacity);
 #ifdef USE_WCHAR
-  return buf->character_buffer___;
+  return buf->character_buffer___ + buf->ring_begin___;
 #else
-  return buf->byte_buffer___;
+  return buf->byte_buffer___ + buf->ring_begin___;
 #endif
 }
 
@@ -115,14 +203,26 @@ CODE_UNIT* subject_buffer_end(subject_buffer_state* buf) {
 // both buffers point to allocation with capacity number of elements
 // buf->input_file must be set
 void init_subject_buffer(subject_buffer_state* buf, size_t capacity, char* byte_buffer, wchar_t* character_buffer, size_t max_lookbehind) {
+  buf->source = SUBJECT_BUFFER_SOURCE_FILE;
   buf->input_file = NULL;
+  buf->input_fd = -1;
+  buf->input_callback = NULL;
+  buf->input_callback_ctx = NULL;
   buf->capacity = capacity;
   buf->max_lookbehind = max_lookbehind;
   buf->byte_buffer___ = byte_buffer;
+  buf->mapping___ = NULL;
+  buf->mapping_size___ = 0;
+  buf->mapping_pos___ = 0;
+  buf->ring___ = NULL;
+  buf->ring_begin___ = 0;
+  buf->prefetch___ = NULL;
+  buf->shift_callback = NULL;
+  buf->shift_callback_ctx = NULL;
   buf->character_buffer___ = character_buffer;
   // ps zero set on first input
   buf->skip_invalid = false;
-  // size, offset set on first input
+  // size, offset, stream_offset set on first input
   assert(buf->capacity > 0);
   assert(buf->max_lookbehind < buf->capacity);
 }
@@ -130,36 +230,637 @@ void init_subject_buffer(subject_buffer_state* buf, size_t capacity, char* byte_
 // byte_buffer points to allocation with capacity number of elements
 // buf->input_file must be set
 void init_subject_buffer(subject_buffer_state* buf, size_t capacity, char* byte_buffer, size_t max_lookbehind) {
+  buf->source = SUBJECT_BUFFER_SOURCE_FILE;
   buf->input_file = NULL;
+  buf->input_fd = -1;
+  buf->input_callback = NULL;
+  buf->input_callback_ctx = NULL;
   buf->capacity = capacity;
   buf->max_lookbehind = max_lookbehind;
   buf->byte_buffer___ = byte_buffer;
+  buf->mapping___ = NULL;
+  buf->mapping_size___ = 0;
+  buf->mapping_pos___ = 0;
+  buf->ring___ = NULL;
+  buf->ring_begin___ = 0;
+  buf->prefetch___ = NULL;
+  buf->shift_callback = NULL;
+  buf->shift_callback_ctx = NULL;
   // ps zero set on first input
-  // size, offset set on first input
+  // size, offset, stream_offset set on first input
   assert(buf->capacity > 0);
   assert(buf->max_lookbehind < buf->capacity);
 }
 #endif
 
+// private. map the entirety of a regular file.
+// returns false if fd isn't a regular file, or on error (an appropriate error
+// will have been printed to stderr)
+static bool subject_buffer_map_file(subject_buffer_state* buf, int fd) {
+  struct stat st;
+  if (unlikely(fstat(fd, &st) == -1)) {
+    perror("fstat");
+    return false;
+  }
+
+  if (!S_ISREG(st.st_mode)) {
+    return false; // pipes, sockets, ttys, etc. must be streamed
+  }
+
+  buf->source = SUBJECT_BUFFER_SOURCE_MMAP;
+  buf->input_file = NULL;
+  buf->input_fd = -1;
+  buf->input_callback = NULL;
+  buf->input_callback_ctx = NULL;
+  buf->mapping___ = NULL;
+  buf->mapping_size___ = st.st_size;
+  buf->mapping_pos___ = 0;
+
+  if (buf->mapping_size___ == 0) {
+    return true; // can't map zero length. nothing to read anyways
+  }
+
+  // the subject is never written to
+  void* mapping = mmap(NULL, buf->mapping_size___, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (unlikely(mapping == MAP_FAILED)) {
+    perror("mmap");
+    return false;
+  }
+  // advisory only. failure is inconsequential
+  madvise(mapping, buf->mapping_size___, MADV_SEQUENTIAL);
+  buf->mapping___ = (char*)mapping;
+  return true;
+}
+
+#ifdef USE_WCHAR
+// alternative to init_subject_buffer for regular files. the file is mapped
+// instead of being read, which removes the copy from the file into the byte
+// buffer; the mapping is decoded directly into character_buffer, which points
+// to an allocation with capacity number of elements.
+//
+// returns false if fd isn't a regular file or on error; the caller should
+// instead stream the input with init_subject_buffer
+//
+// the mapping is released by deinit_subject_buffer
+bool init_subject_buffer_mmap(subject_buffer_state* buf, int fd, size_t capacity, wchar_t* character_buffer, size_t max_lookbehind) {
+  init_subject_buffer(buf, capacity, NULL, character_buffer, max_lookbehind);
+  return subject_buffer_map_file(buf, fd);
+}
+#else
+// alternative to init_subject_buffer for regular files. the entire file is
+// mapped and becomes the subject; there are never any shifts or copies, and
+// subject_buffer_get_first_input always indicates that the input is complete.
+//
+// returns false if fd isn't a regular file or on error; the caller should
+// instead stream the input with init_subject_buffer
+//
+// the mapping is released by deinit_subject_buffer
+bool init_subject_buffer_mmap(subject_buffer_state* buf, int fd, size_t max_lookbehind) {
+  // stays a file source if fd can't be mapped
+  buf->source = SUBJECT_BUFFER_SOURCE_FILE;
+  buf->input_file = NULL;
+  buf->input_fd = -1;
+  buf->input_callback = NULL;
+  buf->input_callback_ctx = NULL;
+  buf->mapping___ = NULL;
+  buf->mapping_size___ = 0;
+  buf->mapping_pos___ = 0;
+  buf->capacity = 0;
+  buf->max_lookbehind = max_lookbehind;
+  buf->byte_buffer___ = NULL;
+  buf->ring___ = NULL;
+  buf->ring_begin___ = 0;
+  buf->prefetch___ = NULL;
+  buf->shift_callback = NULL;
+  buf->shift_callback_ctx = NULL;
+  if (!subject_buffer_map_file(buf, fd)) {
+    return false;
+  }
+  // the whole mapping is the subject
+  buf->capacity = buf->mapping_size___;
+  buf->byte_buffer___ = buf->mapping___;
+  return true;
+}
+#endif
+
+// alternative to init_subject_buffer, where the input is produced by
+// callback instead of being read from a file. the characters are given as is
+// (for USE_WCHAR they're already decoded). subject_buffer points to an
+// allocation with capacity number of elements
+void init_subject_buffer_callback(subject_buffer_state* buf,
+                                  size_t capacity,
+                                  CODE_UNIT* subject_buffer,
+                                  size_t max_lookbehind,
+                                  subject_buffer_input_callback callback,
+                                  void* ctx) {
+#ifdef USE_WCHAR
+  init_subject_buffer(buf, capacity, NULL, subject_buffer, max_lookbehind);
+#else
+  init_subject_buffer(buf, capacity, subject_buffer, max_lookbehind);
+#endif
+  buf->source = SUBJECT_BUFFER_SOURCE_CALLBACK;
+  buf->input_callback = callback;
+  buf->input_callback_ctx = ctx;
+}
+
+// private. tell the kernel that fd will be read sequentially from its current
+// position. advisory only; failure (e.g. for a pipe) is inconsequential
+static void subject_buffer_sequential_hints(int fd, size_t capacity) {
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  off_t position = lseek(fd, 0, SEEK_CUR);
+  if (position != -1) {
+    // start loading the first few segments
+    readahead(fd, position, 4 * capacity);
+  }
+}
+
+#ifdef USE_WCHAR
+// alternative to init_subject_buffer, which streams from a file descriptor
+// with read(2) instead of from a FILE*. this skips the stdio buffer (and its
+// lock); bytes are read directly into byte_buffer.
+void init_subject_buffer_fd(subject_buffer_state* buf, int fd, size_t capacity, char* byte_buffer, wchar_t* character_buffer, size_t max_lookbehind) {
+  init_subject_buffer(buf, capacity, byte_buffer, character_buffer, max_lookbehind);
+#else
+// alternative to init_subject_buffer, which streams from a file descriptor
+// with read(2) instead of from a FILE*. this skips the stdio buffer (and its
+// lock); bytes are read directly into the subject buffer.
+void init_subject_buffer_fd(subject_buffer_state* buf, int fd, size_t capacity, char* byte_buffer, size_t max_lookbehind) {
+  init_subject_buffer(buf, capacity, byte_buffer, max_lookbehind);
+#endif
+  buf->source = SUBJECT_BUFFER_SOURCE_FD;
+  buf->input_fd = fd;
+  subject_buffer_sequential_hints(fd, capacity);
+}
+
+// the capacity of a ring buffer must be a multiple of this many elements
+size_t subject_buffer_ring_granularity() {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  assert(page_size % sizeof(CODE_UNIT) == 0);
+  return page_size / sizeof(CODE_UNIT);
+}
+
+// the smallest valid ring buffer capacity which is at least min_capacity
+size_t subject_buffer_ring_capacity(size_t min_capacity) {
+  size_t granularity = subject_buffer_ring_granularity();
+  if (min_capacity == 0) min_capacity = 1;
+  return ((min_capacity + granularity - 1) / granularity) * granularity;
+}
+
+// private. create a memory file of the given size, mapped twice at adjacent
+// virtual addresses. a range which runs past the end of the first mapping
+// continues contiguously into the beginning of the file via the second.
+// returns NULL on error (an appropriate error will have been printed to stderr)
+static void* subject_buffer_map_ring(size_t size_bytes) {
+  void* ret = NULL;
+  char* reservation = MAP_FAILED;
+  int fd = memfd_create("subject_buffer_ring", 0);
+  if (unlikely(fd == -1)) {
+    perror("memfd_create");
+    goto end;
+  }
+
+  if (unlikely(ftruncate(fd, size_bytes) == -1)) {
+    perror("ftruncate");
+    goto end;
+  }
+
+  // reserve a contiguous address range for both mappings
+  reservation = (char*)mmap(NULL, 2 * size_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (unlikely(reservation == MAP_FAILED)) {
+    perror("mmap");
+    goto end;
+  }
+
+  for (size_t i = 0; i < 2; ++i) {
+    void* half = mmap(reservation + i * size_bytes, size_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+    if (unlikely(half == MAP_FAILED)) {
+      perror("mmap");
+      munmap(reservation, 2 * size_bytes);
+      goto end;
+    }
+  }
+
+  ret = reservation;
+end:
+  if (fd != -1) {
+    close(fd); // the mappings keep the memory file alive
+  }
+  return ret;
+}
+
+#ifdef USE_WCHAR
+// alternative to init_subject_buffer, in which the character buffer is a ring.
+// subject_buffer_shift_and_get_input moves where the subject segment begins
+// instead of moving the retained characters back to the beginning of the
+// buffer; the ranges given by subject_buffer_start, subject_buffer_offset and
+// subject_buffer_end are still contiguous.
+//
+// capacity must be a multiple of subject_buffer_ring_granularity (see
+// subject_buffer_ring_capacity). byte_buffer points to an allocation with
+// capacity number of elements. buf->input_file must be set
+//
+// returns false on error. the ring is released by deinit_subject_buffer
+bool init_subject_buffer_ring(subject_buffer_state* buf, size_t capacity, char* byte_buffer, size_t max_lookbehind) {
+  init_subject_buffer(buf, capacity, byte_buffer, NULL, max_lookbehind);
+#else
+// alternative to init_subject_buffer, in which the byte buffer is a ring.
+// subject_buffer_shift_and_get_input moves where the subject segment begins
+// instead of moving the retained bytes back to the beginning of the buffer;
+// the ranges given by subject_buffer_start, subject_buffer_offset and
+// subject_buffer_end are still contiguous.
+//
+// capacity must be a multiple of subject_buffer_ring_granularity (see
+// subject_buffer_ring_capacity). buf->input_file must be set
+//
+// returns false on error. the ring is released by deinit_subject_buffer
+bool init_subject_buffer_ring(subject_buffer_state* buf, size_t capacity, size_t max_lookbehind) {
+  init_subject_buffer(buf, capacity, NULL, max_lookbehind);
+#endif
+  if (unlikely(capacity % subject_buffer_ring_granularity() != 0)) {
+    assert(false);
+    return false;
+  }
+
+  void* ring = subject_buffer_map_ring(capacity * sizeof(CODE_UNIT));
+  if (unlikely(ring == NULL)) {
+    return false;
+  }
+  buf->ring___ = ring;
+#ifdef USE_WCHAR
+  buf->character_buffer___ = (wchar_t*)ring;
+#else
+  buf->byte_buffer___ = (char*)ring;
+#endif
+  return true;
+}
+
+// private. read up to n bytes from the streamed input into dst.
+// returns the number of bytes read, which is less than n only on eof or error
+static size_t subject_buffer_read(subject_buffer_state* buf, char* dst, size_t n) {
+  if (buf->source == SUBJECT_BUFFER_SOURCE_FILE) {
+    return fread_wrapper(dst, sizeof(char), n, buf->input_file);
+  }
+
+  assert(buf->source == SUBJECT_BUFFER_SOURCE_FD);
+  // read(2) can give less than requested (e.g. from a pipe)
+  size_t ret = 0;
+  while (ret != n) {
+    ssize_t read_ret = read_wrapper(buf->input_fd, dst + ret, n - ret);
+    if (read_ret > 0) {
+      ret += read_ret;
+    } else if (read_ret == 0) {
+      break; // eof
+    } else if (errno != EINTR) {
+      break; // error
+    }
+  }
+  return ret;
+}
+
+#ifdef USE_WCHAR
+// private. get up to n bytes of input, to be decoded.
+// dst points to n elements, and might be used as the location of the output.
+// the returned pointer points to the bytes, and *read_ret is the number of
+// bytes obtained (which is less than n on eof or error)
+static const char* subject_buffer_read_bytes(subject_buffer_state* buf, char* dst, size_t n, size_t* read_ret) {
+  if (buf->source == SUBJECT_BUFFER_SOURCE_MMAP) {
+    // no copy. point directly into the mapping
+    size_t mapping_remaining = buf->mapping_size___ - buf->mapping_pos___;
+    *read_ret = n < mapping_remaining ? n : mapping_remaining;
+    const char* ret = buf->mapping___ + buf->mapping_pos___;
+    buf->mapping_pos___ += *read_ret;
+    return ret;
+  }
+  *read_ret = subject_buffer_read(buf, dst, n);
+  return dst;
+}
+
+// private. read and decode input into dst, until n characters are given or
+// the input ends. returns the number of characters given, which is less than n
+// only once the input is complete.
+//
+// a multibyte sequence can decode to fewer characters than bytes, so this
+// reads until the characters fill dst; otherwise, a segment which isn't the
+// last might not be full
+static size_t subject_buffer_decode(subject_buffer_state* buf, wchar_t* dst, size_t n) {
+  size_t num_produced = 0;
+  bool input_complete = false;
+  while (num_produced != n) {
+    if (buf->num_carry___ != 0) {
+      dst[num_produced++] = buf->carry___[buf->carry_begin___++];
+      --buf->num_carry___;
+      continue;
+    }
+    if (input_complete) {
+      break;
+    }
+
+    // a byte gives at most one character, aside from the pending bytes of an
+    // incomplete sequence from before, which might each give one if invalid.
+    // if there isn't room for that, decode a single byte to the carry instead
+    size_t room = n - num_produced;
+    bool to_carry = room <= buf->ps.num_pending;
+    size_t num_to_read = to_carry ? 1 : room - buf->ps.num_pending;
+    size_t read_ret;
+    const char* bytes = subject_buffer_read_bytes(buf, subject_processing_buffer(buf), num_to_read, &read_ret);
+    input_complete = read_ret != num_to_read; // from either eof or error
+    wchar_t* out_begin = to_carry ? buf->carry___ : dst + num_produced;
+    wchar_t* out_end = convert_subject_to_wchar_range(bytes,            //
+                                                      bytes + read_ret, //
+                                                      input_complete,   //
+                                                      &buf->ps,         //
+                                                      out_begin,        //
+                                                      buf->skip_invalid);
+    size_t num_new_characters = out_end - out_begin;
+    if (to_carry) {
+      buf->carry_begin___ = 0;
+      buf->num_carry___ = num_new_characters;
+    } else {
+      num_produced += num_new_characters;
+    }
+  }
+  return num_produced;
+}
+#endif
+
+// ============================== prefetch =====================================
+
+// double buffered background refill. while the current segment is being
+// matched, a helper thread reads (and decodes, if USE_WCHAR) the following
+// input into one of two prefetch segments. refills copy from the prefetch
+// segments instead of blocking on the input, so reading and matching overlap.
+//
+// each prefetch segment holds at most capacity elements. a segment is either
+// being filled by the helper thread, or full and waiting to be consumed
+typedef struct subject_buffer_prefetch {
+  subject_buffer_state* buf; // the input is read with buf's source
+
+  char* byte_buffer[2]; // each points to capacity elements
+#ifdef USE_WCHAR
+  wchar_t* character_buffer[2]; // each points to capacity elements
+  utf8_decode_state ps;         // decode state, owned by the helper thread
+  bool skip_invalid;
+#endif
+
+  // guarded by mutex
+  size_t size[2]; // number of elements in each full segment
+  bool full[2];
+  bool last[2]; // the input ended with this segment
+  bool stop;    // the helper thread should exit
+
+  // owned by the consumer (the matching thread)
+  size_t consume_segment;
+  size_t consume_pos; // elements of consume_segment already taken
+  bool exhausted;     // the last segment has been completely taken
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} subject_buffer_prefetch;
+
+// private
+static void* subject_buffer_prefetch_thread(void* arg) {
+  subject_buffer_prefetch* prefetch = (subject_buffer_prefetch*)arg;
+  subject_buffer_state* buf = prefetch->buf;
+  // only the blocking read can be cancelled (see subject_buffer_stop_prefetch)
+  pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+  size_t segment = 0;
+  while (1) {
+    pthread_mutex_lock(&prefetch->mutex);
+    while (prefetch->full[segment] && !prefetch->stop) {
+      pthread_cond_wait(&prefetch->cond, &prefetch->mutex);
+    }
+    bool stop = prefetch->stop;
+    pthread_mutex_unlock(&prefetch->mutex);
+    if (stop) {
+      break;
+    }
+
+#ifdef USE_WCHAR
+    // a byte gives at most one character, and so might each pending byte of
+    // an incomplete sequence (if it turns out to be invalid). leave room for
+    // those, so the characters fit in the segment
+    assert(buf->capacity > prefetch->ps.num_pending);
+    size_t num_to_read = buf->capacity - prefetch->ps.num_pending;
+#else
+    size_t num_to_read = buf->capacity;
+#endif
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    size_t read_ret = subject_buffer_read(buf, prefetch->byte_buffer[segment], num_to_read);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    bool last = read_ret != num_to_read; // from either eof or error
+#ifdef USE_WCHAR
+    wchar_t* characters = prefetch->character_buffer[segment];
+    wchar_t* new_end = convert_subject_to_wchar_range(prefetch->byte_buffer[segment],            //
+                                                      prefetch->byte_buffer[segment] + read_ret, //
+                                                      last,                                      //
+                                                      &prefetch->ps,                             //
+                                                      characters,                                //
+                                                      prefetch->skip_invalid);
+    size_t size = new_end - characters;
+#else
+    size_t size = read_ret;
+#endif
+
+    pthread_mutex_lock(&prefetch->mutex);
+    prefetch->size[segment] = size;
+    prefetch->last[segment] = last;
+    prefetch->full[segment] = true;
+    pthread_cond_broadcast(&prefetch->cond);
+    pthread_mutex_unlock(&prefetch->mutex);
+    if (last) {
+      break;
+    }
+    segment ^= 1;
+  }
+  return NULL;
+}
+
+// private. take up to n elements of prefetched input into dst.
+// returns the number of elements given, which is less than n only at the end
+// of the input
+static size_t subject_buffer_prefetch_take(subject_buffer_prefetch* prefetch, CODE_UNIT* dst, size_t n) {
+  size_t ret = 0;
+  while (ret != n && !prefetch->exhausted) {
+    size_t segment = prefetch->consume_segment;
+    pthread_mutex_lock(&prefetch->mutex);
+    while (!prefetch->full[segment]) {
+      pthread_cond_wait(&prefetch->cond, &prefetch->mutex);
+    }
+    size_t size = prefetch->size[segment];
+    bool last = prefetch->last[segment];
+    pthread_mutex_unlock(&prefetch->mutex);
+
+    size_t available = size - prefetch->consume_pos;
+    size_t amount = n - ret < available ? n - ret : available;
+#ifdef USE_WCHAR
+    const CODE_UNIT* src = prefetch->character_buffer[segment];
+#else
+    const CODE_UNIT* src = prefetch->byte_buffer[segment];
+#endif
+    memcpy(dst + ret, src + prefetch->consume_pos, amount * sizeof(CODE_UNIT));
+    ret += amount;
+    prefetch->consume_pos += amount;
+
+    if (prefetch->consume_pos == size) {
+      if (last) {
+        prefetch->exhausted = true;
+      } else {
+        // give the segment back to the helper thread
+        pthread_mutex_lock(&prefetch->mutex);
+        prefetch->full[segment] = false;
+        pthread_cond_broadcast(&prefetch->cond);
+        pthread_mutex_unlock(&prefetch->mutex);
+        prefetch->consume_segment ^= 1;
+        prefetch->consume_pos = 0;
+      }
+    }
+  }
+  return ret;
+}
+
+#ifdef USE_WCHAR
+// begin reading and decoding input in the background. refills of buf are
+// then taken from the prefetched input; the shift semantics are unchanged.
+//
+// buf must have been initialized with init_subject_buffer or
+// init_subject_buffer_fd, its input set, and buf->skip_invalid set. this must
+// be called before subject_buffer_get_first_input.
+//
+// byte_buffers and character_buffers each point to two allocations of
+// buf->capacity elements. if the input isn't ASCII, buf->capacity must have
+// room for a whole multibyte sequence (4). prefetch must outlive buf's use;
+// the helper thread is stopped by deinit_subject_buffer
+//
+// returns false on error (an appropriate error will have been printed to
+// stderr), in which case buf continues without prefetching
+bool subject_buffer_start_prefetch(subject_buffer_state* buf, subject_buffer_prefetch* prefetch, char* byte_buffers[2], wchar_t* character_buffers[2]) {
+#else
+// begin reading input in the background. refills of buf are then taken from
+// the prefetched input; the shift semantics are unchanged.
+//
+// buf must have been initialized with init_subject_buffer or
+// init_subject_buffer_fd, and its input set. this must be called before
+// subject_buffer_get_first_input.
+//
+// byte_buffers points to two allocations of buf->capacity elements. prefetch
+// must outlive buf's use; the helper thread is stopped by
+// deinit_subject_buffer
+//
+// returns false on error (an appropriate error will have been printed to
+// stderr), in which case buf continues without prefetching
+bool subject_buffer_start_prefetch(subject_buffer_state* buf, subject_buffer_prefetch* prefetch, char* byte_buffers[2]) {
+#endif
+  assert(buf->source == SUBJECT_BUFFER_SOURCE_FILE || buf->source == SUBJECT_BUFFER_SOURCE_FD);
+  prefetch->buf = buf;
+  for (size_t i = 0; i < 2; ++i) {
+    prefetch->byte_buffer[i] = byte_buffers[i];
+#ifdef USE_WCHAR
+    prefetch->character_buffer[i] = character_buffers[i];
+#endif
+    prefetch->size[i] = 0;
+    prefetch->full[i] = false;
+    prefetch->last[i] = false;
+  }
+#ifdef USE_WCHAR
+  memset(&prefetch->ps, 0, sizeof(prefetch->ps));
+  prefetch->skip_invalid = buf->skip_invalid;
+#endif
+  prefetch->stop = false;
+  prefetch->consume_segment = 0;
+  prefetch->consume_pos = 0;
+  prefetch->exhausted = false;
+
+  int err = pthread_mutex_init(&prefetch->mutex, NULL);
+  if (unlikely(err != 0)) {
+    errno = err;
+    perror("pthread_mutex_init");
+    return false;
+  }
+  err = pthread_cond_init(&prefetch->cond, NULL);
+  if (unlikely(err != 0)) {
+    errno = err;
+    perror("pthread_cond_init");
+    pthread_mutex_destroy(&prefetch->mutex);
+    return false;
+  }
+  err = pthread_create(&prefetch->thread, NULL, subject_buffer_prefetch_thread, prefetch);
+  if (unlikely(err != 0)) {
+    errno = err;
+    perror("pthread_create");
+    pthread_cond_destroy(&prefetch->cond);
+    pthread_mutex_destroy(&prefetch->mutex);
+    return false;
+  }
+  buf->prefetch___ = prefetch;
+  return true;
+}
+
+// private. stop and join the helper thread, even if it's blocked on input
+static void subject_buffer_stop_prefetch(subject_buffer_prefetch* prefetch) {
+  pthread_mutex_lock(&prefetch->mutex);
+  prefetch->stop = true;
+  pthread_cond_broadcast(&prefetch->cond);
+  pthread_mutex_unlock(&prefetch->mutex);
+  // the thread might be waiting on a read which never completes (e.g. pipe).
+  // it can only be cancelled while reading, and otherwise exits from stop.
+  // ESRCH if it already exited
+  pthread_cancel(prefetch->thread);
+  pthread_join(prefetch->thread, NULL);
+  pthread_cond_destroy(&prefetch->cond);
+  pthread_mutex_destroy(&prefetch->mutex);
+}
+
+// release any resources held by the subject buffer (it does not own the
+// buffers given to init_subject_buffer, nor input_file)
+void deinit_subject_buffer(subject_buffer_state* buf) {
+  if (buf->prefetch___ != NULL) {
+    subject_buffer_stop_prefetch(buf->prefetch___);
+    buf->prefetch___ = NULL;
+  }
+  if (buf->source == SUBJECT_BUFFER_SOURCE_MMAP && buf->mapping___ != NULL) {
+    munmap(buf->mapping___, buf->mapping_size___);
+    buf->mapping___ = NULL;
+  }
+  if (buf->ring___ != NULL) {
+    munmap(buf->ring___, 2 * buf->capacity * sizeof(CODE_UNIT));
+    buf->ring___ = NULL;
+  }
+}
+
 // this must be called the first time input is retrieved.
 // return true iff input is complete
 bool subject_buffer_get_first_input(subject_buffer_state* buf) {
   buf->size = 0;
   buf->offset = 0;
+  buf->stream_offset = 0;
+  buf->pin = SUBJECT_BUFFER_NO_PIN;
+  buf->ring_begin___ = 0;
+  if (buf->source == SUBJECT_BUFFER_SOURCE_CALLBACK) {
+    buf->size = buf->input_callback(buf->input_callback_ctx, subject_buffer_start(buf), buf->capacity);
+    return buf->size != buf->capacity;
+  }
 #ifdef USE_WCHAR
   memset(&buf->ps, 0, sizeof(buf->ps));
-  size_t read_ret = fread_wrapper(subject_processing_buffer(buf), sizeof(char), buf->capacity, buf->input_file);
-  bool input_complete = read_ret != buf->capacity;                                               // from either eof or error
-  CODE_UNIT* new_end = convert_subject_to_wchar_range(subject_processing_buffer(buf),            //
-                                                      subject_processing_buffer(buf) + read_ret, //
-                                                      input_complete,                            //
-                                                      &buf->ps,                                  //
-                                                      subject_buffer_start(buf),                 //
-                                                      buf->skip_invalid);
-  size_t num_new_characters = new_end - subject_buffer_start(buf);
-  buf->size += num_new_characters;
+  buf->carry_begin___ = 0;
+  buf->num_carry___ = 0;
+  if (buf->prefetch___ != NULL) {
+    buf->size = subject_buffer_prefetch_take(buf->prefetch___, subject_buffer_start(buf), buf->capacity);
+    return buf->size != buf->capacity;
+  }
+  buf->size = subject_buffer_decode(buf, subject_buffer_start(buf), buf->capacity);
+  bool input_complete = buf->size != buf->capacity;
 #else
-  size_t read_ret = fread_wrapper(subject_buffer_start(buf), sizeof(char), buf->capacity, buf->input_file);
+  if (buf->source == SUBJECT_BUFFER_SOURCE_MMAP) {
+    // the entire input is already available
+    buf->size = buf->capacity;
+    return true;
+  }
+  if (buf->prefetch___ != NULL) {
+    buf->size = subject_buffer_prefetch_take(buf->prefetch___, subject_buffer_start(buf), buf->capacity);
+    return buf->size != buf->capacity;
+  }
+  size_t read_ret = subject_buffer_read(buf, subject_buffer_start(buf), buf->capacity);
   bool input_complete = read_ret != buf->capacity; // from either eof or error
   buf->size += read_ret;
 #endif
@@ -186,7 +887,29 @@ bool subject_buffer_get_first_input(subject_buffer_state* buf) {
 // this function moves back 2 and 3 to the beginning of the buffer, discarding
 // 1, and filling the newly available space, 4, at the end with more characters
 // from the input. return true iff input is complete
+//
+// if the entire input is mapped (SUBJECT_BUFFER_SOURCE_MMAP without
+// USE_WCHAR), then there is never any more input and nothing is moved.
+//
+// if the subject buffer is a ring (init_subject_buffer_ring), then 2 and 3 are
+// not moved. instead, the beginning of the segment is moved forward to 2, and
+// 4 is filled past the end of 3 (wrapping around the end of the ring)
+//
+// if a position is pinned (pin), 1 ends there instead, if it's before 2. if
+// the pinned position is at the beginning of the segment (or was already
+// discarded), it can't be retained without stopping the input; then it's
+// discarded as usual, and pin is reset to SUBJECT_BUFFER_NO_PIN
 bool subject_buffer_shift_and_get_input(subject_buffer_state* buf) {
+#ifndef USE_WCHAR
+  if (buf->source == SUBJECT_BUFFER_SOURCE_MMAP) {
+    return true;
+  }
+#endif
+
+  if (buf->shift_callback != NULL) {
+    buf->shift_callback(buf->shift_callback_ctx);
+  }
+
   if (unlikely(buf->offset <= buf->max_lookbehind)) {
     // can't shift!
     // region 1 (see doc string) is 0 length. this would likely lead to an
@@ -204,38 +927,67 @@ bool subject_buffer_shift_and_get_input(subject_buffer_state* buf) {
     buf->offset = buf->max_lookbehind + 1;
   }
 
-  CODE_UNIT* move_src_begin = subject_buffer_offset(buf) - buf->max_lookbehind;
-  CODE_UNIT* move_src_end = subject_buffer_end(buf);
-  size_t num_characters = move_src_end - move_src_begin;
+  size_t amount_moved_back = buf->offset - buf->max_lookbehind;
+  if (buf->pin != SUBJECT_BUFFER_NO_PIN) {
+    uint64_t pinned = buf->pin > buf->stream_offset ? buf->pin - buf->stream_offset : 0;
+    if (pinned < amount_moved_back) {
+      if (pinned != 0) {
+        amount_moved_back = pinned;
+      } else {
+        buf->pin = SUBJECT_BUFFER_NO_PIN;
+      }
+    }
+  }
+  CODE_UNIT* move_dst_end;
+  if (buf->ring___ != NULL) {
+    // the retained characters stay where they are
+    buf->ring_begin___ += amount_moved_back;
+    if (buf->ring_begin___ >= buf->capacity) {
+      buf->ring_begin___ -= buf->capacity;
+    }
+    buf->size -= amount_moved_back;
+    buf->offset -= amount_moved_back;
+    buf->stream_offset += amount_moved_back;
+    move_dst_end = subject_buffer_end(buf);
+  } else {
+    CODE_UNIT* move_src_begin = subject_buffer_start(buf) + amount_moved_back;
+    CODE_UNIT* move_src_end = subject_buffer_end(buf);
+    size_t num_characters = move_src_end - move_src_begin;
 
-  CODE_UNIT* move_dst_begin = subject_buffer_start(buf);
-  CODE_UNIT* move_dst_end = move_dst_begin + num_characters;
-  memmove(            // range can overlap
-      move_dst_begin, //
-      move_src_begin, //
-      sizeof(CODE_UNIT) * num_characters);
-  assert(move_dst_begin < move_src_begin);
-  size_t amount_moved_back = move_src_begin - move_dst_begin;
-  buf->size -= amount_moved_back;
-  buf->offset -= amount_moved_back;
+    CODE_UNIT* move_dst_begin = subject_buffer_start(buf);
+    move_dst_end = move_dst_begin + num_characters;
+    memmove(            // range can overlap
+        move_dst_begin, //
+        move_src_begin, //
+        sizeof(CODE_UNIT) * num_characters);
+    assert(move_dst_begin < move_src_begin);
+    assert((size_t)(move_src_begin - move_dst_begin) == amount_moved_back);
+    buf->size -= amount_moved_back;
+    buf->offset -= amount_moved_back;
+    buf->stream_offset += amount_moved_back;
+  }
 
-#ifdef USE_WCHAR
-  // read bytes into processing buffer
-  size_t read_ret = fread_wrapper(subject_processing_buffer(buf), sizeof(char), amount_moved_back, buf->input_file);
-  bool input_complete = read_ret != amount_moved_back; // from either eof or error
+  if (buf->source == SUBJECT_BUFFER_SOURCE_CALLBACK) {
+    size_t num_new_characters = buf->input_callback(buf->input_callback_ctx, move_dst_end, amount_moved_back);
+    buf->size += num_new_characters;
+    return num_new_characters != amount_moved_back;
+  }
 
-  // decode processing buffer into characters. fill region 4 with the new characters
-  CODE_UNIT* new_end = convert_subject_to_wchar_range(subject_processing_buffer(buf),            //
-                                                      subject_processing_buffer(buf) + read_ret, //
-                                                      input_complete,                            //
-                                                      &buf->ps,                                  //
-                                                      move_dst_end,                              //
-                                                      buf->skip_invalid);
-  size_t num_new_characters = new_end - move_dst_end;
+  if (buf->prefetch___ != NULL) {
+    // fill region 4 with prefetched characters
+    size_t num_new_characters = subject_buffer_prefetch_take(buf->prefetch___, move_dst_end, amount_moved_back);
+    buf->size += num_new_characters;
+    return num_new_characters != amount_moved_back;
+  }
+
+#ifdef USE_WCHAR
+  // fill region 4 with decoded characters
+  size_t num_new_characters = subject_buffer_decode(buf, move_dst_end, amount_moved_back);
   buf->size += num_new_characters;
+  bool input_complete = num_new_characters != amount_moved_back;
 #else
   // fill region 4 with new bytes
-  size_t read_ret = fread_wrapper(move_dst_end, sizeof(char), amount_moved_back, buf->input_file);
+  size_t read_ret = subject_buffer_read(buf, move_dst_end, amount_moved_back);
   bool input_complete = read_ret != amount_moved_back; // from either eof or error
   buf->size += read_ret;
 #endif
@@ -0,0 +1,560 @@
+#pragma once
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "character/code_unit.h"
+#include "character/subject_buffer.h"
+
+// a single large regular file can be split into chunks which are scanned in
+// parallel, each by its own worker with its own subject buffer.
+//
+// each chunk owns the bytes [owned_begin, owned_end) of the input. the owned
+// ranges partition the input, and a match belongs to the chunk which owns the
+// beginning of the match; so no match is reported twice, even though adjacent
+// chunks read overlapping parts of the input:
+//  - before owned_begin, the lookbehind which the pattern might evaluate
+//  - after owned_end, enough to complete a match which begins in the owned
+//    range
+//
+// each chunk searches from its owned_begin. for a non-overlapping scan, a
+// match of the previous chunk might end past that, in which case the chunk's
+// first matches can differ from those of a single scan over the input. those
+// are found again once all chunks are scanned, by scanning the chunk from
+// where the previous chunk's last match ended, until the matches agree (see
+// subject_chunk_scan)
+//
+// with USE_WCHAR or USE_UTF8, the boundaries of the owned ranges are moved
+// forward so they never split a UTF-8 sequence. with USE_WCHAR, each worker
+// begins decoding at a sequence boundary.
+typedef struct {
+  uint64_t read_begin;
+  uint64_t owned_begin;
+  uint64_t owned_end;
+  uint64_t read_end;
+} subject_chunk_range;
+
+#ifdef USE_WCHAR
+// a character is decoded from at most this many bytes
+#define SUBJECT_CHUNK_BYTES_PER_CHARACTER 4
+#else
+#define SUBJECT_CHUNK_BYTES_PER_CHARACTER 1
+#endif
+
+// a position of a subject chunk which hasn't been decoded yet
+#define SUBJECT_CHUNK_UNKNOWN_INDEX UINT64_MAX
+
+struct subject_chunk; // forward declare
+
+// scans a chunk. it must retrieve the subject (subject_chunk_get_first_input,
+// subject_buffer_shift_and_get_input) until the input is complete, searching
+// from the offset given by subject_chunk_get_first_input, and give each match
+// to subject_chunk_report_match. it can stop early if
+// subject_chunk_report_match returns false
+typedef void (*subject_chunk_scan_function)(subject_buffer_state* buf, struct subject_chunk* chunk, void* ctx);
+
+typedef struct subject_chunk {
+  int fd;
+  subject_chunk_range range;
+  size_t capacity;
+  size_t max_lookbehind;
+
+  // points to capacity elements. the worker's subject buffer
+  CODE_UNIT* subject_buffer___;
+#ifdef USE_WCHAR
+  // points to capacity elements. bytes read from fd are placed here
+  char* byte_buffer___;
+  utf8_decode_state ps___;
+  // characters which were decoded, but which didn't fit in the requested
+  // amount. they're given first on the next request
+  wchar_t carry___[4];
+  size_t carry_begin___;
+  size_t num_carry___;
+#endif
+
+  // the position in fd of the next byte to read
+  uint64_t read_pos___;
+  // the number of characters given to the worker's subject buffer so far
+  uint64_t num_decoded___;
+  // the positions of owned_begin and owned_end within the characters given to
+  // the worker's subject buffer
+  uint64_t owned_begin_index___;
+  uint64_t owned_end_index___;
+
+  subject_chunk_scan_function scan___;
+  void* scan_ctx___;
+
+  // the beginning of each match, in input order. before subject_chunk_scan
+  // completes, this is the number of characters from owned_begin. afterward,
+  // it's the number of characters from the beginning of the input
+  uint64_t* matches;
+  size_t matches_capacity;
+  size_t num_matches;
+  // set if a match was discarded since matches was full
+  bool matches_overflow;
+  // the end of the last match, from the same position as matches. only
+  // meaningful if num_matches isn't 0
+  uint64_t last_match_end;
+
+  // the position from which the scan searches, relative to owned_begin
+  uint64_t scan_from___;
+  // set while the chunk is scanned again (see subject_chunk_scan). the matches
+  // which are found are placed at rescan_write___, in place of the first
+  // scan's matches before rescan_cursor___
+  bool rescan___;
+  bool rescan_agreed___;
+  size_t rescan_write___;
+  size_t rescan_cursor___;
+  uint64_t rescan_last_end___;
+} subject_chunk;
+
+// private. read n bytes at position (less only on eof or error, in which case
+// an appropriate error will have been printed to stderr)
+static size_t subject_chunk_pread(int fd, char* dst, size_t n, uint64_t position) {
+  size_t total = 0;
+  while (total != n) {
+    ssize_t ret = pread(fd, dst + total, n - total, (off_t)(position + total));
+    if (unlikely(ret == -1)) {
+      if (errno == EINTR) continue;
+      perror("pread");
+      break;
+    }
+    if (ret == 0) break; // eof
+    total += (size_t)ret;
+  }
+  return total;
+}
+
+// private. moves position forward past any UTF-8 continuation bytes (at most
+// 3, which is the most that a valid sequence can have)
+static uint64_t subject_chunk_resync(int fd, uint64_t position, uint64_t input_size) {
+#if defined(USE_WCHAR) || defined(USE_UTF8)
+  unsigned char bytes[3];
+  size_t num_bytes = subject_chunk_pread(fd, (char*)bytes, sizeof(bytes), position);
+  for (size_t i = 0; i < num_bytes && (bytes[i] & 0xC0) == 0x80; ++i) {
+    ++position;
+  }
+#else
+  (void)(fd);
+#endif
+  return position < input_size ? position : input_size;
+}
+
+// split the first input_size bytes of regular file fd into (at most)
+// num_chunks ranges, to be scanned by subject_chunk_scan. max_size and
+// max_lookbehind are the number of characters that the pattern might consume
+// and evaluate before the match offset, respectively.
+//
+// returns the number of ranges placed in out, which might be fewer than
+// num_chunks for a small input (0 for an empty input)
+size_t subject_chunk_plan(int fd,                //
+                          uint64_t input_size,   //
+                          size_t num_chunks,     //
+                          size_t max_size,       //
+                          size_t max_lookbehind, //
+                          subject_chunk_range* out) {
+  assert(num_chunks > 0);
+  uint64_t lookbehind_bytes = (uint64_t)max_lookbehind * SUBJECT_CHUNK_BYTES_PER_CHARACTER;
+#ifdef USE_WCHAR
+  // the read begins at a sequence boundary, which might be up to 3 bytes
+  // forward. one more character retains the lookbehind
+  lookbehind_bytes += SUBJECT_CHUNK_BYTES_PER_CHARACTER;
+#endif
+  uint64_t lookahead_bytes = ((uint64_t)max_size + max_lookbehind) * SUBJECT_CHUNK_BYTES_PER_CHARACTER;
+
+  size_t num_ranges = 0;
+  uint64_t owned_begin = 0;
+  for (size_t i = 1; i <= num_chunks; ++i) {
+    uint64_t owned_end = i == num_chunks ? input_size //
+                                         : subject_chunk_resync(fd, input_size * i / num_chunks, input_size);
+    if (owned_end <= owned_begin) {
+      continue; // empty after resync
+    }
+    subject_chunk_range* range = out + num_ranges++;
+    range->owned_begin = owned_begin;
+    range->owned_end = owned_end;
+
+    range->read_begin = owned_begin < lookbehind_bytes ? 0 : owned_begin - lookbehind_bytes;
+#ifdef USE_WCHAR
+    range->read_begin = subject_chunk_resync(fd, range->read_begin, owned_begin);
+#endif
+    range->read_end = input_size - owned_end < lookahead_bytes ? input_size : owned_end + lookahead_bytes;
+#ifdef USE_WCHAR
+    range->read_end = subject_chunk_resync(fd, range->read_end, input_size);
+#endif
+    owned_begin = owned_end;
+  }
+  return num_ranges;
+}
+
+// private. read the chunk from the beginning of its read range
+static void subject_chunk_rewind(subject_chunk* chunk) {
+#ifdef USE_WCHAR
+  memset(&chunk->ps___, 0, sizeof(chunk->ps___));
+  chunk->carry_begin___ = 0;
+  chunk->num_carry___ = 0;
+  // found while decoding
+  chunk->owned_begin_index___ = chunk->range.read_begin == chunk->range.owned_begin ? 0 : SUBJECT_CHUNK_UNKNOWN_INDEX;
+  chunk->owned_end_index___ = SUBJECT_CHUNK_UNKNOWN_INDEX;
+#else
+  // a character is a byte
+  chunk->owned_begin_index___ = chunk->range.owned_begin - chunk->range.read_begin;
+  chunk->owned_end_index___ = chunk->range.owned_end - chunk->range.read_begin;
+#endif
+  chunk->read_pos___ = chunk->range.read_begin;
+  chunk->num_decoded___ = 0;
+}
+
+// setup a chunk to be scanned by subject_chunk_scan, from a range given by
+// subject_chunk_plan. the chunk reads from regular file fd.
+//
+// subject_buffer (and byte_buffer for USE_WCHAR) point to capacity elements,
+// which is the capacity of the worker's subject buffer. matches points to
+// matches_capacity elements
+#ifdef USE_WCHAR
+void init_subject_chunk(subject_chunk* chunk,         //
+                        int fd,                       //
+                        subject_chunk_range range,    //
+                        size_t capacity,              //
+                        wchar_t* subject_buffer,      //
+                        char* byte_buffer,            //
+                        size_t max_lookbehind,        //
+                        uint64_t* matches,            //
+                        size_t matches_capacity) {
+#else
+void init_subject_chunk(subject_chunk* chunk,         //
+                        int fd,                       //
+                        subject_chunk_range range,    //
+                        size_t capacity,              //
+                        char* subject_buffer,         //
+                        size_t max_lookbehind,        //
+                        uint64_t* matches,            //
+                        size_t matches_capacity) {
+#endif
+  assert(range.read_begin <= range.owned_begin);
+  assert(range.owned_begin < range.owned_end);
+  assert(range.owned_end <= range.read_end);
+  chunk->fd = fd;
+  chunk->range = range;
+  chunk->capacity = capacity;
+  chunk->max_lookbehind = max_lookbehind;
+  chunk->subject_buffer___ = subject_buffer;
+#ifdef USE_WCHAR
+  chunk->byte_buffer___ = byte_buffer;
+#endif
+  subject_chunk_rewind(chunk);
+  chunk->scan___ = NULL;
+  chunk->scan_ctx___ = NULL;
+  chunk->matches = matches;
+  chunk->matches_capacity = matches_capacity;
+  chunk->num_matches = 0;
+  chunk->matches_overflow = false;
+  chunk->last_match_end = 0;
+  chunk->scan_from___ = 0;
+  chunk->rescan___ = false;
+}
+
+// private. subject_buffer_input_callback for a chunk's subject buffer. gives
+// the characters decoded from the chunk's read range
+static size_t subject_chunk_produce(void* ctx, CODE_UNIT* dst, size_t n) {
+  subject_chunk* chunk = (subject_chunk*)ctx;
+#ifdef USE_WCHAR
+  size_t num_produced = 0;
+  while (num_produced < n) {
+    if (chunk->num_carry___ != 0) {
+      dst[num_produced++] = chunk->carry___[chunk->carry_begin___++];
+      --chunk->num_carry___;
+      continue;
+    }
+    if (chunk->read_pos___ == chunk->range.read_end) {
+      break;
+    }
+
+    // a byte gives at most one character, aside from the pending bytes of an
+    // incomplete sequence from before, which might each give one if invalid.
+    // if there isn't room for that, decode a single byte to the carry instead
+    size_t room = n - num_produced;
+    bool to_carry = room <= chunk->ps___.num_pending;
+    uint64_t limit = to_carry ? 1 : room - chunk->ps___.num_pending;
+    uint64_t pos = chunk->read_pos___;
+    if (chunk->range.read_end - pos < limit) {
+      limit = chunk->range.read_end - pos;
+    }
+    // decoding stops at the owned boundaries, so their positions are known
+    if (pos < chunk->range.owned_begin && chunk->range.owned_begin - pos < limit) {
+      limit = chunk->range.owned_begin - pos;
+    } else if (pos < chunk->range.owned_end && chunk->range.owned_end - pos < limit) {
+      limit = chunk->range.owned_end - pos;
+    }
+
+    size_t num_read = subject_chunk_pread(chunk->fd, chunk->byte_buffer___, limit, pos);
+    if (num_read != limit) {
+      chunk->range.read_end = pos + num_read; // eof or error
+    }
+    bool complete = pos + num_read == chunk->range.read_end;
+    wchar_t* out_begin = to_carry ? chunk->carry___ : dst + num_produced;
+    wchar_t* out_end = convert_subject_to_wchar_range(chunk->byte_buffer___,            //
+                                                      chunk->byte_buffer___ + num_read, //
+                                                      complete,                         //
+                                                      &chunk->ps___,                    //
+                                                      out_begin,                        //
+                                                      false);
+    size_t num_new_characters = out_end - out_begin;
+    if (to_carry) {
+      chunk->carry_begin___ = 0;
+      chunk->num_carry___ = num_new_characters;
+    } else {
+      num_produced += num_new_characters;
+    }
+    chunk->num_decoded___ += num_new_characters;
+    chunk->read_pos___ = pos + num_read;
+
+    if (chunk->read_pos___ == chunk->range.owned_begin) {
+      chunk->owned_begin_index___ = chunk->num_decoded___;
+    } else if (chunk->read_pos___ == chunk->range.owned_end) {
+      chunk->owned_end_index___ = chunk->num_decoded___;
+    }
+  }
+  return num_produced;
+#else
+  uint64_t remaining = chunk->range.read_end - chunk->read_pos___;
+  if (remaining < n) {
+    n = remaining;
+  }
+  size_t num_read = subject_chunk_pread(chunk->fd, dst, n, chunk->read_pos___);
+  chunk->read_pos___ += num_read;
+  chunk->num_decoded___ += num_read;
+  return num_read;
+#endif
+}
+
+// this must be called by the scan function the first time input is
+// retrieved, in place of subject_buffer_get_first_input. input is skipped
+// until the position from which the chunk is searched, which is then the
+// subject buffer's offset.
+// return true iff input is complete
+bool subject_chunk_get_first_input(subject_chunk* chunk, subject_buffer_state* buf) {
+  bool input_complete = subject_buffer_get_first_input(buf);
+  while (1) {
+    // an unknown owned_begin hasn't been decoded yet
+    uint64_t position = chunk->owned_begin_index___ == SUBJECT_CHUNK_UNKNOWN_INDEX //
+                            ? SUBJECT_CHUNK_UNKNOWN_INDEX
+                            : chunk->owned_begin_index___ + chunk->scan_from___;
+    if (position <= buf->stream_offset + buf->size) {
+      buf->offset = position - buf->stream_offset;
+      return input_complete;
+    }
+    buf->offset = buf->size;
+    if (input_complete) {
+      return input_complete;
+    }
+    input_complete = subject_buffer_shift_and_get_input(buf);
+  }
+}
+
+// private. a match found while the chunk is scanned again. returns false once
+// the scan can stop
+static bool subject_chunk_rescan_match(subject_chunk* chunk, uint64_t begin, uint64_t end) {
+  // matches from the first scan which begin before this one weren't found
+  // from where the previous chunk's last match ended
+  while (chunk->rescan_cursor___ != chunk->num_matches && chunk->matches[chunk->rescan_cursor___] < begin) {
+    ++chunk->rescan_cursor___;
+  }
+  if (chunk->rescan_cursor___ != chunk->num_matches && chunk->matches[chunk->rescan_cursor___] == begin) {
+    // both scans continue from the same match, so the remaining matches of the
+    // first scan are kept
+    size_t num_kept = chunk->num_matches - chunk->rescan_cursor___;
+    memmove(chunk->matches + chunk->rescan_write___, chunk->matches + chunk->rescan_cursor___, num_kept * sizeof(*chunk->matches));
+    chunk->num_matches = chunk->rescan_write___ + num_kept;
+    chunk->rescan_agreed___ = true;
+    return false;
+  }
+  if (chunk->rescan_write___ == chunk->rescan_cursor___) {
+    // make room before the first scan's remaining matches
+    if (unlikely(chunk->num_matches == chunk->matches_capacity)) {
+      chunk->matches_overflow = true;
+      return false;
+    }
+    size_t num_remaining = chunk->num_matches - chunk->rescan_cursor___;
+    memmove(chunk->matches + chunk->rescan_cursor___ + 1, chunk->matches + chunk->rescan_cursor___, num_remaining * sizeof(*chunk->matches));
+    ++chunk->rescan_cursor___;
+    ++chunk->num_matches;
+  }
+  chunk->matches[chunk->rescan_write___++] = begin;
+  chunk->rescan_last_end___ = end;
+  return true;
+}
+
+// give a match to the chunk, which is [begin, end) within the subject buffer.
+// the match is discarded if it doesn't begin within the chunk's owned range
+// (an adjacent chunk reports it instead).
+//
+// returns false if the scan should stop (e.g. if there was no room for the
+// match)
+bool subject_chunk_report_match(subject_chunk* chunk, const subject_buffer_state* buf, size_t begin, size_t end) {
+  uint64_t position = buf->stream_offset + begin;
+  // an unknown begin hasn't been reached. an unknown end hasn't either
+  if (chunk->owned_begin_index___ == SUBJECT_CHUNK_UNKNOWN_INDEX //
+      || position < chunk->owned_begin_index___ + chunk->scan_from___) {
+    return true;
+  }
+  if (position >= chunk->owned_end_index___) {
+    // nothing remains to be found again
+    return !chunk->rescan___;
+  }
+  uint64_t relative_begin = position - chunk->owned_begin_index___;
+  uint64_t relative_end = buf->stream_offset + end - chunk->owned_begin_index___;
+  if (chunk->rescan___) {
+    return subject_chunk_rescan_match(chunk, relative_begin, relative_end);
+  }
+  if (unlikely(chunk->num_matches == chunk->matches_capacity)) {
+    chunk->matches_overflow = true;
+    return false;
+  }
+  chunk->matches[chunk->num_matches++] = relative_begin;
+  chunk->last_match_end = relative_end;
+  return true;
+}
+
+// private. scans a chunk with its own subject buffer
+static void* subject_chunk_worker(void* arg) {
+  subject_chunk* chunk = (subject_chunk*)arg;
+  subject_buffer_state buf;
+  init_subject_buffer_callback(&buf,                      //
+                               chunk->capacity,           //
+                               chunk->subject_buffer___,  //
+                               chunk->max_lookbehind,     //
+                               subject_chunk_produce,     //
+                               chunk);
+  chunk->scan___(&buf, chunk, chunk->scan_ctx___);
+  deinit_subject_buffer(&buf);
+  return NULL;
+}
+
+// private. scan the chunk again, searching from scan_from (relative to
+// owned_begin), until a match agrees with the first scan. the first scan's
+// matches before that are replaced with the ones found
+static void subject_chunk_rescan(subject_chunk* chunk, uint64_t scan_from) {
+  // the positions of the owned range were found by the first scan. the
+  // second might stop before decoding that far
+  uint64_t owned_begin_index = chunk->owned_begin_index___;
+  uint64_t owned_end_index = chunk->owned_end_index___;
+  subject_chunk_rewind(chunk);
+  chunk->owned_begin_index___ = owned_begin_index;
+  chunk->owned_end_index___ = owned_end_index;
+  chunk->scan_from___ = scan_from;
+  chunk->rescan___ = true;
+  chunk->rescan_agreed___ = false;
+  chunk->rescan_write___ = 0;
+  chunk->rescan_cursor___ = 0;
+  subject_chunk_worker(chunk);
+  chunk->rescan___ = false;
+  if (!chunk->rescan_agreed___ && !chunk->matches_overflow) {
+    // the scans never agreed within the owned range. none of the first
+    // scan's matches are kept
+    chunk->num_matches = chunk->rescan_write___;
+    if (chunk->num_matches != 0) {
+      chunk->last_match_end = chunk->rescan_last_end___;
+    }
+  }
+}
+
+// scan each chunk in parallel; the first on the calling thread, and the rest
+// each on their own thread.
+//
+// overlapping indicates that scan gives every match, rather than the
+// non-overlapping matches (each searched from the end of the previous). if
+// not overlapping, then a chunk which begins within the previous chunk's last
+// match is scanned again (on the calling thread) from where that match ends.
+// usually the scans agree after a few matches, but at worst the entire chunk
+// is scanned again.
+//
+// afterward, each chunk's matches are positions from the beginning of the
+// input, so the concatenation of the chunks' matches in order is every match
+// in input order, the same as from a single scan of the input (see
+// subject_chunk_merge_matches).
+//
+// returns false on error (an appropriate error will have been printed to
+// stderr), or if any chunk's matches overflowed
+bool subject_chunk_scan(subject_chunk* chunks, size_t num_chunks, subject_chunk_scan_function scan, void* ctx, bool overlapping) {
+  if (num_chunks == 0) {
+    return true;
+  }
+
+  for (size_t i = 0; i < num_chunks; ++i) {
+    chunks[i].scan___ = scan;
+    chunks[i].scan_ctx___ = ctx;
+  }
+
+  pthread_t threads[num_chunks];
+  bool started[num_chunks];
+  bool ret = true;
+  for (size_t i = 1; i < num_chunks; ++i) {
+    int err = pthread_create(&threads[i], NULL, subject_chunk_worker, &chunks[i]);
+    started[i] = err == 0;
+    if (unlikely(!started[i])) {
+      // scanned on this thread instead
+      errno = err;
+      perror("pthread_create");
+    }
+  }
+  subject_chunk_worker(&chunks[0]);
+  for (size_t i = 1; i < num_chunks; ++i) {
+    if (started[i]) {
+      pthread_join(threads[i], NULL);
+    } else {
+      subject_chunk_worker(&chunks[i]);
+    }
+  }
+
+  // the position of each chunk's owned_begin is the total number of
+  // characters owned by the chunks before it
+  uint64_t base = 0;
+  uint64_t last_match_end = 0; // of the chunks before, from the beginning of the input
+  for (size_t i = 0; i < num_chunks; ++i) {
+    subject_chunk* chunk = &chunks[i];
+    if (base != SUBJECT_CHUNK_UNKNOWN_INDEX) {
+      if (!overlapping && last_match_end > base //
+          && !chunk->matches_overflow && chunk->owned_end_index___ != SUBJECT_CHUNK_UNKNOWN_INDEX) {
+        subject_chunk_rescan(chunk, last_match_end - base);
+      }
+      for (size_t j = 0; j < chunk->num_matches; ++j) {
+        chunk->matches[j] += base;
+      }
+      chunk->last_match_end += base;
+      if (chunk->num_matches != 0) {
+        last_match_end = chunk->last_match_end;
+      }
+    }
+    if (chunk->matches_overflow || chunk->owned_end_index___ == SUBJECT_CHUNK_UNKNOWN_INDEX) {
+      // the scan stopped early. the positions after this chunk are unknown, so
+      // the matches of later chunks remain relative to their owned_begin
+      base = SUBJECT_CHUNK_UNKNOWN_INDEX;
+      ret = false;
+    } else if (base != SUBJECT_CHUNK_UNKNOWN_INDEX) {
+      base += chunk->owned_end_index___ - chunk->owned_begin_index___;
+    }
+  }
+  return ret;
+}
+
+// concatenate the chunks' matches after subject_chunk_scan, which gives every
+// match in input order. out points to out_capacity elements.
+// returns the number of matches placed in out
+size_t subject_chunk_merge_matches(const subject_chunk* chunks, size_t num_chunks, uint64_t* out, size_t out_capacity) {
+  size_t num_out = 0;
+  for (size_t i = 0; i < num_chunks; ++i) {
+    size_t n = chunks[i].num_matches;
+    if (n > out_capacity - num_out) {
+      n = out_capacity - num_out;
+    }
+    memcpy(out + num_out, chunks[i].matches, n * sizeof(*out));
+    num_out += n;
+  }
+  return num_out;
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#ifndef USE_WCHAR
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "basic/likely_unlikely.h"
+#include "character/subject_buffer.h"
+
+// matches (or the records which contain them) are written to the output
+// directly from the subject buffer, rather than being copied to an output
+// buffer first. each span to write is queued as an iovec pointing into the
+// subject buffer, and the queue is written all at once with writev(2).
+//
+// a queued span must not be discarded or moved before it's written. the
+// sink is attached to the subject buffer, which flushes the sink before each
+// shift.
+//
+// if the subject is an entire mapped file (init_subject_buffer_mmap), it's
+// never modified, so when the output is a pipe the spans are given to the
+// pipe with vmsplice(2) instead, which references the pages rather than
+// copying them. this isn't done for any other subject; a reference to the
+// subject buffer would be overwritten by the next shift.
+//
+// not available with USE_WCHAR, where the subject isn't the input's bytes.
+typedef struct {
+  int fd;
+  bool splice; // use vmsplice instead of writev
+
+  // points to iov_capacity elements
+  struct iovec* iov;
+  size_t iov_capacity;
+  size_t num_iov;
+
+  // set once a write fails (an appropriate error will have been printed to
+  // stderr). after, spans are discarded
+  bool error;
+} subject_output;
+
+// iov points to iov_capacity elements, which is the maximum number of spans
+// which are queued before they're written (no greater than IOV_MAX)
+void init_subject_output(subject_output* out, int fd, struct iovec* iov, size_t iov_capacity) {
+  assert(iov_capacity > 0);
+  out->fd = fd;
+  out->splice = false;
+  out->iov = iov;
+  out->iov_capacity = iov_capacity;
+  out->num_iov = 0;
+  out->error = false;
+}
+
+// private. write all of the iovecs, accounting for partial writes. the iovecs
+// are modified. returns false on error
+static bool subject_output_write_iov(subject_output* out) {
+  struct iovec* iov = out->iov;
+  size_t num_iov = out->num_iov;
+  while (num_iov != 0) {
+    ssize_t num_written;
+    if (out->splice) {
+      num_written = vmsplice(out->fd, iov, num_iov, 0);
+      if (unlikely(num_written == -1 && errno == EINVAL)) {
+        // e.g. the pipe was swapped for something else. stop trying
+        out->splice = false;
+        continue;
+      }
+    } else {
+      num_written = writev(out->fd, iov, num_iov);
+    }
+    if (unlikely(num_written == -1)) {
+      if (errno == EINTR) continue;
+      perror(out->splice ? "vmsplice" : "writev");
+      return false;
+    }
+    size_t remaining = (size_t)num_written;
+    while (num_iov != 0 && remaining >= iov->iov_len) {
+      remaining -= iov->iov_len;
+      ++iov;
+      --num_iov;
+    }
+    if (remaining != 0) {
+      iov->iov_base = (char*)iov->iov_base + remaining;
+      iov->iov_len -= remaining;
+    }
+  }
+  return true;
+}
+
+// write all queued spans. this must be called after the last span is queued.
+// returns false if any write has failed
+bool subject_output_flush(subject_output* out) {
+  if (out->num_iov != 0 && likely(!out->error)) {
+    out->error = !subject_output_write_iov(out);
+  }
+  out->num_iov = 0;
+  return !out->error;
+}
+
+// private. subject_buffer_shift_callback
+static void subject_output_flush_before_shift(void* ctx) {
+  subject_output_flush((subject_output*)ctx);
+}
+
+// the output flushes before buf shifts, so queued spans of buf are written
+// before they're discarded. if buf is an entire mapped file and the output is
+// a pipe, vmsplice is used from here on
+void subject_output_attach(subject_output* out, subject_buffer_state* buf) {
+  buf->shift_callback = subject_output_flush_before_shift;
+  buf->shift_callback_ctx = out;
+
+  struct stat st;
+  if (buf->source == SUBJECT_BUFFER_SOURCE_MMAP //
+      && fstat(out->fd, &st) != -1              //
+      && S_ISFIFO(st.st_mode)) {
+    subject_output_flush(out); // anything before isn't from the mapping
+    out->splice = true;
+  }
+}
+
+// queue the span [begin, end) to be written. it must remain unchanged until
+// it's written (on flush)
+void subject_output_add(subject_output* out, const char* begin, const char* end) {
+  assert(begin <= end);
+  if (begin == end) {
+    return;
+  }
+  if (out->num_iov != 0) {
+    struct iovec* last = &out->iov[out->num_iov - 1];
+    if ((const char*)last->iov_base + last->iov_len == begin) {
+      // adjacent to the previous span
+      last->iov_len += end - begin;
+      return;
+    }
+    if (out->num_iov == out->iov_capacity) {
+      subject_output_flush(out);
+    }
+  }
+  out->iov[out->num_iov].iov_base = (void*)begin;
+  out->iov[out->num_iov].iov_len = end - begin;
+  ++out->num_iov;
+}
+
+#endif
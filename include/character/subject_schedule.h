@@ -0,0 +1,303 @@
+#pragma once
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "basic/likely_unlikely.h"
+#include "character/code_unit.h"
+#include "character/subject_buffer.h"
+
+// many files (e.g. a directory tree) are scanned by a fixed number of
+// workers. each worker owns a subject buffer which is reused for each file.
+//
+// the files are initially divided evenly between the workers. each worker has
+// a deque of its files: it takes its own from the front (ascending), and once
+// it runs out it steals from the back of the others' deques. so a worker
+// which is stuck on a large file doesn't hold up the rest.
+//
+// the results are emitted in the order of the files regardless of which
+// worker scanned which file and when
+//
+// all memory is taken from a caller provided arena (see
+// subject_schedule_arena_size)
+
+// scans a single file. it must retrieve the subject
+// (subject_buffer_get_first_input, subject_buffer_shift_and_get_input) until
+// the input is complete, and place its results somewhere in ctx for the file
+// at file_index.
+//
+// this is called concurrently from each worker, so ctx should be read only
+// aside from per file results
+typedef void (*subject_schedule_scan_function)(subject_buffer_state* buf, size_t file_index, void* ctx);
+
+// emits the results of a single file. called once per file, in file order and
+// never concurrently. opened indicates if the file could be opened (if not, it
+// wasn't scanned, and an appropriate error will have been printed to stderr)
+typedef void (*subject_schedule_emit_function)(size_t file_index, bool opened, void* ctx);
+
+// the minimum capacity given by subject_schedule_capacity. most files are read
+// in a single call
+#define SUBJECT_SCHEDULE_MIN_CAPACITY 65536
+
+// the capacity of each worker's subject buffer, from the pattern's
+// interpret_setup result
+size_t subject_schedule_capacity(size_t max_size_characters, size_t max_lookbehind_characters) {
+  // a match and its lookbehind must fit, with at least one character to shift
+  size_t required = max_size_characters + max_lookbehind_characters + 1;
+  return required > SUBJECT_SCHEDULE_MIN_CAPACITY ? required : SUBJECT_SCHEDULE_MIN_CAPACITY;
+}
+
+typedef enum {
+  SUBJECT_SCHEDULE_PENDING,
+  SUBJECT_SCHEDULE_SCANNED,
+  SUBJECT_SCHEDULE_NOT_OPENED,
+} subject_schedule_file_status;
+
+struct subject_schedule; // forward declare
+
+typedef struct {
+  struct subject_schedule* schedule;
+  pthread_t thread;
+
+  // the deque is tasks[front, back). guarded by mutex
+  pthread_mutex_t mutex;
+  size_t front;
+  size_t back;
+
+  // each points to capacity elements
+  CODE_UNIT* subject_buffer;
+#ifdef USE_WCHAR
+  char* byte_buffer;
+#endif
+} subject_schedule_worker;
+
+typedef struct subject_schedule {
+  const char* const* paths;
+  size_t num_files;
+  size_t capacity;
+  size_t max_lookbehind;
+  subject_schedule_scan_function scan;
+  subject_schedule_emit_function emit;
+  void* ctx;
+
+  size_t num_workers;
+  subject_schedule_worker* workers;
+  // the file indices. each worker's deque is a contiguous part of this
+  size_t* tasks;
+
+  // guards status and next_to_emit
+  pthread_mutex_t emit_mutex;
+  // num_files elements of subject_schedule_file_status
+  unsigned char* status;
+  size_t next_to_emit;
+} subject_schedule;
+
+// private. size rounded up so that whatever follows in the arena is aligned
+static size_t subject_schedule_align(size_t size) {
+  const size_t alignment = 16;
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// the number of bytes which must be given as the arena to subject_schedule_run
+size_t subject_schedule_arena_size(size_t num_files, size_t num_workers, size_t capacity) {
+  size_t ret = 0;
+  ret += subject_schedule_align(sizeof(subject_schedule_worker) * num_workers);
+  ret += subject_schedule_align(sizeof(size_t) * num_files);
+  ret += subject_schedule_align(sizeof(CODE_UNIT) * capacity) * num_workers;
+#ifdef USE_WCHAR
+  ret += subject_schedule_align(capacity) * num_workers;
+#endif
+  ret += subject_schedule_align(num_files);
+  return ret;
+}
+
+// private. take a file from the front of the worker's own deque
+static bool subject_schedule_take(subject_schedule_worker* worker, size_t* file_index) {
+  bool ret = false;
+  pthread_mutex_lock(&worker->mutex);
+  if (worker->front != worker->back) {
+    *file_index = worker->schedule->tasks[worker->front++];
+    ret = true;
+  }
+  pthread_mutex_unlock(&worker->mutex);
+  return ret;
+}
+
+// private. take a file from the back of another worker's deque
+static bool subject_schedule_steal(subject_schedule_worker* thief, size_t* file_index) {
+  subject_schedule* schedule = thief->schedule;
+  size_t thief_index = thief - schedule->workers;
+  for (size_t i = 1; i < schedule->num_workers; ++i) {
+    subject_schedule_worker* victim = &schedule->workers[(thief_index + i) % schedule->num_workers];
+    bool stolen = false;
+    pthread_mutex_lock(&victim->mutex);
+    if (victim->front != victim->back) {
+      *file_index = schedule->tasks[--victim->back];
+      stolen = true;
+    }
+    pthread_mutex_unlock(&victim->mutex);
+    if (stolen) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// private. record a file's status, and emit all files which are ready in order
+static void subject_schedule_finish(subject_schedule* schedule, size_t file_index, subject_schedule_file_status status) {
+  pthread_mutex_lock(&schedule->emit_mutex);
+  schedule->status[file_index] = status;
+  while (schedule->next_to_emit != schedule->num_files) {
+    unsigned char next_status = schedule->status[schedule->next_to_emit];
+    if (next_status == SUBJECT_SCHEDULE_PENDING) {
+      break;
+    }
+    schedule->emit(schedule->next_to_emit, next_status == SUBJECT_SCHEDULE_SCANNED, schedule->ctx);
+    ++schedule->next_to_emit;
+  }
+  pthread_mutex_unlock(&schedule->emit_mutex);
+}
+
+// private. scan a single file with the worker's subject buffer
+static void subject_schedule_scan_file(subject_schedule_worker* worker, size_t file_index) {
+  subject_schedule* schedule = worker->schedule;
+  int fd = open(schedule->paths[file_index], O_RDONLY | O_CLOEXEC);
+  if (unlikely(fd == -1)) {
+    perror(schedule->paths[file_index]);
+    subject_schedule_finish(schedule, file_index, SUBJECT_SCHEDULE_NOT_OPENED);
+    return;
+  }
+
+  subject_buffer_state buf;
+#ifdef USE_WCHAR
+  init_subject_buffer(&buf, schedule->capacity, worker->byte_buffer, worker->subject_buffer, schedule->max_lookbehind);
+#else
+  init_subject_buffer(&buf, schedule->capacity, worker->subject_buffer, schedule->max_lookbehind);
+#endif
+  // same as init_subject_buffer_fd, but without the readahead hints. most
+  // files fit in a single read, so they'd only cost more syscalls
+  buf.source = SUBJECT_BUFFER_SOURCE_FD;
+  buf.input_fd = fd;
+  schedule->scan(&buf, file_index, schedule->ctx);
+  deinit_subject_buffer(&buf);
+  close(fd);
+  subject_schedule_finish(schedule, file_index, SUBJECT_SCHEDULE_SCANNED);
+}
+
+// private
+static void* subject_schedule_worker_thread(void* arg) {
+  subject_schedule_worker* worker = (subject_schedule_worker*)arg;
+  size_t file_index;
+  // files are never added, so once all deques are empty the work is done
+  while (subject_schedule_take(worker, &file_index) || subject_schedule_steal(worker, &file_index)) {
+    subject_schedule_scan_file(worker, file_index);
+  }
+  return NULL;
+}
+
+// scan each of the files at paths, with num_workers workers; the first on the
+// calling thread, and the rest each on their own thread. capacity is the
+// capacity of each worker's subject buffer (see subject_schedule_capacity).
+//
+// arena points to subject_schedule_arena_size bytes, with 16 byte alignment.
+//
+// returns false on error (an appropriate error will have been printed to
+// stderr), in which case no files were scanned. a file which can't be opened
+// isn't an error; it's indicated to emit
+bool subject_schedule_run(const char* const* paths,
+                          size_t num_files,
+                          size_t num_workers,
+                          size_t capacity,
+                          size_t max_lookbehind,
+                          void* arena,
+                          subject_schedule_scan_function scan,
+                          subject_schedule_emit_function emit,
+                          void* ctx) {
+  assert(num_workers > 0);
+  assert(max_lookbehind < capacity);
+  assert((uintptr_t)arena % 16 == 0);
+  subject_schedule schedule;
+  schedule.paths = paths;
+  schedule.num_files = num_files;
+  schedule.capacity = capacity;
+  schedule.max_lookbehind = max_lookbehind;
+  schedule.scan = scan;
+  schedule.emit = emit;
+  schedule.ctx = ctx;
+  schedule.num_workers = num_workers;
+  schedule.next_to_emit = 0;
+
+  char* pos = (char*)arena;
+  schedule.workers = (subject_schedule_worker*)pos;
+  pos += subject_schedule_align(sizeof(subject_schedule_worker) * num_workers);
+  schedule.tasks = (size_t*)pos;
+  pos += subject_schedule_align(sizeof(size_t) * num_files);
+  for (size_t i = 0; i < num_workers; ++i) {
+    schedule.workers[i].subject_buffer = (CODE_UNIT*)pos;
+    pos += subject_schedule_align(sizeof(CODE_UNIT) * capacity);
+  }
+#ifdef USE_WCHAR
+  for (size_t i = 0; i < num_workers; ++i) {
+    schedule.workers[i].byte_buffer = pos;
+    pos += subject_schedule_align(capacity);
+  }
+#endif
+  schedule.status = (unsigned char*)pos;
+  pos += subject_schedule_align(num_files);
+  assert((size_t)(pos - (char*)arena) == subject_schedule_arena_size(num_files, num_workers, capacity));
+
+  for (size_t i = 0; i < num_files; ++i) {
+    schedule.tasks[i] = i;
+    schedule.status[i] = SUBJECT_SCHEDULE_PENDING;
+  }
+
+  int err = pthread_mutex_init(&schedule.emit_mutex, NULL);
+  if (unlikely(err != 0)) {
+    errno = err;
+    perror("pthread_mutex_init");
+    return false;
+  }
+  size_t num_initialized = 0;
+  for (; num_initialized < num_workers; ++num_initialized) {
+    subject_schedule_worker* worker = &schedule.workers[num_initialized];
+    worker->schedule = &schedule;
+    worker->front = num_files * num_initialized / num_workers;
+    worker->back = num_files * (num_initialized + 1) / num_workers;
+    err = pthread_mutex_init(&worker->mutex, NULL);
+    if (unlikely(err != 0)) {
+      errno = err;
+      perror("pthread_mutex_init");
+      break;
+    }
+  }
+
+  bool ret = num_initialized == num_workers;
+  if (likely(ret)) {
+    size_t num_started = 1;
+    for (; num_started < num_workers; ++num_started) {
+      err = pthread_create(&schedule.workers[num_started].thread, NULL, subject_schedule_worker_thread, &schedule.workers[num_started]);
+      if (unlikely(err != 0)) {
+        // the remaining deques are stolen from
+        errno = err;
+        perror("pthread_create");
+        break;
+      }
+    }
+    subject_schedule_worker_thread(&schedule.workers[0]);
+    for (size_t i = 1; i < num_started; ++i) {
+      pthread_join(schedule.workers[i].thread, NULL);
+    }
+    assert(schedule.next_to_emit == num_files);
+  }
+
+  for (size_t i = 0; i < num_initialized; ++i) {
+    pthread_mutex_destroy(&schedule.workers[i].mutex);
+  }
+  pthread_mutex_destroy(&schedule.emit_mutex);
+  return ret;
+}
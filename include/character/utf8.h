@@ -0,0 +1,100 @@
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "basic/likely_unlikely.h"
+
+// result of utf8_decode_one
+typedef enum {
+  UTF8_DECODE_OK,
+  UTF8_DECODE_INVALID,    // the first byte doesn't begin a valid sequence
+  UTF8_DECODE_INCOMPLETE, // valid so far, but the range ended early
+} utf8_decode_one_type;
+
+// decode the UTF-8 sequence at the beginning of a non-empty range.
+// on UTF8_DECODE_OK, *out and *len are set.
+// overlong forms, surrogates and values past U+10FFFF are invalid
+utf8_decode_one_type utf8_decode_one(const unsigned char* begin, const unsigned char* end, uint_fast32_t* out, size_t* len) {
+  assert(begin < end);
+  unsigned char b0 = *begin;
+  if (b0 < 0x80) {
+    *out = b0;
+    *len = 1;
+    return UTF8_DECODE_OK;
+  }
+
+  size_t num_continuation;
+  uint_fast32_t value;
+  // the allowed range of the first continuation byte (the rest are 80..BF)
+  unsigned char lowest = 0x80;
+  unsigned char highest = 0xBF;
+  if (b0 < 0xC2) {
+    return UTF8_DECODE_INVALID; // stray continuation byte, or overlong (C0, C1)
+  } else if (b0 < 0xE0) {
+    num_continuation = 1;
+    value = b0 & 0x1F;
+  } else if (b0 < 0xF0) {
+    num_continuation = 2;
+    value = b0 & 0x0F;
+    if (b0 == 0xE0) lowest = 0xA0;  // overlong
+    if (b0 == 0xED) highest = 0x9F; // surrogates
+  } else if (b0 < 0xF5) {
+    num_continuation = 3;
+    value = b0 & 0x07;
+    if (b0 == 0xF0) lowest = 0x90;  // overlong
+    if (b0 == 0xF4) highest = 0x8F; // past U+10FFFF
+  } else {
+    return UTF8_DECODE_INVALID;
+  }
+
+  for (size_t i = 1; i <= num_continuation; ++i) {
+    if (begin + i == end) {
+      return UTF8_DECODE_INCOMPLETE;
+    }
+    unsigned char b = begin[i];
+    if (unlikely(b < lowest || b > highest)) {
+      return UTF8_DECODE_INVALID;
+    }
+    lowest = 0x80;
+    highest = 0xBF;
+    value = (value << 6) | (b & 0x3F);
+  }
+  *out = value;
+  *len = num_continuation + 1;
+  return UTF8_DECODE_OK;
+}
+
+// the code point that a position is interpreted as, when it doesn't begin a
+// valid sequence (same as the wchar_t subject decoding)
+#define UTF8_INVALID_CODE_POINT 0xFFFF
+
+// write the UTF-8 encoding of a code point to out, which points to at least 4
+// elements. returns the number of bytes written, or 0 if the value isn't an
+// encodable code point (surrogate or past U+10FFFF)
+size_t utf8_encode(uint_fast32_t code_point, char* out) {
+  if (code_point < 0x80) {
+    out[0] = code_point;
+    return 1;
+  } else if (code_point < 0x800) {
+    out[0] = 0xC0 | (code_point >> 6);
+    out[1] = 0x80 | (code_point & 0x3F);
+    return 2;
+  } else if (code_point < 0x10000) {
+    if (unlikely(code_point >= 0xD800 && code_point <= 0xDFFF)) {
+      return 0;
+    }
+    out[0] = 0xE0 | (code_point >> 12);
+    out[1] = 0x80 | ((code_point >> 6) & 0x3F);
+    out[2] = 0x80 | (code_point & 0x3F);
+    return 3;
+  } else if (code_point < 0x110000) {
+    out[0] = 0xF0 | (code_point >> 18);
+    out[1] = 0x80 | ((code_point >> 12) & 0x3F);
+    out[2] = 0x80 | ((code_point >> 6) & 0x3F);
+    out[3] = 0x80 | (code_point & 0x3F);
+    return 4;
+  }
+  return 0;
+}
@@ -2,9 +2,14 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <wchar.h>
 
+#include "basic/likely_unlikely.h"
+#include "character/code_unit.h"
+#include "character/utf8.h"
+
 typedef enum {
   CONVERT_PATTERN_WCHAR_ERROR,
   CONVERT_PATTERN_WCHAR_OK,
@@ -20,84 +25,151 @@ typedef struct {
   convert_pattern_to_wchar_range_result_value value;
 } convert_pattern_to_wchar_range_result;
 
-// convert a regex pattern to wchar_t range.
+// convert a regex pattern to wchar_t range. the pattern is decoded as UTF-8
+// (regardless of the locale).
 // out must point to an allocation greater or equal in number of elements to the input.
 convert_pattern_to_wchar_range_result convert_pattern_to_wchar_range(const char* begin, const char* end, wchar_t* out) {
   assert(begin <= end);
   convert_pattern_to_wchar_range_result ret;
-  mbstate_t ps;
-  memset(&ps, 0, sizeof(ps));
   while (begin != end) {
-    size_t num_bytes = mbrtowc(out, begin, end - begin, &ps);
-    switch (num_bytes) {
-      case 0:
-        num_bytes = 1;
-        goto suppress_fallthrough_warn;
-      default:
-suppress_fallthrough_warn:
-        begin += num_bytes;
-        out += 1;
-        break;
-      case (size_t)-1: // any error
-      case (size_t)-2: {
-        ret.type = CONVERT_PATTERN_WCHAR_ERROR;
-        ret.value.offending_location = begin;
-        return ret;
-      } break;
+    uint_fast32_t ch;
+    size_t len;
+    if (utf8_decode_one((const unsigned char*)begin, (const unsigned char*)end, &ch, &len) != UTF8_DECODE_OK) {
+      // invalid, or incomplete at the end of the pattern
+      ret.type = CONVERT_PATTERN_WCHAR_ERROR;
+      ret.value.offending_location = begin;
+      return ret;
     }
+    *out++ = ch;
+    begin += len;
   }
   ret.type = CONVERT_PATTERN_WCHAR_OK;
   ret.value.out_end = out;
   return ret;
 }
 
+// ============================ subject decoding ===============================
+
+// decode state retained between calls of convert_subject_to_wchar_range.
+// holds the leading bytes of a multibyte sequence that was incomplete at the
+// end of the previous segment. zero initialize (memset) before first use
+typedef struct {
+  unsigned char pending[3];
+  unsigned char num_pending;
+} utf8_decode_state;
+
+// private. emit for a byte which couldn't be decoded
+static wchar_t* utf8_decode_invalid(wchar_t* out, bool skip_invalid) {
+  // it's important that something is sent, otherwise characters that aren't
+  // adjacent will appear so from the perspective of the pattern matching
+  // downstream
+  if (!skip_invalid) *out++ = L'\uFFFF';
+  return out;
+}
+
 // intended for use in converting the subject text from a file before its use by the engine.
+// the subject text is always decoded as UTF-8 (regardless of the locale).
 // `out` must point to an allocation greater or equal in number of elements to the input.
 // the decode state, `ps`, must be retained between calls.
 // `complete` indicates that this is the last segment to decode from the input stream
 // `skip_invalid` indicates the behaviour of invalid bytes. if true, they are discarded.
-// if false, \\uFFFF is sent per invalid byte
+// if false, \uFFFF is sent per invalid byte
 // returns the end of the output.
-wchar_t* convert_subject_to_wchar_range(const char* begin, const char* end, bool complete, mbstate_t* ps, wchar_t* out, bool skip_invalid) {
-  assert(begin <= end);
-  while (begin != end) {
-    size_t num_bytes = mbrtowc(out, begin, end - begin, ps);
-    switch (num_bytes) {
-      case 0:
-        num_bytes = 1; // fallthrough with 1 character consumed
-        goto suppress_fallthrough_warn;
+wchar_t* convert_subject_to_wchar_range(const char* begin_arg, const char* end_arg, bool complete, utf8_decode_state* ps, wchar_t* out, bool skip_invalid) {
+  assert(begin_arg <= end_arg);
+  const unsigned char* begin = (const unsigned char*)begin_arg;
+  const unsigned char* end = (const unsigned char*)end_arg;
+
+  if (ps->num_pending != 0) {
+    // resume the sequence which was incomplete at the end of the previous call
+    unsigned char joined[4];
+    size_t num_joined = ps->num_pending;
+    memcpy(joined, ps->pending, num_joined);
+    while (num_joined != sizeof(joined) && begin + (num_joined - ps->num_pending) != end) {
+      joined[num_joined] = begin[num_joined - ps->num_pending];
+      ++num_joined;
+    }
+    uint_fast32_t ch;
+    size_t len;
+    switch (utf8_decode_one(joined, joined + num_joined, &ch, &len)) {
+      case UTF8_DECODE_OK:
+        *out++ = ch;
+        begin += len - ps->num_pending;
+        ps->num_pending = 0;
+        break;
+      case UTF8_DECODE_INVALID:
+        // the pending bytes are a lead byte and continuation bytes. with the
+        // lead byte invalidated, the continuation bytes are each invalid too.
+        // resume decoding at the beginning of this input
+        for (size_t i = 0; i < ps->num_pending; ++i) {
+          out = utf8_decode_invalid(out, skip_invalid);
+        }
+        ps->num_pending = 0;
+        break;
       default:
-suppress_fallthrough_warn:
-        begin += num_bytes;
-        out += 1;
+        assert(begin + (num_joined - ps->num_pending) == end); // all input consumed
+        if (complete) {
+          for (size_t i = 0; i < num_joined; ++i) {
+            out = utf8_decode_invalid(out, skip_invalid);
+          }
+          ps->num_pending = 0;
+        } else {
+          memcpy(ps->pending, joined, num_joined);
+          ps->num_pending = num_joined;
+        }
+        return out;
+    }
+  }
+
+  // the kernel decodes what it can, and the rest is decoded here. when it
+  // can't make progress (e.g. an invalid byte), it isn't used again until a
+  // block's worth of input has been decoded here
+  const unsigned char* kernel_from = begin;
+  while (begin != end) {
+    if (begin >= kernel_from) {
+      const unsigned char* decoded = code_unit_kernels.utf8_decode(begin, end, &out);
+      if (decoded != begin) {
+        begin = decoded;
+        continue;
+      }
+      kernel_from = end - begin > 32 ? begin + 32 : end;
+    }
+
+    if (*begin < 0x80) {
+      *out++ = *begin++;
+      continue;
+    }
+
+    uint_fast32_t ch;
+    size_t len;
+    switch (utf8_decode_one(begin, end, &ch, &len)) {
+      case UTF8_DECODE_OK:
+        *out++ = ch;
+        begin += len;
         break;
-      case (size_t)-1:
-        // decode error
-        // this is handled by consuming 1 byte of the input,
-        // and by sending a noncharacter-FFFF to the output. it's important
-        // that something is sent, otherwise characters that aren't adjacent will
-        // appear so from the perspective of the pattern matching downstream
-        if (!skip_invalid) *out++ = L'\uFFFF';
+      case UTF8_DECODE_INVALID:
+        // this is handled by consuming 1 byte of the input, and by sending a
+        // noncharacter-FFFF to the output
+        out = utf8_decode_invalid(out, skip_invalid);
         begin += 1;
-        memset(ps, 0, sizeof(*ps)); // make not unspecified
         break;
-      case (size_t)-2:
+      default:
+        assert(end - begin < 4);
         if (complete) {
           // represent n bytes of the incomplete multibyte with a noncharacter, each
-          if (!skip_invalid) {
-            while (begin != end) {
-              *out++ = L'\uFFFF';
-              begin += 1;
-            }
+          while (begin != end) {
+            out = utf8_decode_invalid(out, skip_invalid);
+            begin += 1;
           }
         } else {
           // incomplete multibyte.
           // state so far has been stored and will be resumed on next call
+          ps->num_pending = end - begin;
+          memcpy(ps->pending, begin, ps->num_pending);
+          begin = end;
         }
-        goto end;
         break;
     }
   }
-end:
   return out;
 }
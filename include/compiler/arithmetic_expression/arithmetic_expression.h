@@ -409,7 +409,21 @@ simple_token:
             } break;
           }
         } else {
+#ifdef USE_UTF8
+          // the literal is one code point, which can span several code units
+          uint_fast32_t code_point;
+          size_t code_point_len;
+          if (unlikely(UTF8_DECODE_OK != utf8_decode_one((const unsigned char*)begin, (const unsigned char*)end, &code_point, &code_point_len))) {
+            ret.type = ARITH_TOKENIZE_CAPACITY_ERROR;
+            ret.value.err.reason = "literal is not valid utf-8";
+            ret.value.err.offset = begin - original_begin;
+            goto end;
+          }
+          token.value.u32 = code_point;
+          begin += code_point_len - 1;
+#else
           token.value.u32 = ch;
+#endif
         }
         ++begin;
         if (unlikely(begin == end)) {
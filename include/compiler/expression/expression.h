@@ -267,8 +267,24 @@ expr_tokenize_result_internal tokenize_expression_internal(expr_tokenize_arg* ar
               goto end;
             }
 past_hex_completion:
+#ifdef USE_UTF8
+            { // the code point is matched as its encoded byte sequence
+              char encoded[4];
+              size_t encoded_len = utf8_encode(hex_value, encoded);
+              if (unlikely(encoded_len == 0)) {
+                ret.ret.offset = token.offset;
+                ret.ret.reason = "hex value is not an encodable code point";
+                goto end;
+              }
+              for (size_t i = 0; i < encoded_len; ++i) {
+                token.value.literal = encoded[i];
+                send_to_output(arg, token);
+              }
+            }
+#else
             token.value.literal = hex_value;
             send_to_output(arg, token);
+#endif
           } break;
         }
       } break;
@@ -609,3 +625,68 @@ expr_token_marker_low_result tokenize_expression_check_markers_lowest(const expr
   ret.value = num_unique_markers;
   return ret;
 }
+
+// ========================== literal coalescing ===============================
+
+// a pass between tokenize_expression and interpret_presetup. each run of two or
+// more adjacent literals at the top level of the expression is replaced with a
+// single call to the function called name, with the run as its argument. the
+// literals within a function's arguments are left as they are.
+//
+// name is typically str's (function_definition_for_str), so the run is
+// searched for with memmem and verified with one memcmp, rather than one
+// literal (and one indirect call) at a time. it must be registered for
+// interpret_presetup
+//
+// on the first pass, out should be null, and the number of tokens which will
+// be produced is returned. on the second pass, they're written to out
+size_t expr_coalesce_literals(const expr_token* begin, const expr_token* end, expr_token_string_range name, expr_token* out) {
+  assert(begin <= end);
+  size_t ret = 0;
+  size_t pending_endargs = 0; // zero at the top level
+  while (begin != end) {
+    const expr_token* run_end = begin;
+    if (pending_endargs == 0) {
+      while (run_end != end && run_end->type == EXPR_TOKEN_LITERAL) {
+        ++run_end;
+      }
+    }
+
+    if (run_end - begin < 2) {
+      if (begin->type == EXPR_TOKEN_FUNCTION) {
+        pending_endargs += begin->value.function.num_args;
+      } else if (begin->type == EXPR_TOKEN_ENDARG) {
+        assert(pending_endargs != 0);
+        --pending_endargs;
+      }
+      if (out) {
+        out[ret] = *begin;
+      }
+      ++ret;
+      ++begin;
+      continue;
+    }
+
+    // {name,run}
+    if (out) {
+      expr_token* function_token = &out[ret];
+      function_token->type = EXPR_TOKEN_FUNCTION;
+      function_token->offset = begin->offset;
+      function_token->value.function.name = name;
+      function_token->value.function.num_args = 1;
+      function_token->value.function.begin_marker.present = false;
+      function_token->value.function.begin_marker.marker_number = 0;
+      function_token->value.function.begin_marker.offset = 0;
+      function_token->value.function.end_marker = function_token->value.function.begin_marker;
+      for (size_t i = 0; begin + i != run_end; ++i) {
+        out[ret + 1 + i] = begin[i];
+      }
+      expr_token* endarg_token = &out[ret + 1 + (run_end - begin)];
+      endarg_token->type = EXPR_TOKEN_ENDARG;
+      endarg_token->offset = run_end[-1].offset;
+    }
+    ret += (run_end - begin) + 2;
+    begin = run_end;
+  }
+  return ret;
+}
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "compiler/expression/expression_interpret.h"
+
+// a pattern which has been set up (interpret_presetup, interpret_setup) can be
+// saved as a file, which is later used as is (e.g. mapped with mmap) instead
+// of compiling the pattern again. the file is:
+//
+//  - a header (expression_file_header)
+//  - each element's entry (expression_file_element)
+//  - the name of each element's function
+//  - the data for all elements, aligned to FUNCTION_DATA_CACHE_LINE within the
+//    file. since the data doesn't point into itself, it's used where it is
+//
+// a function is stored by its name, and is looked up among the registered
+// functions when the file is read. a file is only readable by a build with
+// the same configuration (CODE_UNIT, USE_UTF8, word size and byte order) and
+// format version. the data itself isn't validated; it must have been written
+// by expression_file_write with the same functions
+
+#define EXPRESSION_FILE_MAGIC "fastrgx"
+#define EXPRESSION_FILE_VERSION 2
+#define EXPRESSION_FILE_BYTE_ORDER 0x01020304u
+
+#define EXPRESSION_FILE_UTF8 1
+
+#define EXPRESSION_FILE_BEGIN_MARKER 1
+#define EXPRESSION_FILE_END_MARKER 2
+
+typedef struct {
+  char magic[8]; // EXPRESSION_FILE_MAGIC
+  uint32_t version;
+  uint32_t byte_order;     // EXPRESSION_FILE_BYTE_ORDER, as written
+  uint32_t code_unit_size; // sizeof(CODE_UNIT)
+  uint32_t size_t_size;    // sizeof(size_t)
+  uint32_t flags;          // EXPRESSION_FILE_UTF8
+  uint32_t num_elements;
+  uint64_t max_size_characters;       // from interpret_setup
+  uint64_t max_lookbehind_characters; // from interpret_setup
+  uint64_t names_offset;              // bytes, from the beginning of the file
+  uint64_t data_offset;               // bytes, from the beginning of the file
+  uint64_t data_size_bytes;
+} expression_file_header;
+
+typedef struct {
+  uint64_t function_data_offset; // bytes, from the beginning of the data
+  uint64_t function_data_size;   // bytes
+  uint64_t num_args;
+  uint64_t name_offset; // code units, from the beginning of the names
+  uint32_t name_size;   // code units
+  uint32_t opcode;      // the function's opcode when written
+  uint32_t markers;     // EXPRESSION_FILE_BEGIN_MARKER, EXPRESSION_FILE_END_MARKER
+  uint32_t begin_marker_number;
+  uint32_t end_marker_number;
+  int32_t begin_marker_offset;
+  int32_t end_marker_offset;
+} expression_file_element;
+
+// private. the flags for this build
+static uint32_t expression_file_flags() {
+#ifdef USE_UTF8
+  return EXPRESSION_FILE_UTF8;
+#else
+  return 0;
+#endif
+}
+
+// private. the offset of the names, which follow the elements
+static size_t expression_file_names_offset(size_t num_elements) {
+  return sizeof(expression_file_header) + num_elements * sizeof(expression_file_element);
+}
+
+// private. the number of bytes of data which the elements use
+static size_t expression_file_data_size(const function_setup_info* elements, size_t num_elements) {
+  size_t ret = 0;
+  for (size_t i = 0; i < num_elements; ++i) {
+    size_t end = elements[i].function_data_offset + elements[i].function_data_size;
+    if (end > ret) ret = end;
+  }
+  return ret;
+}
+
+// private
+static size_t expression_file_data_offset(const function_setup_info* elements, size_t num_elements) {
+  size_t ret = expression_file_names_offset(num_elements);
+  for (size_t i = 0; i < num_elements; ++i) {
+    const expr_token_string_range* name = &elements[i].definition->name;
+    ret += (name->end - name->begin) * sizeof(CODE_UNIT);
+  }
+  return (ret + FUNCTION_DATA_CACHE_LINE - 1) / FUNCTION_DATA_CACHE_LINE * FUNCTION_DATA_CACHE_LINE;
+}
+
+// the size of the file for a pattern. the arguments are the same as for
+// init_expression_pattern
+size_t expression_file_size(const function_setup_info* elements, size_t num_elements) {
+  return expression_file_data_offset(elements, num_elements) + expression_file_data_size(elements, num_elements);
+}
+
+// write the file for a pattern to out, which points to expression_file_size
+// bytes. the arguments are the same as for init_expression_pattern
+void expression_file_write(void* out,
+                           const function_setup_info* elements,
+                           size_t num_elements,
+                           const void* data,
+                           const interpret_setup_result* setup_result) {
+  assert(setup_result->success);
+  char* file = (char*)out;
+  size_t data_offset = expression_file_data_offset(elements, num_elements);
+  memset(file, 0, data_offset); // including the padding
+
+  expression_file_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, EXPRESSION_FILE_MAGIC, sizeof(header.magic));
+  header.version = EXPRESSION_FILE_VERSION;
+  header.byte_order = EXPRESSION_FILE_BYTE_ORDER;
+  header.code_unit_size = sizeof(CODE_UNIT);
+  header.size_t_size = sizeof(size_t);
+  header.flags = expression_file_flags();
+  header.num_elements = num_elements;
+  header.max_size_characters = setup_result->value.ok.max_size_characters;
+  header.max_lookbehind_characters = setup_result->value.ok.max_lookbehind_characters;
+  header.names_offset = expression_file_names_offset(num_elements);
+  header.data_offset = data_offset;
+  header.data_size_bytes = expression_file_data_size(elements, num_elements);
+  memcpy(file, &header, sizeof(header));
+
+  CODE_UNIT* names = (CODE_UNIT*)(file + header.names_offset);
+  size_t name_offset = 0;
+  for (size_t i = 0; i < num_elements; ++i) {
+    const expr_token_string_range* name = &elements[i].definition->name;
+    expression_file_element element;
+    memset(&element, 0, sizeof(element));
+    element.function_data_offset = elements[i].function_data_offset;
+    element.function_data_size = elements[i].function_data_size;
+    element.num_args = elements[i].num_args;
+    element.name_offset = name_offset;
+    element.name_size = name->end - name->begin;
+    element.opcode = elements[i].definition->opcode;
+    if (elements[i].begin_marker.present) {
+      element.markers |= EXPRESSION_FILE_BEGIN_MARKER;
+      element.begin_marker_number = elements[i].begin_marker.marker_number;
+      element.begin_marker_offset = elements[i].begin_marker.offset;
+    }
+    if (elements[i].end_marker.present) {
+      element.markers |= EXPRESSION_FILE_END_MARKER;
+      element.end_marker_number = elements[i].end_marker.marker_number;
+      element.end_marker_offset = elements[i].end_marker.offset;
+    }
+    memcpy(file + sizeof(header) + i * sizeof(element), &element, sizeof(element));
+    for (const CODE_UNIT* pos = name->begin; pos != name->end; ++pos) {
+      names[name_offset++] = *pos;
+    }
+  }
+
+  memcpy(file + data_offset, data, header.data_size_bytes);
+}
+
+typedef struct {
+  const char* reason; // NULL indicates success
+  size_t num_elements;
+
+  // on the second pass, the pattern's data (within the file), and the result
+  // to give to init_expression_pattern
+  const void* data;
+  interpret_setup_result setup_result;
+} expression_file_read_result;
+
+// read a file written by expression_file_write. file points to file_size
+// bytes, aligned to FUNCTION_DATA_CACHE_LINE (as mmap gives), which must
+// remain for as long as the pattern is used.
+//
+// this is done in two passes. on the first pass, elements_output should be
+// null. the file is validated, and the number of elements is given. on the
+// second pass, elements_output points to that many elements, which are
+// populated. each function is looked up in functions, which points to
+// num_function definitions sorted by function_definition_sort (the same
+// functions as for interpret_presetup).
+//
+// the elements, data and setup_result can then be given to
+// init_expression_pattern
+expression_file_read_result expression_file_read(const void* file,
+                                                 size_t file_size,
+                                                 size_t num_function,
+                                                 const function_definition* functions,
+                                                 function_setup_info* elements_output) {
+  expression_file_read_result ret;
+  ret.reason = NULL;
+  ret.num_elements = 0;
+  ret.data = NULL;
+
+  expression_file_header header;
+  if (unlikely(file_size < sizeof(header))) {
+    ret.reason = "not a pattern file";
+    return ret;
+  }
+  memcpy(&header, file, sizeof(header));
+  if (unlikely(memcmp(header.magic, EXPRESSION_FILE_MAGIC, sizeof(header.magic)) != 0)) {
+    ret.reason = "not a pattern file";
+    return ret;
+  }
+  if (unlikely(header.version != EXPRESSION_FILE_VERSION)) {
+    ret.reason = "unsupported pattern file version";
+    return ret;
+  }
+  if (unlikely(header.byte_order != EXPRESSION_FILE_BYTE_ORDER //
+               || header.code_unit_size != sizeof(CODE_UNIT)   //
+               || header.size_t_size != sizeof(size_t)         //
+               || header.flags != expression_file_flags())) {
+    ret.reason = "pattern file was written by a build with a different configuration";
+    return ret;
+  }
+  if (unlikely(header.names_offset != expression_file_names_offset(header.num_elements) //
+               || header.data_offset < header.names_offset                             //
+               || header.data_offset % FUNCTION_DATA_CACHE_LINE != 0                   //
+               || header.data_offset > file_size                                       //
+               || header.data_size_bytes > file_size - header.data_offset)) {
+    ret.reason = "pattern file is truncated or corrupt";
+    return ret;
+  }
+  if (unlikely((uintptr_t)file % FUNCTION_DATA_ALIGNMENT != 0)) {
+    ret.reason = "pattern file isn't aligned in memory";
+    return ret;
+  }
+  ret.num_elements = header.num_elements;
+  if (elements_output == NULL) {
+    return ret;
+  }
+
+  const char* bytes = (const char*)file;
+  const CODE_UNIT* names = (const CODE_UNIT*)(bytes + header.names_offset);
+  size_t names_size = (header.data_offset - header.names_offset) / sizeof(CODE_UNIT);
+  for (size_t i = 0; i < header.num_elements; ++i) {
+    expression_file_element element;
+    memcpy(&element, bytes + sizeof(header) + i * sizeof(element), sizeof(element));
+    if (unlikely(element.name_offset > names_size                                  //
+                 || element.name_size > names_size - element.name_offset           //
+                 || element.function_data_offset > header.data_size_bytes          //
+                 || element.function_data_size > header.data_size_bytes - element.function_data_offset)) {
+      ret.reason = "pattern file is truncated or corrupt";
+      return ret;
+    }
+
+    const function_definition* definition;
+    if (element.opcode == FUNCTION_OPCODE_LITERAL) {
+      definition = function_definition_for_literal();
+    } else {
+      expr_token_string_range name;
+      name.begin = names + element.name_offset;
+      name.end = name.begin + element.name_size;
+      definition = function_definition_lookup(name, num_function, functions);
+      if (unlikely(definition == NULL)) {
+        ret.reason = "pattern file uses a function which isn't registered";
+        return ret;
+      }
+    }
+    if (unlikely(definition->opcode != element.opcode)) {
+      ret.reason = "pattern file uses a function which differs from when it was written";
+      return ret;
+    }
+
+    elements_output[i].function_data_size = element.function_data_size;
+    elements_output[i].function_data_offset = element.function_data_offset;
+    elements_output[i].definition = definition;
+    elements_output[i].num_args = element.num_args;
+    elements_output[i].function_start = NULL; // the expression isn't kept
+    elements_output[i].begin_marker.present = (element.markers & EXPRESSION_FILE_BEGIN_MARKER) != 0;
+    elements_output[i].begin_marker.marker_number = element.begin_marker_number;
+    elements_output[i].begin_marker.offset = element.begin_marker_offset;
+    elements_output[i].end_marker.present = (element.markers & EXPRESSION_FILE_END_MARKER) != 0;
+    elements_output[i].end_marker.marker_number = element.end_marker_number;
+    elements_output[i].end_marker.offset = element.end_marker_offset;
+  }
+
+  ret.data = bytes + header.data_offset;
+  ret.setup_result.success = true;
+  ret.setup_result.value.ok.max_size_characters = header.max_size_characters;
+  ret.setup_result.value.ok.max_lookbehind_characters = header.max_lookbehind_characters;
+  return ret;
+}
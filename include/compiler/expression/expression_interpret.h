@@ -1,5 +1,6 @@
 #pragma once
 
+#include "character/code_unit_rare.h"
 #include "character/subject_buffer.h"
 #include "compiler/expression/expression.h"
 
@@ -42,11 +43,26 @@ typedef enum { MATCH_SUCCESS, MATCH_FAILURE, MATCH_INCOMPLETE } match_status;
 
 struct function_definition; // forward declare
 
+// identifies a built-in function, so the pattern driver can run it directly
+// rather than through the definition's function pointers (see
+// expression_match.h). any other function is FUNCTION_OPCODE_CALL
+typedef enum {
+  FUNCTION_OPCODE_CALL,
+  FUNCTION_OPCODE_LITERAL,
+  FUNCTION_OPCODE_STR,
+  FUNCTION_OPCODE_ARITH,
+  FUNCTION_OPCODE_EMPTY
+} function_opcode;
+
 typedef struct {
-  size_t function_data_size; // bytes
+  size_t function_data_size;   // bytes
+  size_t function_data_offset; // bytes, from the beginning of all data. see function_data_offset
   const struct function_definition* definition;
   size_t num_args;
   const expr_token* function_start;
+  // the function's markers (see expr_marker). a literal has none
+  expr_marker begin_marker;
+  expr_marker end_marker;
 } function_setup_info;
 
 // associates a function name with it's behaviour
@@ -108,9 +124,39 @@ typedef struct function_definition {
   //
   // the function must move the subject buffer's offset depending on the result:
   //  - INCOMPLETE : move to the beginning of the incomplete match
-  //  - SUCCESS : move the offset forward to one character past the matched content
+  //  - SUCCESS : move the offset forward to one character past the matched
+  //    content, and set match_begin to the beginning of the matched content
   //  - FAILURE : move to the end of the match buffer (buffer->size)
-  match_status (*entrypoint_interpret)(subject_buffer_state* buffer, const void* data, size_t data_size_bytes);
+  match_status (*entrypoint_interpret)(subject_buffer_state* buffer, const void* data, size_t data_size_bytes, size_t* match_begin);
+
+  // match the element in reverse, ending at the buffer's match offset
+  //
+  // this is called for the elements which precede the element used as the
+  // entrypoint, when it isn't the first (see selectivity)
+  //
+  // return INCOMPLETE if there's not enough content before the offset.
+  // otherwise, return SUCCESS on successful match, and FAILURE on no match.
+  //
+  // the function must move the subject buffer's offset depending on the result:
+  //  - INCOMPLETE : don't move the offset
+  //  - SUCCESS : move the offset back to the beginning of the matched content
+  //  - FAILURE : (doesn't matter)
+  //
+  // this function pointer can be NULL, in which case no element after this
+  // one is used as the entrypoint
+  match_status (*reverse_interpret)(subject_buffer_state* buffer, const void* data, size_t data_size_bytes);
+
+  // estimate how unlikely the element is to match at any given position, as
+  // -log2 of the probability in sixteenths of a bit (see code_unit_rarity).
+  // called after setup. of the elements which can be, the most selective one
+  // is used as the entrypoint, so that candidates are found as rarely as
+  // possible
+  //
+  // this function pointer can be NULL, which is the least selective
+  size_t (*selectivity)(const void* data, size_t data_size_bytes);
+
+  // FUNCTION_OPCODE_CALL, unless this is a built-in
+  function_opcode opcode;
 } function_definition;
 
 // ===================== definition for literal function (built in) ============
@@ -164,7 +210,7 @@ static match_status function_definition_for_literal_interpret(subject_buffer_sta
   return success ? MATCH_SUCCESS : MATCH_FAILURE;
 }
 
-static match_status function_definition_for_literal_entrypoint_interpret(subject_buffer_state* buffer, const void* data, size_t data_size_bytes) {
+static match_status function_definition_for_literal_entrypoint_interpret(subject_buffer_state* buffer, const void* data, size_t data_size_bytes, size_t* match_begin) {
   assert(data_size_bytes == sizeof(CODE_UNIT));
   #ifdef NDEBUG
     (void)(data_size_bytes);
@@ -175,11 +221,23 @@ static match_status function_definition_for_literal_entrypoint_interpret(subject
     buffer->offset = buffer->size;
     return MATCH_FAILURE;
   } else {
-    buffer->offset = (ptr - subject_buffer_start(buffer)) + 1;
+    *match_begin = ptr - subject_buffer_start(buffer);
+    buffer->offset = *match_begin + 1;
     return MATCH_SUCCESS;
   }
 }
 
+static match_status function_definition_for_literal_reverse_interpret(subject_buffer_state* buffer, const void* data, size_t) {
+  if (buffer->offset < 1) {
+    return MATCH_INCOMPLETE;
+  }
+  return subject_buffer_start(buffer)[--buffer->offset] == *(const CODE_UNIT*)data ? MATCH_SUCCESS : MATCH_FAILURE;
+}
+
+static size_t function_definition_for_literal_selectivity(const void* data, size_t) {
+  return code_unit_rarity(*(const CODE_UNIT*)data);
+}
+
 // ptr to static lifetime
 const function_definition* function_definition_for_literal() {
   static function_definition ret = {{NULL, NULL}, //
@@ -187,49 +245,15 @@ const function_definition* function_definition_for_literal() {
                                     function_definition_for_literal_setup,
                                     function_definition_for_literal_interpret,
                                     function_definition_for_literal_guaranteed_length_interpret,
-                                    function_definition_for_literal_entrypoint_interpret};
+                                    function_definition_for_literal_entrypoint_interpret,
+                                    function_definition_for_literal_reverse_interpret,
+                                    function_definition_for_literal_selectivity,
+                                    FUNCTION_OPCODE_LITERAL};
   return &ret;
 }
 
 // =============== helper functions ===============
 
-// wrapper, providing abstraction which reduces complexity of defined entrypoint function
-// if true is returned, the entrypoint successfully matched, and the offset points one after the match
-// false otherwise
-static bool entrypoint_interpret_wrapper(subject_buffer_state* buffer, //
-                                         const void* data,
-                                         size_t data_size_bytes,
-                                         match_status (*entrypoint_interpret)(subject_buffer_state* buffer, const void* data, size_t data_size_bytes)) {
-  while (1) {
-    size_t offset_before = buffer->offset;
-    match_status result = entrypoint_interpret(buffer, data, data_size_bytes);
-    // assertions
-    if (result == MATCH_SUCCESS) {
-      assert(buffer->offset >= offset_before); // must have been moved to end of match
-    } else if (result == MATCH_FAILURE) {
-      assert(buffer->offset == buffer->size); // moved to end of buffer
-    } else if (result == MATCH_INCOMPLETE) {
-      assert(offset_before == buffer->offset); // shouldn't have moved
-    }
-    #ifdef NDEBUG
-      (void)(offset_before);
-    #endif
-
-    if (result == MATCH_SUCCESS) {
-      return true;
-    }
-
-    bool input_complete = subject_buffer_shift_and_get_input(buffer); // get more input
-    if (likely(!input_complete)) {
-      continue; // more input has been received. try again to find a match
-    }
-
-    // no more input. this is the last segment to find a match in
-    result = entrypoint_interpret(buffer, data, data_size_bytes);
-    return result == MATCH_SUCCESS;
-  }
-}
-
 static int function_definition_sort_comp(const void* lhs_arg, const void* rhs_arg) {
   const function_definition* lhs = (const function_definition*)lhs_arg;
   const function_definition* rhs = (const function_definition*)rhs_arg;
@@ -259,6 +283,177 @@ void function_definition_sort(function_definition* functions, size_t num_functio
   qsort(functions, num_function, sizeof(*functions), function_definition_sort_comp);
 }
 
+// ========================== function registry ================================
+
+// an alternative to sorting the functions and looking each one up with a binary
+// search. a minimal perfect hash over the function names is built once, after
+// which a name is looked up by hashing it and comparing it with one function.
+//
+// each name hashes to one of num_function buckets. each bucket has a seed,
+// which is chosen (largest buckets first) so that its names hash with that
+// seed to distinct slots which aren't yet taken. each slot refers to one
+// function.
+//
+// the seeds and slots are plain arrays, so a registry which doesn't change can
+// be generated ahead of time and given them as constants (see
+// src/registry_gen.c, which does this for the standard library)
+typedef struct {
+  const function_definition* functions;
+  size_t num_function;
+  const uint32_t* seeds; // num_function elements, one per bucket
+  const uint32_t* slots; // num_function elements, each an index of functions
+} function_registry;
+
+// private
+static uint64_t function_registry_hash(expr_token_string_range name) {
+  uint64_t ret = 14695981039346656037u; // fnv-1a
+  for (const CODE_UNIT* pos = name.begin; pos != name.end; ++pos) {
+    ret ^= (uint64_t)*pos;
+    ret *= 1099511628211u;
+  }
+  return ret;
+}
+
+// private. the bucket (seed 0) or slot (the bucket's seed) for a name's hash
+static size_t function_registry_index(uint64_t hash, uint32_t seed, size_t num_function) {
+  uint64_t x = hash + (seed + 1) * 0x9E3779B97F4A7C15u; // splitmix64
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9u;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBu;
+  x ^= x >> 31;
+  return x % num_function;
+}
+
+// the number of elements of the work given to init_function_registry
+#define FUNCTION_REGISTRY_WORK_SIZE(num_function) (3 * (num_function))
+
+// functions points to num_function definitions (in any order), which must
+// remain for as long as the registry is used. seeds and slots each point to
+// num_function elements. work points to FUNCTION_REGISTRY_WORK_SIZE elements,
+// and is only used while the registry is built. returns false if two functions
+// have the same name
+bool init_function_registry(function_registry* registry,
+                            const function_definition* functions,
+                            size_t num_function,
+                            uint32_t* seeds,
+                            uint32_t* slots,
+                            size_t* work) {
+  registry->functions = functions;
+  registry->num_function = num_function;
+  registry->seeds = seeds;
+  registry->slots = slots;
+  if (num_function == 0) {
+    return true;
+  }
+
+  // the functions in each bucket, as ranges of members
+  size_t* bucket_end = work;
+  size_t* members = work + num_function;
+  size_t* bucket_slots = work + 2 * num_function; // of the bucket being placed
+  for (size_t i = 0; i < num_function; ++i) {
+    bucket_end[i] = 0;
+  }
+  size_t max_bucket_size = 0;
+  for (size_t i = 0; i < num_function; ++i) {
+    size_t bucket = function_registry_index(function_registry_hash(functions[i].name), 0, num_function);
+    if (++bucket_end[bucket] > max_bucket_size) max_bucket_size = bucket_end[bucket];
+  }
+  for (size_t i = 1; i < num_function; ++i) {
+    bucket_end[i] += bucket_end[i - 1];
+  }
+  for (size_t i = num_function; i-- != 0;) {
+    size_t bucket = function_registry_index(function_registry_hash(functions[i].name), 0, num_function);
+    members[--bucket_end[bucket]] = i;
+  }
+  // bucket_end is now each bucket's beginning
+  for (size_t i = 0; i < num_function; ++i) {
+    seeds[i] = 0;
+    slots[i] = UINT32_MAX; // free
+  }
+
+  for (size_t bucket_size = max_bucket_size; bucket_size != 0; --bucket_size) {
+    for (size_t bucket = 0; bucket < num_function; ++bucket) {
+      const size_t* bucket_members = members + bucket_end[bucket];
+      size_t next_begin = bucket + 1 == num_function ? num_function : bucket_end[bucket + 1];
+      if ((size_t)(members + next_begin - bucket_members) != bucket_size) {
+        continue;
+      }
+      for (size_t i = 0; i < bucket_size; ++i) {
+        for (size_t j = 0; j < i; ++j) {
+          const expr_token_string_range* lhs = &functions[bucket_members[i]].name;
+          const expr_token_string_range* rhs = &functions[bucket_members[j]].name;
+          if (unlikely(code_unit_range_cmp(lhs->begin, lhs->end, rhs->begin, rhs->end) == 0)) {
+            return false;
+          }
+        }
+      }
+
+      for (uint32_t seed = 1;; ++seed) {
+        assert(seed != 0); // a seed is found long before this
+        size_t placed = 0;
+        for (; placed < bucket_size; ++placed) {
+          uint64_t hash = function_registry_hash(functions[bucket_members[placed]].name);
+          size_t slot = function_registry_index(hash, seed, num_function);
+          if (slots[slot] != UINT32_MAX) break;
+          slots[slot] = bucket_members[placed]; // taken until the bucket is placed
+          bucket_slots[placed] = slot;
+        }
+        if (placed == bucket_size) {
+          seeds[bucket] = seed;
+          break;
+        }
+        while (placed != 0) {
+          slots[bucket_slots[--placed]] = UINT32_MAX;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// NULL if no function has the name
+const function_definition* function_registry_lookup(const function_registry* registry, expr_token_string_range name) {
+  size_t num_function = registry->num_function;
+  if (unlikely(num_function == 0)) {
+    return NULL;
+  }
+  uint64_t hash = function_registry_hash(name);
+  uint32_t seed = registry->seeds[function_registry_index(hash, 0, num_function)];
+  const function_definition* ret = &registry->functions[registry->slots[function_registry_index(hash, seed, num_function)]];
+  if (code_unit_range_cmp(name.begin, name.end, ret->name.begin, ret->name.end) != 0) {
+    return NULL;
+  }
+  return ret;
+}
+
+// ========================== function data layout =============================
+
+// the data given to interpret_setup holds each element's data, in order. it
+// must be aligned to FUNCTION_DATA_ALIGNMENT, and preferably to
+// FUNCTION_DATA_CACHE_LINE. each element's data is aligned as an object of its
+// size would need to be (up to FUNCTION_DATA_ALIGNMENT), and isn't split across
+// cache lines unless it's larger than one.
+//
+// a function's data must not point into itself (it refers to its own content
+// by offset instead), so all the data can be copied or mapped elsewhere with
+// the same alignment and used from there
+#define FUNCTION_DATA_ALIGNMENT 16 // as max_align_t, which isn't in c99
+#define FUNCTION_DATA_CACHE_LINE 64
+
+// the offset of an element's data, given the offset one past the previous
+// element's data
+size_t function_data_offset(size_t offset, size_t data_size_bytes) {
+  size_t alignment = 1;
+  while (alignment < data_size_bytes && alignment < FUNCTION_DATA_ALIGNMENT) {
+    alignment <<= 1;
+  }
+  offset = (offset + alignment - 1) / alignment * alignment;
+  if (data_size_bytes <= FUNCTION_DATA_CACHE_LINE //
+      && offset % FUNCTION_DATA_CACHE_LINE + data_size_bytes > FUNCTION_DATA_CACHE_LINE) {
+    offset = (offset / FUNCTION_DATA_CACHE_LINE + 1) * FUNCTION_DATA_CACHE_LINE;
+  }
+  return offset;
+}
+
 // ========================== interpret presetup ===============================
 
 // overall return status from interpret_presetup.
@@ -287,7 +482,9 @@ size_t interpret_presetup_get_number_of_function_calls(const expr_token* begin,
 
 // associates function names with their definitions and invokes the presetup on each function
 //
-// functions points to num_function defined functions, sorted by function_definition_sort
+// functions points to num_function defined functions, sorted by function_definition_sort.
+// alternatively, registry points to a function registry, in which case
+// functions and num_function aren't used. otherwise, it should be null
 //
 // presetup_info_output points to n elements (interpret_presetup_get_number_of_function_calls)
 //
@@ -299,6 +496,7 @@ typedef struct {
   const expr_token* end;
   size_t num_function;
   const function_definition* functions;
+  const function_registry* registry;
   function_setup_info* presetup_info_output;
   CODE_UNIT* error_msg_output;
 } interpret_presetup_arg;
@@ -323,7 +521,8 @@ interpret_presetup_result interpret_presetup(interpret_presetup_arg* arg) {
     } else {
       assert(token.type == EXPR_TOKEN_FUNCTION);
       // check if function has been registered
-      definition = function_definition_lookup(token.value.function.name, arg->num_function, arg->functions);
+      definition = arg->registry != NULL ? function_registry_lookup(arg->registry, token.value.function.name)
+                                         : function_definition_lookup(token.value.function.name, arg->num_function, arg->functions);
       if (unlikely(definition == NULL)) {
         ret.success = false;
         ret.value.err.size = 0;
@@ -350,7 +549,8 @@ interpret_presetup_result interpret_presetup(interpret_presetup_arg* arg) {
         return ret;
       }
     }
-    arg->presetup_info_output->definition = definition;
+    function_setup_info* info = arg->presetup_info_output;
+    info->definition = definition;
     function_presetup_result presetup_result = definition->presetup(&arg->begin, &arg->presetup_info_output);
 
     if (unlikely(presetup_result.success == false)) {
@@ -394,7 +594,15 @@ interpret_presetup_result interpret_presetup(interpret_presetup_arg* arg) {
       (void)(begin_before_call);
     #endif
 
-    ret.value.data_size_bytes += presetup_result.value.data_size_bytes;
+    if (token.type == EXPR_TOKEN_FUNCTION) {
+      info->begin_marker = token.value.function.begin_marker;
+      info->end_marker = token.value.function.end_marker;
+    } else {
+      memset(&info->begin_marker, 0, sizeof(info->begin_marker));
+      memset(&info->end_marker, 0, sizeof(info->end_marker));
+    }
+    info->function_data_offset = function_data_offset(ret.value.data_size_bytes, presetup_result.value.data_size_bytes);
+    ret.value.data_size_bytes = info->function_data_offset + presetup_result.value.data_size_bytes;
   }
 
   ret.success = true;
@@ -421,7 +629,7 @@ typedef struct {
 // both presetup_info and data were populated by interpret_presetup
 //
 // data points to n bytes, as specified by a successful return result from
-// interpret_presetup
+// interpret_presetup, aligned to FUNCTION_DATA_ALIGNMENT
 //
 // error_msg_output should point to null on first pass, and to an appropriate
 // sized allocation on second pass as indicated by a first pass failure return
@@ -435,6 +643,8 @@ typedef struct {
 } interpret_setup_arg;
 
 interpret_setup_result interpret_setup(interpret_setup_arg* arg) {
+  char* const data_begin = (char*)arg->data;
+  assert((uintptr_t)data_begin % FUNCTION_DATA_ALIGNMENT == 0);
   interpret_setup_result ret;
   ret.value.ok.max_lookbehind_characters = 0;
   ret.value.ok.max_size_characters = 0;
@@ -448,6 +658,7 @@ interpret_setup_result interpret_setup(interpret_setup_arg* arg) {
 
     const function_definition* definition = arg->presetup_info->definition;
     size_t data_size = arg->presetup_info->function_data_size;
+    arg->data = data_begin + arg->presetup_info->function_data_offset;
 
     const expr_token* begin_before_call = arg->begin;
     function_setup_result result = definition->setup(&arg->begin, &arg->presetup_info, arg->data, data_size);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <limits.h>
+#include "character/code_unit_rare.h"
 #include "compiler/arithmetic_expression/arithmetic_expression_interpret.h"
 #include "compiler/expression/expression_interpret.h"
 
@@ -13,13 +15,31 @@ static const arith_expr_allowed_symbols* arith_function_allowed_symbols() {
   return &ret;
 }
 
-// private
+// private. the expression is the following tokens. it's kept by its length
+// rather than as an arith_expr, which would point into the data
 typedef struct {
-  // expr points to following token range
-  arith_expr expr;
+  size_t stack_required;
+  size_t num_parsed;
+#if !defined(USE_WCHAR) && !defined(USE_UTF8)
+  // if the expression is true for at most CODE_UNIT_SET_CAPACITY code units,
+  // then they're searched for as a set, rather than evaluating the expression
+  // at each position. the code units can be enumerated in this configuration
+  // only
+  bool use_set;
+  code_unit_set set;
+#endif
   arith_parsed tokens[];
 } function_definition_arith_data;
 
+// private
+static arith_expr function_definition_arith_expr(const function_definition_arith_data* data) {
+  arith_expr ret;
+  ret.stack_required = data->stack_required;
+  ret.begin = data->tokens;
+  ret.end = data->tokens + data->num_parsed;
+  return ret;
+}
+
 function_presetup_result function_definition_for_arith_presetup(const expr_token** function_start, function_setup_info** presetup_info) {
   function_presetup_result ret;
   ret.success = true;
@@ -85,7 +105,11 @@ function_presetup_result function_definition_for_arith_presetup(const expr_token
 static function_setup_result function_definition_for_arith_setup(const expr_token** function_start, const function_setup_info** presetup_info, void* data, size_t data_size_bytes) {
   function_setup_result ret;
   ret.success = true;
+#ifdef USE_UTF8
+  ret.value.ok.max_size_characters = 4; // longest utf-8 sequence
+#else
   ret.value.ok.max_size_characters = 1;
+#endif
   ret.value.ok.max_lookbehind_characters = 0;
 
   (*function_start)++;
@@ -126,16 +150,62 @@ static function_setup_result function_definition_for_arith_setup(const expr_toke
     ret.value.err.reason = expr_result.value.err.reason;
     return ret;
   }
-  ((function_definition_arith_data*)data)->expr = expr_result.value.expr;
+  ((function_definition_arith_data*)data)->stack_required = expr_result.value.expr.stack_required;
+  ((function_definition_arith_data*)data)->num_parsed = expr_result.value.expr.end - expr_result.value.expr.begin;
+#if !defined(USE_WCHAR) && !defined(USE_UTF8)
+  {
+    function_definition_arith_data* arith_data = (function_definition_arith_data*)data;
+    CODE_UNIT units[CODE_UNIT_SET_CAPACITY];
+    size_t num_units = 0;
+    arith_data->use_set = true;
+    for (unsigned int i = 0; i <= UCHAR_MAX; ++i) {
+      // same conversion as when interpreted
+      uint_fast32_t character = (CODE_UNIT)i;
+      if (interpret_arithmetic_expression(function_definition_arith_expr(arith_data), &character)) {
+        if (num_units == CODE_UNIT_SET_CAPACITY) {
+          arith_data->use_set = false;
+          break;
+        }
+        units[num_units++] = (CODE_UNIT)i;
+      }
+    }
+    if (arith_data->use_set) {
+      code_unit_set_init(&arith_data->set, units, num_units);
+    }
+  }
+#endif
   (*presetup_info)++;
+  (*function_start) = arg_end + 1;
+  return ret;
+}
+
+#ifdef USE_UTF8
+// private. decode the code point at the match offset, which must be before the
+// end of the buffer. a position which doesn't begin a valid sequence is
+// interpreted as UTF8_INVALID_CODE_POINT spanning one code unit
+static utf8_decode_one_type function_definition_arith_decode(subject_buffer_state* buffer, uint_fast32_t* character, size_t* len) {
+  const unsigned char* pos = (const unsigned char*)subject_buffer_offset(buffer);
+  utf8_decode_one_type ret = utf8_decode_one(pos, (const unsigned char*)subject_buffer_end(buffer), character, len);
+  if (ret != UTF8_DECODE_OK) {
+    *character = UTF8_INVALID_CODE_POINT;
+    *len = 1;
+  }
   return ret;
 }
+#endif
 
 static bool function_definition_for_arith_guaranteed_length_interpret(subject_buffer_state* buffer, const void* data, size_t) {
   assert(subject_buffer_remaining_size(buffer) >= 1);
   const function_definition_arith_data* expr = (const function_definition_arith_data*)data;
+#ifdef USE_UTF8
+  uint_fast32_t character;
+  size_t len;
+  function_definition_arith_decode(buffer, &character, &len);
+  buffer->offset += len;
+#else
   uint_fast32_t character = subject_buffer_start(buffer)[buffer->offset++];
-  return interpret_arithmetic_expression(expr->expr, &character);
+#endif
+  return interpret_arithmetic_expression(function_definition_arith_expr(expr), &character);
 }
 
 static match_status function_definition_for_arith_interpret(subject_buffer_state* buffer, const void* data, size_t data_size_bytes) {
@@ -143,23 +213,112 @@ static match_status function_definition_for_arith_interpret(subject_buffer_state
   if (characters_remaining < 1) {
     return MATCH_INCOMPLETE;
   }
-  bool success = function_definition_for_literal_guaranteed_length_interpret(buffer, data, data_size_bytes);
+#ifdef USE_UTF8
+  uint_fast32_t character;
+  size_t len;
+  if (function_definition_arith_decode(buffer, &character, &len) == UTF8_DECODE_INCOMPLETE) {
+    return MATCH_INCOMPLETE; // the rest of the code point might follow
+  }
+#endif
+  bool success = function_definition_for_arith_guaranteed_length_interpret(buffer, data, data_size_bytes);
   return success ? MATCH_SUCCESS : MATCH_FAILURE;
 }
 
-static match_status function_definition_for_arith_entrypoint_interpret(subject_buffer_state* buffer, const void* data, size_t) {
+static match_status function_definition_for_arith_entrypoint_interpret(subject_buffer_state* buffer, const void* data, size_t, size_t* match_begin) {
   const function_definition_arith_data* expr = (const function_definition_arith_data*)data;
 
+#if !defined(USE_WCHAR) && !defined(USE_UTF8)
+  if (expr->use_set) {
+    const CODE_UNIT* found = code_unit_memchr_set(subject_buffer_offset(buffer), &expr->set, subject_buffer_remaining_size(buffer));
+    if (found == NULL) {
+      buffer->offset = buffer->size;
+      return MATCH_FAILURE;
+    }
+    *match_begin = found - subject_buffer_start(buffer);
+    buffer->offset = *match_begin + 1;
+    return MATCH_SUCCESS;
+  }
+#endif
+
   while (buffer->offset != buffer->size) {
+    size_t begin = buffer->offset;
+#ifdef USE_UTF8
+    uint_fast32_t character;
+    size_t len;
+    if (function_definition_arith_decode(buffer, &character, &len) == UTF8_DECODE_INCOMPLETE) {
+      return MATCH_INCOMPLETE; // offset is at the beginning of the incomplete code point
+    }
+    buffer->offset += len;
+#else
     uint_fast32_t character = subject_buffer_start(buffer)[buffer->offset++];
-    bool result = interpret_arithmetic_expression(expr->expr, &character);
+#endif
+    bool result = interpret_arithmetic_expression(function_definition_arith_expr(expr), &character);
     if (result) {
+      *match_begin = begin;
       return MATCH_SUCCESS;
     }
   }
   return MATCH_FAILURE;
 }
 
+static match_status function_definition_for_arith_reverse_interpret(subject_buffer_state* buffer, const void* data, size_t) {
+  const function_definition_arith_data* expr = (const function_definition_arith_data*)data;
+  if (buffer->offset < 1) {
+    return MATCH_INCOMPLETE;
+  }
+#ifdef USE_UTF8
+  // the code point which ends at the offset. if there isn't a valid sequence
+  // ending there, the last byte is interpreted alone
+  const unsigned char* end = (const unsigned char*)subject_buffer_offset(buffer);
+  uint_fast32_t character = UTF8_INVALID_CODE_POINT;
+  size_t len = 1;
+  for (size_t back = 1; back <= 4 && back <= buffer->offset; ++back) {
+    const unsigned char* pos = end - back;
+    if ((*pos & 0xC0) != 0x80) {
+      uint_fast32_t decoded;
+      size_t decoded_len;
+      if (utf8_decode_one(pos, end, &decoded, &decoded_len) == UTF8_DECODE_OK && decoded_len == back) {
+        character = decoded;
+        len = back;
+      }
+      break;
+    }
+  }
+  buffer->offset -= len;
+#else
+  uint_fast32_t character = subject_buffer_start(buffer)[--buffer->offset];
+#endif
+  return interpret_arithmetic_expression(function_definition_arith_expr(expr), &character) ? MATCH_SUCCESS : MATCH_FAILURE;
+}
+
+// estimated from the byte values for which the expression is true (for wide
+// characters, the code points below 256): the rarity of the most common of
+// them, less the number of them
+static size_t function_definition_for_arith_selectivity(const void* data, size_t) {
+  const function_definition_arith_data* expr = (const function_definition_arith_data*)data;
+  size_t num_true = 0;
+  size_t min_rarity = SIZE_MAX;
+  for (unsigned int i = 0; i <= UCHAR_MAX; ++i) {
+#if defined(USE_WCHAR) || defined(USE_UTF8)
+    uint_fast32_t character = i;
+#else
+    uint_fast32_t character = (CODE_UNIT)i; // same conversion as when interpreted
+#endif
+    if (interpret_arithmetic_expression(function_definition_arith_expr(expr), &character)) {
+      ++num_true;
+      size_t rarity = code_unit_rarity((CODE_UNIT)i);
+      if (rarity < min_rarity) min_rarity = rarity;
+    }
+  }
+  if (num_true == 0) {
+    return code_unit_rarity(0); // as if it were one rare unit
+  }
+  size_t log2_num_true = 0;
+  while (num_true >>= 1) ++log2_num_true;
+  size_t adjust = 16 * log2_num_true;
+  return min_rarity > adjust ? min_rarity - adjust : 0;
+}
+
 // ptr to static lifetime
 const function_definition* function_definition_for_arith() {
   static const CODE_UNIT arith[] = {'a', 'r', 'i', 't', 'h'};
@@ -168,6 +327,9 @@ const function_definition* function_definition_for_arith() {
                                     function_definition_for_arith_setup,
                                     function_definition_for_arith_interpret,
                                     function_definition_for_arith_guaranteed_length_interpret,
-                                    function_definition_for_arith_entrypoint_interpret};
+                                    function_definition_for_arith_entrypoint_interpret,
+                                    function_definition_for_arith_reverse_interpret,
+                                    function_definition_for_arith_selectivity,
+                                    FUNCTION_OPCODE_ARITH};
   return &ret;
 }
\ No newline at end of file
@@ -51,6 +51,10 @@ static match_status function_definition_for_empty_interpret(subject_buffer_state
   return MATCH_SUCCESS;
 }
 
+static match_status function_definition_for_empty_reverse_interpret(subject_buffer_state*, const void*, size_t) {
+  return MATCH_SUCCESS;
+}
+
 // ptr to static lifetime
 // an empty function name should be used for markers
 // {0}hello{1}
@@ -60,6 +64,9 @@ const function_definition* function_definition_for_empty() {
                                     function_definition_for_empty_setup,
                                     function_definition_for_empty_interpret,
                                     function_definition_for_empty_guaranteed_length_interpret,
-                                    NULL};
+                                    NULL,
+                                    function_definition_for_empty_reverse_interpret,
+                                    NULL,
+                                    FUNCTION_OPCODE_EMPTY};
   return &ret;
 }
@@ -0,0 +1,16 @@
+#pragma once
+#include "compiler/expression/expression_interpret_standardlib/arith.h"
+#include "compiler/expression/expression_interpret_standardlib/empty.h"
+#include "compiler/expression/expression_interpret_standardlib/str.h"
+
+#define STANDARDLIB_NUM_FUNCTIONS 3
+
+// out points to STANDARDLIB_NUM_FUNCTIONS elements. they're sorted (see
+// function_definition_sort), which is also the order that a registry generated
+// for the standard library refers to
+void init_standardlib_definitions(function_definition* out) {
+  out[0] = *function_definition_for_arith();
+  out[1] = *function_definition_for_empty();
+  out[2] = *function_definition_for_str();
+  function_definition_sort(out, STANDARDLIB_NUM_FUNCTIONS);
+}
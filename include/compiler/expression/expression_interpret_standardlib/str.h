@@ -1,7 +1,32 @@
 #pragma once
 
+#include "character/code_unit_rare.h"
 #include "compiler/expression/expression_interpret.h"
 
+// the data is the needle, followed by its failure table (see
+// code_unit_failure_table) which is used to find an incomplete match at the
+// end of the segment, followed by the positions of the needle's two rarest
+// units (see code_unit_rarest_pair) which the search is anchored on. the table
+// is aligned relative to the data (which is itself aligned, see
+// function_data_offset), so there's some room for padding after the needle.
+//
+// private. the number of elements in the needle
+static size_t function_definition_for_str_needle_len(size_t data_size_bytes) {
+  return (data_size_bytes - 3 * sizeof(size_t)) / (sizeof(CODE_UNIT) + sizeof(size_t));
+}
+
+// private. the failure table following the needle
+static const size_t* function_definition_for_str_failure(const void* data, size_t needle_len) {
+  size_t table = needle_len * sizeof(CODE_UNIT);
+  table = (table + sizeof(size_t) - 1) / sizeof(size_t) * sizeof(size_t);
+  return (const size_t*)((const char*)data + table);
+}
+
+// private. the positions of the rare units, following the failure table
+static const size_t* function_definition_for_str_rare(const void* data, size_t needle_len) {
+  return function_definition_for_str_failure(data, needle_len) + needle_len;
+}
+
 function_presetup_result function_definition_for_str_presetup(const expr_token** function_start, function_setup_info** presetup_info) {
   function_presetup_result ret;
   ret.success = true;
@@ -39,7 +64,8 @@ function_presetup_result function_definition_for_str_presetup(const expr_token**
     arg_end += 1;
   }
 
-  ret.value.data_size_bytes = (arg_end - arg_begin) * sizeof(CODE_UNIT);
+  size_t needle_len = arg_end - arg_begin;
+  ret.value.data_size_bytes = needle_len * (sizeof(CODE_UNIT) + sizeof(size_t)) + 3 * sizeof(size_t);
   (*presetup_info)->function_data_size = ret.value.data_size_bytes;
   (*presetup_info)++;
   (*function_start) = arg_end + 1;
@@ -49,16 +75,26 @@ function_presetup_result function_definition_for_str_presetup(const expr_token**
 static function_setup_result function_definition_for_str_setup(const expr_token** function_start, const function_setup_info** presetup_info, void* data, size_t data_size_bytes) {
   function_setup_result ret;
   ret.success = true;
-  assert(data_size_bytes % sizeof(CODE_UNIT) == 0);
-  ret.value.ok.max_size_characters = data_size_bytes / sizeof(CODE_UNIT);
+  size_t needle_len = function_definition_for_str_needle_len(data_size_bytes);
+  ret.value.ok.max_size_characters = needle_len;
   ret.value.ok.max_lookbehind_characters = 0;
 
   assert((*function_start)->type == EXPR_TOKEN_FUNCTION);
   (*function_start)++;
-  for (size_t i = 0; i < ret.value.ok.max_size_characters; ++i) {
+  for (size_t i = 0; i < needle_len; ++i) {
     assert((*function_start)->type == EXPR_TOKEN_LITERAL);
     ((CODE_UNIT*)data)[i] = (*function_start)++->value.literal;
   }
+  size_t* failure = (size_t*)function_definition_for_str_failure(data, needle_len);
+  size_t* rare = failure + needle_len;
+  assert((char*)(rare + 2) <= (char*)data + data_size_bytes);
+  code_unit_failure_table((const CODE_UNIT*)data, needle_len, failure);
+  if (needle_len != 0) {
+    code_unit_rarest_pair((const CODE_UNIT*)data, needle_len, &rare[0], &rare[1]);
+  } else {
+    rare[0] = 0;
+    rare[1] = 0;
+  }
   assert((*function_start)->type == EXPR_TOKEN_ENDARG);
   (*function_start)++;
   (*presetup_info)++;
@@ -67,16 +103,16 @@ static function_setup_result function_definition_for_str_setup(const expr_token*
 
 static bool function_definition_for_str_guaranteed_length_interpret(subject_buffer_state* buffer, const void* data, size_t data_size_bytes) {
   const CODE_UNIT* needle = data;
-  size_t needle_len = data_size_bytes / sizeof(CODE_UNIT); // number of elements
+  size_t needle_len = function_definition_for_str_needle_len(data_size_bytes);
   assert(subject_buffer_remaining_size(buffer) >= needle_len);
-  bool ret = code_unit_memcmp(subject_buffer_offset(buffer), needle, needle_len);
+  bool ret = code_unit_memcmp(subject_buffer_offset(buffer), needle, needle_len) == 0;
   buffer->offset += needle_len;
   return ret;
 }
 
 static match_status function_definition_for_str_interpret(subject_buffer_state* buffer, const void* data, size_t data_size_bytes) {
   size_t characters_remaining = subject_buffer_remaining_size(buffer);
-  size_t needle_len = data_size_bytes / sizeof(CODE_UNIT); // number of elements
+  size_t needle_len = function_definition_for_str_needle_len(data_size_bytes);
   if (characters_remaining < needle_len) {
     return MATCH_INCOMPLETE;
   }
@@ -84,18 +120,21 @@ static match_status function_definition_for_str_interpret(subject_buffer_state*
   return success ? MATCH_SUCCESS : MATCH_FAILURE;
 }
 
-static match_status function_definition_for_str_entrypoint_interpret(subject_buffer_state* buffer, const void* data, size_t data_size_bytes) {
+static match_status function_definition_for_str_entrypoint_interpret(subject_buffer_state* buffer, const void* data, size_t data_size_bytes, size_t* match_begin) {
   const CODE_UNIT* haystack = subject_buffer_start(buffer) + buffer->offset;
   size_t haystack_len = subject_buffer_remaining_size(buffer); // number of elements
   const CODE_UNIT* needle = data;
-  size_t needle_len = data_size_bytes / sizeof(CODE_UNIT); // number of elements
-  const CODE_UNIT* result = code_unit_memmem(haystack, haystack_len, needle, needle_len);
+  size_t needle_len = function_definition_for_str_needle_len(data_size_bytes);
+  const size_t* rare = function_definition_for_str_rare(data, needle_len);
+  const CODE_UNIT* result = code_unit_memmem_rare(haystack, haystack_len, needle, needle_len, rare[0], rare[1]);
   if (result != NULL) {
-    buffer->offset = (result - subject_buffer_start(buffer)) + needle_len;
+    *match_begin = result - subject_buffer_start(buffer);
+    buffer->offset = *match_begin + needle_len;
     return MATCH_SUCCESS;
   }
 
-  result = code_unit_incomplete_suffix(haystack, haystack_len, needle, needle_len);
+  const size_t* failure = function_definition_for_str_failure(data, needle_len);
+  result = code_unit_incomplete_suffix_kmp(haystack, haystack_len, needle, needle_len, failure);
   if (result == NULL) {
     buffer->offset = buffer->size;
     return MATCH_FAILURE;
@@ -105,6 +144,27 @@ static match_status function_definition_for_str_entrypoint_interpret(subject_buf
   }
 }
 
+static match_status function_definition_for_str_reverse_interpret(subject_buffer_state* buffer, const void* data, size_t data_size_bytes) {
+  const CODE_UNIT* needle = data;
+  size_t needle_len = function_definition_for_str_needle_len(data_size_bytes);
+  if (buffer->offset < needle_len) {
+    return MATCH_INCOMPLETE;
+  }
+  buffer->offset -= needle_len;
+  return code_unit_memcmp(subject_buffer_offset(buffer), needle, needle_len) == 0 ? MATCH_SUCCESS : MATCH_FAILURE;
+}
+
+// each unit is taken as independent
+static size_t function_definition_for_str_selectivity(const void* data, size_t data_size_bytes) {
+  const CODE_UNIT* needle = data;
+  size_t needle_len = function_definition_for_str_needle_len(data_size_bytes);
+  size_t ret = 0;
+  for (size_t i = 0; i < needle_len; ++i) {
+    ret += code_unit_rarity(needle[i]);
+  }
+  return ret;
+}
+
 // ptr to static lifetime
 const function_definition* function_definition_for_str() {
   static const CODE_UNIT s[] = {'s', 't', 'r'};
@@ -113,6 +173,9 @@ const function_definition* function_definition_for_str() {
                                     function_definition_for_str_setup,
                                     function_definition_for_str_interpret,
                                     function_definition_for_str_guaranteed_length_interpret,
-                                    function_definition_for_str_entrypoint_interpret};
+                                    function_definition_for_str_entrypoint_interpret,
+                                    function_definition_for_str_reverse_interpret,
+                                    function_definition_for_str_selectivity,
+                                    FUNCTION_OPCODE_STR};
   return &ret;
-}
\ No newline at end of file
+}
@@ -0,0 +1,490 @@
+#pragma once
+
+#include "character/subject_buffer.h"
+#include "compiler/expression/expression_interpret.h"
+#include "compiler/expression/expression_interpret_standardlib/arith.h"
+#include "compiler/expression/expression_interpret_standardlib/empty.h"
+#include "compiler/expression/expression_interpret_standardlib/str.h"
+
+// runs a pattern which has been set up (interpret_presetup, interpret_setup)
+// against a subject buffer.
+//
+// the pattern is a sequence of elements, each matched where the previous one
+// ended. one element (the entrypoint element) searches the subject for a
+// candidate; it's the most selective element which has an entrypoint (see
+// function_definition selectivity), so that the search skips as much of the
+// subject as possible. the elements before it are matched in reverse from the
+// beginning of the candidate. the elements after it are then matched in order
+// from the end of the candidate. if there's enough left in the buffer for the
+// entire pattern (max_size_characters), they're matched with
+// guaranteed_length_interpret, which skips the bound checks. otherwise,
+// they're matched with interpret, and if more input is needed, the buffer is
+// shifted and the candidate tried again.
+//
+// each element is run as an op: the built-ins are run by switching on their
+// opcode, which calls their implementation directly (so it can be inlined),
+// and any other function is called through its definition.
+
+typedef struct {
+  function_opcode opcode;
+  const function_definition* definition;
+  const void* data;
+  size_t data_size_bytes;
+} expression_op;
+
+typedef struct {
+  // each element's definition and data size. from interpret_presetup
+  const function_setup_info* elements;
+  size_t num_elements;
+  // the data for all elements, in order. from interpret_setup, or a copy of it
+  // (see function_data_offset)
+  const char* data;
+  // each element as an op, with its data
+  const expression_op* program;
+  size_t max_size_characters;
+  // the lookbehind which the subject buffer must be initialized with. this is
+  // the pattern's own, plus room for the elements before the entrypoint
+  // element (bounded by the size of the entire pattern)
+  size_t max_lookbehind_characters;
+
+  // the element which searches for candidates
+  size_t entry;
+
+  // one more than the highest marker number of any element (see
+  // expr_marker), or 0 if there are no markers
+  size_t num_markers;
+} expression_pattern;
+
+// the position of a marker which wasn't reached by the match
+#define EXPRESSION_MARKER_UNSET UINT64_MAX
+
+// elements points to the presetup info given to interpret_presetup, and
+// num_elements is the number it populated (how far presetup_info_output was
+// moved). data is the data given to interpret_setup (or a copy, aligned the
+// same way), and setup_result is its successful result. program points to
+// num_elements ops, which are filled and referred to by the pattern.
+//
+// returns false if no element can search for a match (no element has an
+// entrypoint which can be used, or the pattern can't consume any content)
+bool init_expression_pattern(expression_pattern* pattern,
+                             const function_setup_info* elements,
+                             size_t num_elements,
+                             const void* data,
+                             const interpret_setup_result* setup_result,
+                             expression_op* program) {
+  assert(setup_result->success);
+  pattern->elements = elements;
+  pattern->num_elements = num_elements;
+  pattern->data = (const char*)data;
+  pattern->program = program;
+  pattern->max_size_characters = setup_result->value.ok.max_size_characters;
+  pattern->max_lookbehind_characters = setup_result->value.ok.max_lookbehind_characters;
+  pattern->num_markers = 0;
+
+  // the most selective element with an entrypoint, which the elements before
+  // can be matched in reverse from. the first on a tie
+  bool found = false;
+  bool can_be_entry = true;
+  size_t best_selectivity = 0;
+  for (size_t i = 0; i < num_elements; ++i) {
+    const function_definition* definition = elements[i].definition;
+    const char* element_data = pattern->data + elements[i].function_data_offset;
+    size_t data_size = elements[i].function_data_size;
+    program[i].opcode = definition->opcode;
+    program[i].definition = definition;
+    program[i].data = element_data;
+    program[i].data_size_bytes = data_size;
+    const expr_marker* markers[2] = {&elements[i].begin_marker, &elements[i].end_marker};
+    for (size_t j = 0; j < 2; ++j) {
+      if (markers[j]->present && markers[j]->marker_number >= pattern->num_markers) {
+        pattern->num_markers = (size_t)markers[j]->marker_number + 1;
+      }
+    }
+    if (can_be_entry && definition->entrypoint_interpret != NULL) {
+      size_t selectivity = definition->selectivity == NULL ? 0 : definition->selectivity(element_data, data_size);
+      if (!found || selectivity > best_selectivity) {
+        found = true;
+        best_selectivity = selectivity;
+        pattern->entry = i;
+      }
+    }
+    if (definition->reverse_interpret == NULL) {
+      can_be_entry = false; // nor any element after
+    }
+  }
+  if (found && pattern->entry != 0) {
+    pattern->max_lookbehind_characters += pattern->max_size_characters;
+  }
+  return found && pattern->max_size_characters != 0;
+}
+
+// the capacity required of a subject buffer to match the pattern: a candidate
+// and its lookbehind must fit, with at least one character to shift
+size_t expression_pattern_min_capacity(const expression_pattern* pattern) {
+  return pattern->max_size_characters + pattern->max_lookbehind_characters + 1;
+}
+
+// private. the needle which the pattern's entrypoint element searches for, or
+// null if it isn't a literal or str
+static const CODE_UNIT* expression_pattern_needle(const expression_pattern* pattern, size_t* len) {
+  const expression_op* entry = &pattern->program[pattern->entry];
+  if (entry->opcode == FUNCTION_OPCODE_LITERAL) {
+    *len = 1;
+  } else if (entry->opcode == FUNCTION_OPCODE_STR) {
+    *len = function_definition_for_str_needle_len(entry->data_size_bytes);
+  } else {
+    return NULL;
+  }
+  return *len == 0 ? NULL : (const CODE_UNIT*)entry->data;
+}
+
+// private. run an op's guaranteed_length_interpret
+static inline bool expression_op_guaranteed_length_interpret(const expression_op* op, subject_buffer_state* buf) {
+  switch (op->opcode) {
+    case FUNCTION_OPCODE_LITERAL:
+      return function_definition_for_literal_guaranteed_length_interpret(buf, op->data, op->data_size_bytes);
+    case FUNCTION_OPCODE_STR:
+      return function_definition_for_str_guaranteed_length_interpret(buf, op->data, op->data_size_bytes);
+    case FUNCTION_OPCODE_ARITH:
+      return function_definition_for_arith_guaranteed_length_interpret(buf, op->data, op->data_size_bytes);
+    case FUNCTION_OPCODE_EMPTY:
+      return true;
+    case FUNCTION_OPCODE_CALL:
+      break;
+  }
+  return op->definition->guaranteed_length_interpret(buf, op->data, op->data_size_bytes);
+}
+
+// private. run an op's interpret
+static inline match_status expression_op_interpret(const expression_op* op, subject_buffer_state* buf) {
+  switch (op->opcode) {
+    case FUNCTION_OPCODE_LITERAL:
+      return function_definition_for_literal_interpret(buf, op->data, op->data_size_bytes);
+    case FUNCTION_OPCODE_STR:
+      return function_definition_for_str_interpret(buf, op->data, op->data_size_bytes);
+    case FUNCTION_OPCODE_ARITH:
+      return function_definition_for_arith_interpret(buf, op->data, op->data_size_bytes);
+    case FUNCTION_OPCODE_EMPTY:
+      return MATCH_SUCCESS;
+    case FUNCTION_OPCODE_CALL:
+      break;
+  }
+  return op->definition->interpret(buf, op->data, op->data_size_bytes);
+}
+
+// private. run an op's reverse_interpret
+static inline match_status expression_op_reverse_interpret(const expression_op* op, subject_buffer_state* buf) {
+  switch (op->opcode) {
+    case FUNCTION_OPCODE_LITERAL:
+      return function_definition_for_literal_reverse_interpret(buf, op->data, op->data_size_bytes);
+    case FUNCTION_OPCODE_STR:
+      return function_definition_for_str_reverse_interpret(buf, op->data, op->data_size_bytes);
+    case FUNCTION_OPCODE_ARITH:
+      return function_definition_for_arith_reverse_interpret(buf, op->data, op->data_size_bytes);
+    case FUNCTION_OPCODE_EMPTY:
+      return MATCH_SUCCESS;
+    case FUNCTION_OPCODE_CALL:
+      break;
+  }
+  return op->definition->reverse_interpret(buf, op->data, op->data_size_bytes);
+}
+
+// private. match the elements other than the entrypoint element, around the
+// candidate [entry_begin, entry_end). the match must not begin before lower
+// (a position in the entire input). on success, the match is [*begin,
+// offset).
+//
+// if bounds isn't null, it points to num_elements + 1 positions, and on
+// success gives where each element began, followed by the end of the match
+static match_status expression_match_rest(const expression_pattern* pattern, //
+                                          subject_buffer_state* buf,
+                                          uint64_t lower,
+                                          size_t entry_begin,
+                                          size_t entry_end,
+                                          size_t* begin,
+                                          size_t* bounds) {
+  const expression_op* entry = &pattern->program[pattern->entry];
+  const expression_op* end = pattern->program + pattern->num_elements;
+
+  // in reverse, from the candidate
+  buf->offset = entry_begin;
+  for (const expression_op* op = entry; op != pattern->program;) {
+    if (bounds != NULL) {
+      bounds[op - pattern->program] = buf->offset;
+    }
+    if (expression_op_reverse_interpret(--op, buf) != MATCH_SUCCESS) {
+      // incomplete is the beginning of the input; the lookbehind retains
+      // enough otherwise
+      return MATCH_FAILURE;
+    }
+  }
+  if (buf->stream_offset + buf->offset < lower) {
+    return MATCH_FAILURE; // overlaps the previous match
+  }
+  *begin = buf->offset;
+  if (bounds != NULL) {
+    bounds[0] = buf->offset;
+  }
+
+  buf->offset = entry_end;
+  if (subject_buffer_remaining_size(buf) >= pattern->max_size_characters) {
+    // fast path. every remaining element fits
+    for (const expression_op* op = entry + 1; op != end; ++op) {
+      if (bounds != NULL) {
+        bounds[op - pattern->program] = buf->offset;
+      }
+      if (!expression_op_guaranteed_length_interpret(op, buf)) {
+        return MATCH_FAILURE;
+      }
+    }
+  } else {
+    for (const expression_op* op = entry + 1; op != end; ++op) {
+      if (bounds != NULL) {
+        bounds[op - pattern->program] = buf->offset;
+      }
+      match_status status = expression_op_interpret(op, buf);
+      if (status != MATCH_SUCCESS) {
+        return status;
+      }
+    }
+  }
+  if (bounds != NULL) {
+    bounds[pattern->num_elements] = buf->offset;
+  }
+  return MATCH_SUCCESS;
+}
+
+// private. find the next match at or after the buffer's match offset, which
+// doesn't begin before lower (a position in the entire input). the same as
+// expression_match, but also gives the beginning of the entrypoint element's
+// candidate which matched
+static bool expression_match_search(const expression_pattern* pattern,
+                                    subject_buffer_state* buf,
+                                    bool* input_complete,
+                                    uint64_t lower,
+                                    size_t* begin,
+                                    size_t* entry_begin_output,
+                                    size_t* bounds) {
+  assert(buf->capacity >= expression_pattern_min_capacity(pattern));
+  assert(buf->max_lookbehind >= pattern->max_lookbehind_characters);
+  const expression_op* entry = &pattern->program[pattern->entry];
+  while (1) {
+    size_t entry_begin;
+    match_status status = entry->definition->entrypoint_interpret(buf, entry->data, entry->data_size_bytes, &entry_begin);
+
+    if (status == MATCH_SUCCESS) {
+      size_t entry_end = buf->offset;
+      status = expression_match_rest(pattern, buf, lower, entry_begin, entry_end, begin, bounds);
+      if (likely(status == MATCH_SUCCESS)) {
+        *entry_begin_output = entry_begin;
+        return true;
+      }
+      if (status == MATCH_INCOMPLETE && !*input_complete) {
+        // retain the candidate, and try it again with more content
+        buf->offset = entry_begin;
+      } else if (entry_begin != buf->size) {
+        // the next candidate begins after this one
+        buf->offset = entry_begin + 1;
+        continue;
+      } else {
+        buf->offset = buf->size;
+      }
+    }
+
+    // the offset was moved to the beginning of the incomplete candidate, or
+    // the end of the buffer
+    if (*input_complete) {
+      buf->offset = buf->size;
+      return false;
+    }
+    *input_complete = subject_buffer_shift_and_get_input(buf);
+  }
+}
+
+// find the next match at or after the buffer's match offset.
+//
+// input_complete is the value returned by the previous call to
+// subject_buffer_get_first_input or subject_buffer_shift_and_get_input, and is
+// updated if the buffer is shifted. the buffer's capacity must be at least
+// expression_pattern_min_capacity.
+//
+// returns true if a match was found, in which case the match is [*begin,
+// offset) of the buffer's current segment; the next match can be searched for
+// from there. otherwise, the input has been exhausted
+bool expression_match(const expression_pattern* pattern, subject_buffer_state* buf, bool* input_complete, size_t* begin) {
+  size_t entry_begin;
+  return expression_match_search(pattern, buf, input_complete, buf->stream_offset + buf->offset, begin, &entry_begin, NULL);
+}
+
+// private. a marker's position in the entire input, offset from position.
+// a position before the beginning of the input is 0
+static uint64_t expression_marker_position(uint64_t position, int offset) {
+  if (offset < 0 && (uint64_t)(-(int64_t)offset) > position) {
+    return 0;
+  }
+  return position + (int64_t)offset;
+}
+
+// private. each marker's position in the entire input, from where each element
+// of the match began (see expression_match_rest). markers points to
+// num_markers positions. a marker which appears more than once is given by the
+// last element with it
+static void expression_match_markers(const expression_pattern* pattern, uint64_t stream_offset, const size_t* bounds, uint64_t* markers) {
+  for (size_t i = 0; i < pattern->num_markers; ++i) {
+    markers[i] = EXPRESSION_MARKER_UNSET;
+  }
+  for (size_t i = 0; i < pattern->num_elements; ++i) {
+    const function_setup_info* element = &pattern->elements[i];
+    if (element->begin_marker.present) {
+      markers[element->begin_marker.marker_number] = expression_marker_position(stream_offset + bounds[i], element->begin_marker.offset);
+    }
+    if (element->end_marker.present) {
+      markers[element->end_marker.marker_number] = expression_marker_position(stream_offset + bounds[i + 1], element->end_marker.offset);
+    }
+  }
+}
+
+// gives each match of a pattern in turn, as positions in the entire input.
+// each search continues from where the previous one left off, so finding
+// every match is one pass over the input.
+//
+// with leftmost non-overlapping matches (the same as expression_match), the
+// search continues after the previous match. with overlapping matches, it
+// continues after the previous match's candidate, and gives every match which
+// begins after the previous one
+typedef struct {
+  const expression_pattern* pattern;
+  subject_buffer_state* buf;
+  bool input_complete;
+  bool overlapping;
+  // where the next search begins, and the earliest position the next match
+  // can begin at
+  uint64_t resume;
+  uint64_t lower;
+
+  // if not null, points to the pattern's num_markers positions, which are
+  // given for each match as positions in the entire input (or
+  // EXPRESSION_MARKER_UNSET). only the markers of the pattern's elements are
+  // given, not of their arguments
+  uint64_t* markers;
+  // if set, the buffer is pinned (see subject_buffer_state pin) at the
+  // earliest marker of each match, so its content is retained while searching
+  // for the next match, as far as the buffer's capacity allows
+  bool pin_markers;
+} expression_match_iterator;
+
+// the matches are searched for from the buffer's match offset. input_complete
+// is the value returned by subject_buffer_get_first_input. the buffer's
+// capacity must be at least expression_pattern_min_capacity. markers and
+// pin_markers are unset, and can be set after
+void init_expression_match_iterator(expression_match_iterator* it,
+                                    const expression_pattern* pattern,
+                                    subject_buffer_state* buf,
+                                    bool input_complete,
+                                    bool overlapping) {
+  it->pattern = pattern;
+  it->buf = buf;
+  it->input_complete = input_complete;
+  it->overlapping = overlapping;
+  it->resume = buf->stream_offset + buf->offset;
+  it->lower = it->resume;
+  it->markers = NULL;
+  it->pin_markers = false;
+}
+
+// the next match, which is [*begin, *end) of the entire input. the match's
+// content remains in the buffer until the next call (it's [*begin,
+// *end) minus the buffer's stream_offset). returns false once the input has
+// been exhausted
+bool expression_match_next(expression_match_iterator* it, uint64_t* begin, uint64_t* end) {
+  subject_buffer_state* buf = it->buf;
+  buf->offset = it->resume - buf->stream_offset;
+  size_t bounds[it->markers != NULL ? it->pattern->num_elements + 1 : 1];
+  size_t match_begin;
+  size_t entry_begin;
+  if (!expression_match_search(it->pattern, buf, &it->input_complete, it->lower, &match_begin, &entry_begin, it->markers != NULL ? bounds : NULL)) {
+    it->resume = buf->stream_offset + buf->offset;
+    return false;
+  }
+  *begin = buf->stream_offset + match_begin;
+  *end = buf->stream_offset + buf->offset;
+  if (it->overlapping) {
+    it->resume = buf->stream_offset + (entry_begin != buf->size ? entry_begin + 1 : entry_begin);
+    it->lower = *begin + 1;
+  } else {
+    it->resume = *end;
+    it->lower = *end;
+  }
+
+  if (it->markers != NULL) {
+    expression_match_markers(it->pattern, buf->stream_offset, bounds, it->markers);
+    if (it->pin_markers) {
+      buf->pin = SUBJECT_BUFFER_NO_PIN;
+      for (size_t i = 0; i < it->pattern->num_markers; ++i) {
+        if (it->markers[i] < buf->pin) {
+          buf->pin = it->markers[i];
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// whether there's a match at or after the buffer's match offset. this returns
+// as soon as a match is found, without reading any more input. the arguments
+// are the same as for expression_match
+bool expression_match_exists(const expression_pattern* pattern, subject_buffer_state* buf, bool* input_complete) {
+  size_t begin;
+  return expression_match(pattern, buf, input_complete, &begin);
+}
+
+// the number of matches from the buffer's match offset to the end of the
+// input, the same as calling expression_match until it returns false.
+// input_complete is the value returned by subject_buffer_get_first_input. the
+// buffer's capacity must be at least expression_pattern_min_capacity.
+//
+// if the pattern is only a literal or str (and elements which match nothing,
+// like markers), the occurrences are counted directly rather than matched one
+// by one
+uint64_t expression_match_count(const expression_pattern* pattern, subject_buffer_state* buf, bool input_complete) {
+  assert(buf->capacity >= expression_pattern_min_capacity(pattern));
+  assert(buf->max_lookbehind >= pattern->max_lookbehind_characters);
+  uint64_t ret = 0;
+  size_t needle_len;
+  const CODE_UNIT* needle = expression_pattern_needle(pattern, &needle_len);
+  for (size_t i = 0; i < pattern->num_elements && needle != NULL; ++i) {
+    if (i != pattern->entry && pattern->program[i].opcode != FUNCTION_OPCODE_EMPTY) {
+      needle = NULL;
+    }
+  }
+  if (needle == NULL) {
+    size_t begin;
+    while (expression_match(pattern, buf, &input_complete, &begin)) {
+      ++ret;
+    }
+    return ret;
+  }
+
+  while (1) {
+    const CODE_UNIT* content = subject_buffer_start(buf);
+    if (needle_len == 1) {
+      ret += code_unit_memcount(content + buf->offset, *needle, buf->size - buf->offset);
+      buf->offset = buf->size;
+    } else {
+      const CODE_UNIT* found;
+      while ((found = code_unit_memmem(content + buf->offset, buf->size - buf->offset, needle, needle_len)) != NULL) {
+        ++ret;
+        buf->offset = (found - content) + needle_len;
+      }
+      // an occurrence may begin within what's left, and end in the next segment
+      if (buf->size - buf->offset >= needle_len) {
+        buf->offset = buf->size - (needle_len - 1);
+      }
+    }
+    if (input_complete) {
+      buf->offset = buf->size;
+      return ret;
+    }
+    input_complete = subject_buffer_shift_and_get_input(buf);
+  }
+}
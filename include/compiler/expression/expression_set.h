@@ -0,0 +1,367 @@
+#pragma once
+
+#include <stdint.h>
+#include "compiler/expression/expression_match.h"
+
+// runs many patterns (see expression_match.h) against the same subject buffer
+// in one pass.
+//
+// candidates are found for all patterns at once: each pattern whose
+// entrypoint element is a literal or str (its anchor) has that needle added to
+// an Aho-Corasick automaton, which is run over the subject once. each
+// occurrence of a needle is a candidate for the patterns it belongs to, which
+// is verified with that pattern's own elements, the same as expression_match.
+// the cost of the search doesn't grow with the number of patterns, only the
+// verification of the candidates which are found.
+//
+// a pattern with any other entrypoint element is searched for with its own
+// entrypoint, within the same buffer contents.
+//
+// each pattern gives the same matches as it would on its own with
+// expression_match (leftmost, non-overlapping).
+
+// no node, or no pattern
+#define EXPRESSION_SET_NONE UINT32_MAX
+
+typedef struct {
+  CODE_UNIT unit;        // the transition into this node from its parent
+  uint32_t depth;        // the length of the needle ending at this node
+  uint32_t first_child;
+  uint32_t next_sibling;
+  uint32_t fail;         // the longest proper suffix which is also in the trie
+  uint32_t output;       // the first pattern whose needle ends here
+  uint32_t output_link;  // the nearest node along the fail links with an output
+} expression_set_node;
+
+typedef struct {
+  const expression_pattern* patterns;
+  size_t num_patterns;
+
+  expression_set_node* nodes; // the root is first
+  size_t num_nodes;
+  // for each pattern, the next pattern with the same needle
+  uint32_t* next_output;
+  // the patterns which aren't in the automaton
+  uint32_t* unanchored;
+  size_t num_unanchored;
+  // the transitions from the root, for the code units which fit
+  uint32_t root_next[256];
+
+  size_t max_needle_len;
+  // the lookbehind which the subject buffer must be initialized with
+  size_t max_lookbehind_characters;
+  size_t max_size_characters;
+} expression_set;
+
+// the number of nodes needed by init_expression_set
+size_t expression_set_max_nodes(const expression_pattern* patterns, size_t num_patterns) {
+  size_t ret = 1; // root
+  for (size_t i = 0; i < num_patterns; ++i) {
+    size_t len;
+    if (expression_pattern_needle(&patterns[i], &len) != NULL) {
+      ret += len;
+    }
+  }
+  return ret;
+}
+
+// private. the child of a node along unit, or EXPRESSION_SET_NONE
+static uint32_t expression_set_child(const expression_set_node* nodes, uint32_t node, CODE_UNIT unit) {
+  for (uint32_t child = nodes[node].first_child; child != EXPRESSION_SET_NONE; child = nodes[child].next_sibling) {
+    if (nodes[child].unit == unit) {
+      return child;
+    }
+  }
+  return EXPRESSION_SET_NONE;
+}
+
+// private. a code unit as an index into root_next, or 256 if it doesn't fit
+static size_t expression_set_root_index(CODE_UNIT unit) {
+#ifdef USE_WCHAR
+  return (uint32_t)unit < 256 ? (size_t)(uint32_t)unit : 256;
+#else
+  return (unsigned char)unit;
+#endif
+}
+
+// patterns points to num_patterns patterns (init_expression_pattern), which
+// must remain for as long as the set is used. nodes points to
+// expression_set_max_nodes nodes. next_output and unanchored each point to
+// num_patterns elements
+void init_expression_set(expression_set* set,
+                         const expression_pattern* patterns,
+                         size_t num_patterns,
+                         expression_set_node* nodes,
+                         uint32_t* next_output,
+                         uint32_t* unanchored) {
+  assert(expression_set_max_nodes(patterns, num_patterns) < EXPRESSION_SET_NONE);
+  set->patterns = patterns;
+  set->num_patterns = num_patterns;
+  set->nodes = nodes;
+  set->next_output = next_output;
+  set->unanchored = unanchored;
+  set->num_unanchored = 0;
+  set->max_needle_len = 0;
+  set->max_lookbehind_characters = 0;
+  set->max_size_characters = 0;
+
+  nodes[0].unit = 0;
+  nodes[0].depth = 0;
+  nodes[0].first_child = EXPRESSION_SET_NONE;
+  nodes[0].next_sibling = EXPRESSION_SET_NONE;
+  nodes[0].fail = 0;
+  nodes[0].output = EXPRESSION_SET_NONE;
+  nodes[0].output_link = EXPRESSION_SET_NONE;
+  size_t num_nodes = 1;
+
+  // the trie of needles
+  for (size_t i = 0; i < num_patterns; ++i) {
+    const expression_pattern* pattern = &patterns[i];
+    if (pattern->max_lookbehind_characters > set->max_lookbehind_characters) {
+      set->max_lookbehind_characters = pattern->max_lookbehind_characters;
+    }
+    if (pattern->max_size_characters > set->max_size_characters) {
+      set->max_size_characters = pattern->max_size_characters;
+    }
+    next_output[i] = EXPRESSION_SET_NONE;
+    size_t len;
+    const CODE_UNIT* needle = expression_pattern_needle(pattern, &len);
+    if (needle == NULL) {
+      unanchored[set->num_unanchored++] = i;
+      continue;
+    }
+    if (len > set->max_needle_len) {
+      set->max_needle_len = len;
+    }
+
+    uint32_t node = 0;
+    for (size_t j = 0; j < len; ++j) {
+      uint32_t child = expression_set_child(nodes, node, needle[j]);
+      if (child == EXPRESSION_SET_NONE) {
+        child = num_nodes++;
+        nodes[child].unit = needle[j];
+        nodes[child].depth = j + 1;
+        nodes[child].first_child = EXPRESSION_SET_NONE;
+        nodes[child].next_sibling = nodes[node].first_child;
+        nodes[child].fail = 0;
+        nodes[child].output = EXPRESSION_SET_NONE;
+        nodes[child].output_link = EXPRESSION_SET_NONE;
+        nodes[node].first_child = child;
+      }
+      node = child;
+    }
+    // appended, so patterns with the same needle are verified in order
+    uint32_t* tail = &nodes[node].output;
+    while (*tail != EXPRESSION_SET_NONE) {
+      tail = &next_output[*tail];
+    }
+    *tail = i;
+  }
+  set->num_nodes = num_nodes;
+
+  // the fail links, breadth first so that a node's fail is done before it's
+  // needed by the node's children
+  uint32_t queue[num_nodes];
+  size_t queue_begin = 0;
+  size_t queue_end = 0;
+  for (uint32_t child = nodes[0].first_child; child != EXPRESSION_SET_NONE; child = nodes[child].next_sibling) {
+    queue[queue_end++] = child;
+  }
+  while (queue_begin != queue_end) {
+    uint32_t node = queue[queue_begin++];
+    for (uint32_t child = nodes[node].first_child; child != EXPRESSION_SET_NONE; child = nodes[child].next_sibling) {
+      uint32_t fail = nodes[node].fail;
+      uint32_t next;
+      while ((next = expression_set_child(nodes, fail, nodes[child].unit)) == EXPRESSION_SET_NONE && fail != 0) {
+        fail = nodes[fail].fail;
+      }
+      nodes[child].fail = next == EXPRESSION_SET_NONE ? 0 : next;
+      queue[queue_end++] = child;
+    }
+    uint32_t fail = nodes[node].fail;
+    nodes[node].output_link = nodes[fail].output != EXPRESSION_SET_NONE ? fail : nodes[fail].output_link;
+  }
+
+  for (size_t i = 0; i < 256; ++i) {
+    set->root_next[i] = 0;
+  }
+  for (uint32_t child = nodes[0].first_child; child != EXPRESSION_SET_NONE; child = nodes[child].next_sibling) {
+    size_t index = expression_set_root_index(nodes[child].unit);
+    if (index != 256) {
+      set->root_next[index] = child;
+    }
+  }
+
+  // a candidate found by the automaton may have begun before the segment, by
+  // up to the length of the longest needle
+  set->max_lookbehind_characters += set->max_needle_len;
+}
+
+// the capacity required of a subject buffer to match the set: a candidate of
+// any pattern and its lookbehind must fit, with at least one character to
+// shift
+size_t expression_set_min_capacity(const expression_set* set) {
+  return set->max_size_characters + set->max_lookbehind_characters + set->max_needle_len + 1;
+}
+
+// private. the automaton's state after unit
+static inline uint32_t expression_set_next(const expression_set* set, uint32_t node, CODE_UNIT unit) {
+  while (node != 0) {
+    uint32_t child = expression_set_child(set->nodes, node, unit);
+    if (child != EXPRESSION_SET_NONE) {
+      return child;
+    }
+    node = set->nodes[node].fail;
+  }
+  size_t index = expression_set_root_index(unit);
+  if (likely(index != 256)) {
+    return set->root_next[index];
+  }
+  uint32_t child = expression_set_child(set->nodes, 0, unit);
+  return child == EXPRESSION_SET_NONE ? 0 : child;
+}
+
+// called for each match. the match is [begin, offset) of the buffer's current
+// segment, for the pattern at index pattern in the set. the buffer must not be
+// modified
+typedef void (*expression_set_callback)(void* ctx, size_t pattern, const subject_buffer_state* buf, size_t begin);
+
+// private. search for a pattern which isn't in the automaton, from *cursor (a
+// position in the entire input) to the end of the segment. *cursor is left at
+// the beginning of a candidate which needs more input, or the end of the
+// segment
+static size_t expression_set_match_unanchored(const expression_set* set,
+                                              size_t index,
+                                              subject_buffer_state* buf,
+                                              bool input_complete,
+                                              uint64_t* lower,
+                                              uint64_t* cursor,
+                                              expression_set_callback callback,
+                                              void* ctx) {
+  const expression_pattern* pattern = &set->patterns[index];
+  const expression_op* entry = &pattern->program[pattern->entry];
+  size_t ret = 0;
+  buf->offset = *cursor - buf->stream_offset;
+  while (1) {
+    size_t entry_begin;
+    match_status status = entry->definition->entrypoint_interpret(buf, entry->data, entry->data_size_bytes, &entry_begin);
+    if (status == MATCH_INCOMPLETE) {
+      break; // the offset is at the beginning of the incomplete candidate
+    }
+    if (status == MATCH_FAILURE) {
+      buf->offset = buf->size;
+      break;
+    }
+    size_t entry_end = buf->offset;
+    size_t begin;
+    status = expression_match_rest(pattern, buf, *lower, entry_begin, entry_end, &begin, NULL);
+    if (status == MATCH_SUCCESS) {
+      callback(ctx, index, buf, begin);
+      ++ret;
+      *lower = buf->stream_offset + buf->offset;
+      continue;
+    }
+    if (status == MATCH_INCOMPLETE && !input_complete) {
+      buf->offset = entry_begin;
+      break;
+    }
+    if (entry_begin == buf->size) {
+      buf->offset = buf->size;
+      break;
+    }
+    buf->offset = entry_begin + 1;
+  }
+  *cursor = buf->stream_offset + buf->offset;
+  return ret;
+}
+
+// find every match of every pattern in the set, from the buffer's match
+// offset to the end of the input, calling callback for each one.
+//
+// input_complete is the value returned by subject_buffer_get_first_input. the
+// buffer's capacity must be at least expression_set_min_capacity, and its
+// lookbehind at least the set's max_lookbehind_characters.
+//
+// the matches of each pattern are given in order. the matches of different
+// patterns are given roughly in order, but not strictly. returns the number of
+// matches
+size_t expression_set_match(const expression_set* set,
+                            subject_buffer_state* buf,
+                            bool input_complete,
+                            expression_set_callback callback,
+                            void* ctx) {
+  assert(buf->capacity >= expression_set_min_capacity(set));
+  assert(buf->max_lookbehind >= set->max_lookbehind_characters);
+  const expression_set_node* nodes = set->nodes;
+  size_t ret = 0;
+
+  // per pattern, positions in the entire input. each match begins at or after
+  // lower (the end of the pattern's previous match). an unanchored pattern
+  // continues its search from cursor
+  uint64_t start = buf->stream_offset + buf->offset;
+  uint64_t lower[set->num_patterns];
+  uint64_t cursor[set->num_patterns];
+  for (size_t i = 0; i < set->num_patterns; ++i) {
+    lower[i] = start;
+    cursor[i] = start;
+  }
+
+  // the automaton's state, after the content before scan
+  uint32_t state = 0;
+  uint64_t scan = start;
+  while (1) {
+    const CODE_UNIT* content = subject_buffer_start(buf);
+    size_t pos = scan - buf->stream_offset;
+    if (set->num_nodes == 1) {
+      pos = buf->size; // every pattern is unanchored
+    }
+    // the earliest position which is needed after the shift
+    uint64_t keep;
+    bool stopped = false;
+    while (pos < buf->size && !stopped) {
+      state = expression_set_next(set, state, content[pos++]);
+      uint32_t node = nodes[state].output != EXPRESSION_SET_NONE ? state : nodes[state].output_link;
+      for (; node != EXPRESSION_SET_NONE && !stopped; node = nodes[node].output_link) {
+        for (uint32_t i = nodes[node].output; i != EXPRESSION_SET_NONE; i = set->next_output[i]) {
+          size_t begin;
+          match_status status = expression_match_rest(&set->patterns[i], buf, lower[i], pos - nodes[node].depth, pos, &begin, NULL);
+          if (status == MATCH_SUCCESS) {
+            callback(ctx, i, buf, begin);
+            ++ret;
+            lower[i] = buf->stream_offset + buf->offset;
+          } else if (status == MATCH_INCOMPLETE && !input_complete) {
+            // try this candidate again with more content. the search is
+            // restarted early enough to find every needle which ends here or
+            // after. any candidate found again which has already been verified
+            // gives the same result, or overlaps the match it gave
+            stopped = true;
+            break;
+          }
+        }
+      }
+    }
+    if (stopped) {
+      size_t restart = pos < set->max_needle_len ? 0 : pos - set->max_needle_len;
+      state = 0;
+      scan = buf->stream_offset + restart;
+    } else {
+      scan = buf->stream_offset + pos;
+    }
+    keep = scan;
+
+    for (size_t j = 0; j < set->num_unanchored; ++j) {
+      size_t i = set->unanchored[j];
+      ret += expression_set_match_unanchored(set, i, buf, input_complete, &lower[i], &cursor[i], callback, ctx);
+      if (cursor[i] < keep) {
+        keep = cursor[i];
+      }
+    }
+
+    if (input_complete) {
+      buf->offset = buf->size;
+      return ret;
+    }
+    buf->offset = keep - buf->stream_offset;
+    input_complete = subject_buffer_shift_and_get_input(buf);
+  }
+}
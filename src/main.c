@@ -1,6 +1,342 @@
-#include <assert.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <wchar.h>
+
+#include "compiler/expression/expression_file.h"
+#include "compiler/expression/expression_match.h"
+#include "compiler/expression/expression_interpret_standardlib/standardlib.h"
+#include "standardlib_registry.h" // generated by registry_gen (see makefile)
+
+// usage: regex [-n | -q] PATTERN [FILE]
+//        regex -c OUTPUT PATTERN
+//        regex [-n | -q] -p PATTERN_FILE [FILE]
+//
+// prints each match in FILE (or stdin), each on its own line. exits with 0 if
+// there was a match, 1 if there wasn't, or 2 on error (same as grep).
+//
+// with -n, only the number of matches is printed. with -q, nothing is
+// printed, and the input is read only until the first match.
+//
+// with -c, the pattern is compiled and saved to OUTPUT instead (see
+// expression_file.h). with -p, a pattern saved that way is used, which skips
+// compiling it
+
+// the subject buffer's capacity, unless the pattern requires more
+#define MIN_CAPACITY 65536
+
+// write code units to a byte stream. wide characters are encoded per the locale
+static void print_code_units(FILE* f, const CODE_UNIT* begin, size_t len) {
+#ifdef USE_WCHAR
+  mbstate_t state;
+  memset(&state, 0, sizeof(state));
+  char bytes[MB_LEN_MAX];
+  for (size_t i = 0; i < len; ++i) {
+    size_t num_bytes = wcrtomb(bytes, begin[i], &state);
+    if (num_bytes != (size_t)-1) {
+      fwrite(bytes, 1, num_bytes, f);
+    }
+  }
+#else
+  fwrite(begin, sizeof(CODE_UNIT), len, f);
+#endif
+}
+
+static void print_error(const CODE_UNIT* msg, size_t offset) {
+  fputs("regex: ", stderr);
+  print_code_units(stderr, msg, code_unit_strlen(msg));
+  fprintf(stderr, " (at offset %zu)\n", offset);
+}
+
+// the registered functions, sorted, and a registry of them
+static function_definition definitions[STANDARDLIB_NUM_FUNCTIONS];
+static const size_t num_functions = sizeof(definitions) / sizeof(*definitions);
+static function_registry registry;
+
+static void init_definitions() {
+  init_standardlib_definitions(definitions);
+  // generated for the same order
+  registry.functions = definitions;
+  registry.num_function = num_functions;
+  registry.seeds = standardlib_registry_seeds;
+  registry.slots = standardlib_registry_slots;
+#ifndef NDEBUG
+  for (size_t i = 0; i < num_functions; ++i) {
+    assert(function_registry_lookup(&registry, definitions[i].name) == &definitions[i]);
+  }
+#endif
+}
+
+// what's reported about the matches
+typedef enum {
+  REPORT_MATCHES, // each match
+  REPORT_COUNT,   // the number of matches (-n)
+  REPORT_EXISTS,  // nothing; only the exit status (-q)
+} report_mode;
+
+// report the matches in fd. returns the exit status
+static int report_matches(const expression_pattern* pattern, int fd, report_mode mode) {
+  size_t capacity = expression_pattern_min_capacity(pattern);
+  if (capacity < MIN_CAPACITY) {
+    capacity = MIN_CAPACITY;
+  }
+  char byte_buffer[capacity];
+  subject_buffer_state buf;
+#ifdef USE_WCHAR
+  wchar_t character_buffer[capacity];
+  init_subject_buffer_fd(&buf, fd, capacity, byte_buffer, character_buffer, pattern->max_lookbehind_characters);
+#else
+  init_subject_buffer_fd(&buf, fd, capacity, byte_buffer, pattern->max_lookbehind_characters);
+#endif
+
+  int ret = 1;
+  bool input_complete = subject_buffer_get_first_input(&buf);
+  if (mode == REPORT_EXISTS) {
+    ret = expression_match_exists(pattern, &buf, &input_complete) ? 0 : 1;
+  } else if (mode == REPORT_COUNT) {
+    uint64_t count = expression_match_count(pattern, &buf, input_complete);
+    ret = count != 0 ? 0 : 1;
+    printf("%llu\n", (unsigned long long)count);
+  } else {
+    size_t begin;
+    while (expression_match(pattern, &buf, &input_complete, &begin)) {
+      ret = 0;
+      print_code_units(stdout, subject_buffer_start(&buf) + begin, buf.offset - begin);
+      putchar('\n');
+    }
+  }
+  deinit_subject_buffer(&buf);
+  if (fflush(stdout) != 0) {
+    perror("regex: stdout");
+    return 2;
+  }
+  return ret;
+}
+
+// save the compiled pattern to path. returns the exit status
+static int save_pattern(const char* path,
+                        const function_setup_info* elements,
+                        size_t num_elements,
+                        const void* data,
+                        const interpret_setup_result* setup_result) {
+  size_t file_size = expression_file_size(elements, num_elements);
+  char file[file_size];
+  expression_file_write(file, elements, num_elements, data, setup_result);
+  FILE* f = fopen(path, "wb");
+  if (f == NULL) {
+    perror(path);
+    return 2;
+  }
+  bool ok = fwrite(file, 1, file_size, f) == file_size;
+  ok = fclose(f) == 0 && ok;
+  if (!ok) {
+    perror(path);
+    return 2;
+  }
+  return 0;
+}
+
+// compile the pattern, then report the matches in fd, or save it to
+// save_path if that isn't null. returns the exit status
+static int run(const CODE_UNIT* program, size_t program_len, int fd, report_mode mode, const char* save_path) {
+  expr_tokenize_arg arg = expr_tokenize_arg_init(program, program + program_len);
+  expr_tokenize_result tokenize_result = tokenize_expression(&arg);
+  if (tokenize_result.reason != NULL) {
+    fprintf(stderr, "regex: %s (at offset %zu)\n", tokenize_result.reason, tokenize_result.offset);
+    return 2;
+  }
+  size_t num_literal_tokens = expr_tokenize_arg_get_cap(&arg);
+  expr_token literal_tokens[num_literal_tokens];
+  expr_tokenize_arg_set_to_fill(&arg, literal_tokens);
+  tokenize_expression(&arg);
+
+  // runs of literals are matched as strings
+  size_t num_tokens = expr_coalesce_literals(literal_tokens, literal_tokens + num_literal_tokens, function_definition_for_str()->name, NULL);
+  expr_token tokens[num_tokens];
+  expr_coalesce_literals(literal_tokens, literal_tokens + num_literal_tokens, function_definition_for_str()->name, tokens);
+
+  size_t num_function_calls = interpret_presetup_get_number_of_function_calls(tokens, tokens + num_tokens);
+  function_setup_info presetup_info[num_function_calls];
+  interpret_presetup_arg presetup_arg;
+  presetup_arg.begin = tokens;
+  presetup_arg.end = tokens + num_tokens;
+  presetup_arg.num_function = num_functions;
+  presetup_arg.functions = definitions;
+  presetup_arg.registry = &registry;
+  presetup_arg.presetup_info_output = presetup_info;
+  presetup_arg.error_msg_output = NULL;
+  interpret_presetup_arg presetup_arg_copy = presetup_arg;
+  interpret_presetup_result presetup_result = interpret_presetup(&presetup_arg);
+  if (!presetup_result.success) {
+    CODE_UNIT msg[presetup_result.value.err.size];
+    presetup_arg_copy.error_msg_output = msg;
+    interpret_presetup(&presetup_arg_copy);
+    print_error(msg, presetup_result.value.err.offset);
+    return 2;
+  }
+
+  char data[presetup_result.value.data_size_bytes] __attribute__((aligned(FUNCTION_DATA_CACHE_LINE)));
+  interpret_setup_arg setup_arg;
+  setup_arg.begin = tokens;
+  setup_arg.end = tokens + num_tokens;
+  setup_arg.presetup_info = presetup_info;
+  setup_arg.data = data;
+  setup_arg.error_msg_output = NULL;
+  interpret_setup_arg setup_arg_copy = setup_arg;
+  interpret_setup_result setup_result = interpret_setup(&setup_arg);
+  if (!setup_result.success) {
+    CODE_UNIT msg[setup_result.value.err.size];
+    setup_arg_copy.error_msg_output = msg;
+    interpret_setup(&setup_arg_copy);
+    print_error(msg, setup_result.value.err.offset);
+    return 2;
+  }
+
+  size_t num_elements = presetup_arg.presetup_info_output - presetup_info;
+  if (save_path != NULL) {
+    return save_pattern(save_path, presetup_info, num_elements, data, &setup_result);
+  }
+
+  expression_pattern pattern;
+  expression_op ops[num_elements];
+  if (!init_expression_pattern(&pattern, presetup_info, num_elements, data, &setup_result, ops)) {
+    fputs("regex: the pattern doesn't match any content\n", stderr);
+    return 2;
+  }
+  return report_matches(&pattern, fd, mode);
+}
+
+// report the matches in fd, of the pattern saved at path. returns the exit
+// status
+static int run_saved(const char* path, int fd, report_mode mode) {
+  int pattern_fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (pattern_fd == -1) {
+    perror(path);
+    return 2;
+  }
+  struct stat st;
+  if (fstat(pattern_fd, &st) == -1) {
+    perror(path);
+    close(pattern_fd);
+    return 2;
+  }
+  size_t file_size = st.st_size;
+  void* file = file_size == 0 ? MAP_FAILED : mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, pattern_fd, 0);
+  close(pattern_fd);
+  if (file == MAP_FAILED) {
+    if (file_size == 0) {
+      fprintf(stderr, "regex: %s: not a pattern file\n", path);
+    } else {
+      perror(path);
+    }
+    return 2;
+  }
+
+  int ret = 2;
+  expression_file_read_result result = expression_file_read(file, file_size, num_functions, definitions, NULL);
+  if (result.reason == NULL) {
+    function_setup_info elements[result.num_elements];
+    result = expression_file_read(file, file_size, num_functions, definitions, elements);
+    if (result.reason == NULL) {
+      expression_pattern pattern;
+      expression_op ops[result.num_elements];
+      if (!init_expression_pattern(&pattern, elements, result.num_elements, result.data, &result.setup_result, ops)) {
+        fputs("regex: the pattern doesn't match any content\n", stderr);
+      } else {
+        ret = report_matches(&pattern, fd, mode);
+      }
+    }
+  }
+  if (result.reason != NULL) {
+    fprintf(stderr, "regex: %s: %s\n", path, result.reason);
+  }
+  munmap(file, file_size);
+  return ret;
+}
+
+static void print_usage() {
+  fputs("usage: regex [-n | -q] PATTERN [FILE]\n"
+        "       regex -c OUTPUT PATTERN\n"
+        "       regex [-n | -q] -p PATTERN_FILE [FILE]\n",
+        stderr);
+}
 
 int main(int argc, char** argv) {
-    assert(0);
-    return 0;
-}
\ No newline at end of file
+  setlocale(LC_ALL, "");
+  init_definitions();
+
+  const char* save_path = NULL;
+  const char* saved_path = NULL;
+  const char* pattern = NULL;
+  const char* input_path = NULL;
+  report_mode mode = REPORT_MATCHES;
+  if (argc >= 2 && (strcmp(argv[1], "-n") == 0 || strcmp(argv[1], "-q") == 0)) {
+    mode = argv[1][1] == 'n' ? REPORT_COUNT : REPORT_EXISTS;
+    // the rest is parsed as if the option wasn't given
+    argv[1] = argv[0];
+    ++argv;
+    --argc;
+    if (argc >= 2 && strcmp(argv[1], "-c") == 0) {
+      print_usage();
+      return 2;
+    }
+  }
+  if (argc >= 2 && strcmp(argv[1], "-c") == 0) {
+    if (argc != 4) {
+      print_usage();
+      return 2;
+    }
+    save_path = argv[2];
+    pattern = argv[3];
+  } else if (argc >= 2 && strcmp(argv[1], "-p") == 0) {
+    if (argc != 3 && argc != 4) {
+      print_usage();
+      return 2;
+    }
+    saved_path = argv[2];
+    input_path = argc == 4 ? argv[3] : NULL;
+  } else {
+    if (argc != 2 && argc != 3) {
+      print_usage();
+      return 2;
+    }
+    pattern = argv[1];
+    input_path = argc == 3 ? argv[2] : NULL;
+  }
+
+  int fd = STDIN_FILENO;
+  if (input_path != NULL) {
+    fd = open(input_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      perror(input_path);
+      return 2;
+    }
+  }
+
+  int ret;
+  if (saved_path != NULL) {
+    ret = run_saved(saved_path, fd, mode);
+  } else {
+#ifdef USE_WCHAR
+    size_t program_len = mbstowcs(NULL, pattern, 0);
+    if (program_len == (size_t)-1) {
+      fputs("regex: the pattern isn't valid in the current locale\n", stderr);
+      ret = 2;
+    } else {
+      wchar_t program[program_len + 1];
+      mbstowcs(program, pattern, program_len + 1);
+      ret = run(program, program_len, fd, mode, save_path);
+    }
+#else
+    ret = run(pattern, strlen(pattern), fd, mode, save_path);
+#endif
+  }
+
+  if (fd != STDIN_FILENO) {
+    close(fd);
+  }
+  return ret;
+}
@@ -0,0 +1,38 @@
+#include <stdio.h>
+
+#include "compiler/expression/expression_interpret_standardlib/standardlib.h"
+
+// usage: registry_gen
+//
+// writes a header to stdout which has the seeds and slots of a function
+// registry (see init_function_registry) over the standard library, in the
+// order given by init_standardlib_definitions. the makefile generates
+// build/standardlib_registry.h with it, so the registry isn't built at runtime
+
+static void print_array(const char* name, const uint32_t* values, size_t num_values) {
+  printf("static const uint32_t %s[%zu] = {", name, num_values);
+  for (size_t i = 0; i < num_values; ++i) {
+    printf(i == 0 ? "%u" : ", %u", (unsigned)values[i]);
+  }
+  printf("};\n");
+}
+
+int main() {
+  function_definition definitions[STANDARDLIB_NUM_FUNCTIONS];
+  init_standardlib_definitions(definitions);
+  uint32_t seeds[STANDARDLIB_NUM_FUNCTIONS];
+  uint32_t slots[STANDARDLIB_NUM_FUNCTIONS];
+  size_t work[FUNCTION_REGISTRY_WORK_SIZE(STANDARDLIB_NUM_FUNCTIONS)];
+  function_registry registry;
+  if (!init_function_registry(&registry, definitions, STANDARDLIB_NUM_FUNCTIONS, seeds, slots, work)) {
+    fputs("registry_gen: two functions have the same name\n", stderr);
+    return 1;
+  }
+
+  printf("// generated by registry_gen. don't edit\n");
+  printf("#pragma once\n");
+  printf("#include <stdint.h>\n\n");
+  print_array("standardlib_registry_seeds", seeds, STANDARDLIB_NUM_FUNCTIONS);
+  print_array("standardlib_registry_slots", slots, STANDARDLIB_NUM_FUNCTIONS);
+  return 0;
+}
@@ -3,7 +3,8 @@
 #include "test_common.h"
 extern int has_errors;
 
-int main(void) {
+// the tests, for the currently bound kernels
+static void test_kernels(void) {
   { // empty both
     const CODE_UNIT* haystack = CODE_UNIT_LITERAL("");
     size_t haystack_len = code_unit_strlen(haystack);
@@ -58,6 +59,40 @@ int main(void) {
     size_t needle_len = code_unit_strlen(needle);
     assert_continue(code_unit_memmem(haystack, haystack_len, needle, needle_len) == haystack);
   }
+  { // compared against a naive search, with a small alphabet for many partial matches
+    CODE_UNIT haystack[200];
+    CODE_UNIT needle[20];
+    unsigned int state = 1;
+    for (size_t trial = 0; trial < 2000; ++trial) {
+      size_t haystack_len = trial % 200;
+      size_t needle_len = 1 + trial % 19;
+      for (size_t i = 0; i < haystack_len; ++i) {
+        state = state * 1103515245 + 12345;
+        haystack[i] = 'a' + (state >> 16) % 2;
+      }
+      for (size_t i = 0; i < needle_len; ++i) {
+        state = state * 1103515245 + 12345;
+        needle[i] = 'a' + (state >> 16) % 2;
+      }
+      const CODE_UNIT* expected = NULL;
+      for (size_t i = 0; expected == NULL && i + needle_len <= haystack_len; ++i) {
+        if (code_unit_memcmp(haystack + i, needle, needle_len) == 0) {
+          expected = haystack + i;
+        }
+      }
+      assert_continue(code_unit_memmem(haystack, haystack_len, needle, needle_len) == expected);
+    }
+  }
+  { // long needle against repetitive text
+    CODE_UNIT haystack[5000];
+    CODE_UNIT needle[1000];
+    for (size_t i = 0; i < 5000; ++i) haystack[i] = 'a';
+    for (size_t i = 0; i < 1000; ++i) needle[i] = 'a';
+    needle[500] = 'b';
+    assert_continue(code_unit_memmem(haystack, 5000, needle, 1000) == NULL);
+    haystack[4000] = 'b';
+    assert_continue(code_unit_memmem(haystack, 5000, needle, 1000) == haystack + 3500);
+  }
 
   // ====================================
 
@@ -115,5 +150,125 @@ int main(void) {
     size_t needle_len = code_unit_strlen(needle);
     assert_continue(code_unit_incomplete_suffix(haystack, haystack_len, needle, needle_len) == haystack + 3);
   }
+  { // failure table
+    const CODE_UNIT* needle = CODE_UNIT_LITERAL("abacabab");
+    size_t failure[8];
+    code_unit_failure_table(needle, 8, failure);
+    size_t expected[8] = {0, 0, 1, 0, 1, 2, 3, 2};
+    assert_continue(0 == memcmp(failure, expected, sizeof(expected)));
+  }
+  { // entire haystack is an incomplete needle
+    const CODE_UNIT* haystack = CODE_UNIT_LITERAL("ab");
+    const CODE_UNIT* needle = CODE_UNIT_LITERAL("abc");
+    size_t failure[3];
+    code_unit_failure_table(needle, 3, failure);
+    assert_continue(code_unit_incomplete_suffix_kmp(haystack, 2, needle, 3, failure) == haystack);
+  }
+  { // with failure table, compared against a naive search
+    CODE_UNIT haystack[30];
+    CODE_UNIT needle[12];
+    size_t failure[12];
+    unsigned int state = 7;
+    for (size_t trial = 0; trial < 2000; ++trial) {
+      size_t haystack_len = trial % 30;
+      size_t needle_len = trial % 12;
+      for (size_t i = 0; i < haystack_len; ++i) {
+        state = state * 1103515245 + 12345;
+        haystack[i] = 'a' + (state >> 16) % 2;
+      }
+      for (size_t i = 0; i < needle_len; ++i) {
+        state = state * 1103515245 + 12345;
+        needle[i] = 'a' + (state >> 16) % 2;
+      }
+      const CODE_UNIT* expected = NULL;
+      for (size_t len = needle_len - 1; needle_len != 0 && len != 0 && expected == NULL; --len) {
+        if (len <= haystack_len && 0 == code_unit_memcmp(haystack + haystack_len - len, needle, len)) {
+          expected = haystack + haystack_len - len;
+        }
+      }
+      code_unit_failure_table(needle, needle_len, failure);
+      assert_continue(code_unit_incomplete_suffix_kmp(haystack, haystack_len, needle, needle_len, failure) == expected);
+    }
+  }
+  { // memchr2, memchr3
+    const CODE_UNIT* haystack = CODE_UNIT_LITERAL("the quick brown fox jumps over the lazy dog, again and again");
+    size_t haystack_len = code_unit_strlen(haystack);
+    assert_continue(code_unit_memchr2(haystack, 'z', 'x', haystack_len) == haystack + 18);
+    assert_continue(code_unit_memchr2(haystack, '!', '?', haystack_len) == NULL);
+    assert_continue(code_unit_memchr3(haystack, 'z', 'y', 'j', haystack_len) == haystack + 20);
+    assert_continue(code_unit_memchr3(haystack, 'z', 'y', 'j', 20) == NULL);
+    assert_continue(code_unit_memchr3(haystack, '!', '?', 'n', haystack_len) == haystack + 14);
+    assert_continue(code_unit_memchr2(haystack, 'n', 'n', 0) == NULL);
+  }
+  { // memcount, at every length and alignment
+    CODE_UNIT haystack[200];
+    for (size_t i = 0; i < 200; ++i) {
+      haystack[i] = i % 3 == 0 || i % 7 == 0 ? 'a' : 'b';
+    }
+    for (size_t begin = 0; begin < 8; ++begin) {
+      size_t expected = 0;
+      for (size_t len = 0; begin + len <= 200; ++len) {
+        assert_continue(code_unit_memcount(haystack + begin, 'a', len) == expected);
+        if (begin + len < 200 && haystack[begin + len] == 'a') ++expected;
+      }
+    }
+    assert_continue(code_unit_memcount(haystack, 'z', 200) == 0);
+  }
+  { // sets, compared against a naive search. every byte value, including
+    // ones which share nibbles, in sets of every size
+    CODE_UNIT haystack[200];
+    CODE_UNIT units[CODE_UNIT_SET_CAPACITY];
+    unsigned int state = 11;
+    for (size_t trial = 0; trial < 2000; ++trial) {
+      size_t num_units = trial % (CODE_UNIT_SET_CAPACITY + 1);
+      for (size_t i = 0; i < num_units; ++i) {
+        state = state * 1103515245 + 12345;
+        units[i] = (CODE_UNIT)((state >> 16) & 0xFF);
+      }
+      code_unit_set set;
+      code_unit_set_init(&set, units, num_units);
+      size_t haystack_len = (trial * 7) % 200;
+      for (size_t i = 0; i < haystack_len; ++i) {
+        state = state * 1103515245 + 12345;
+        haystack[i] = (CODE_UNIT)((state >> 16) & 0xFF);
+      }
+      const CODE_UNIT* expected = NULL;
+      for (size_t i = 0; i < haystack_len && expected == NULL; ++i) {
+        for (size_t j = 0; j < num_units; ++j) {
+          if (haystack[i] == units[j]) {
+            expected = haystack + i;
+            break;
+          }
+        }
+      }
+      assert_continue(code_unit_memchr_set(haystack, &set, haystack_len) == expected);
+      if (num_units >= 3) {
+        // the first units of the set
+        set.num_units = 3;
+        assert_continue(code_unit_memchr3(haystack, units[0], units[1], units[2], haystack_len) == code_unit_memchr_units_scalar(haystack, &set, haystack_len));
+        set.num_units = 2;
+        assert_continue(code_unit_memchr2(haystack, units[0], units[1], haystack_len) == code_unit_memchr_units_scalar(haystack, &set, haystack_len));
+      }
+    }
+  }
+}
+
+int main(void) {
+  // every variant which the cpu supports
+  for (int limit = CODE_UNIT_ISA_SCALAR; limit <= CODE_UNIT_ISA_AVX512BW; ++limit) {
+    code_unit_isa isa = code_unit_dispatch((code_unit_isa)limit);
+    assert_continue(isa <= (code_unit_isa)limit);
+    assert_continue(code_unit_kernels.isa == isa);
+    test_kernels();
+  }
+  { // override from the environment
+    setenv("CODE_UNIT_ISA", "scalar", 1);
+    assert_continue(code_unit_isa_from_env() == CODE_UNIT_ISA_SCALAR);
+    assert_continue(code_unit_dispatch(code_unit_isa_from_env()) == CODE_UNIT_ISA_SCALAR);
+    setenv("CODE_UNIT_ISA", "avx2", 1);
+    assert_continue(code_unit_isa_from_env() == CODE_UNIT_ISA_AVX2);
+    unsetenv("CODE_UNIT_ISA");
+    assert_continue(code_unit_isa_from_env() == CODE_UNIT_ISA_AVX512BW);
+  }
   return has_errors;
-}
\ No newline at end of file
+}
@@ -0,0 +1,105 @@
+#include "character/code_unit_rare.h"
+
+#include "test_common.h"
+extern int has_errors;
+
+// the first occurrence, brute force
+static const CODE_UNIT* naive_memmem(const CODE_UNIT* haystack, size_t haystack_len, const CODE_UNIT* needle, size_t needle_len) {
+  for (size_t i = 0; i + needle_len <= haystack_len; ++i) {
+    size_t j = 0;
+    while (j < needle_len && haystack[i + j] == needle[j]) ++j;
+    if (j == needle_len) return haystack + i;
+  }
+  return NULL;
+}
+
+int main() {
+  { // rare units of the built in table
+    const CODE_UNIT* needle = CODE_UNIT_LITERAL("the qzx");
+    size_t rare1, rare2;
+    code_unit_rarest_pair(needle, code_unit_strlen(needle), &rare1, &rare2);
+    assert_continue(rare1 == 5); // z
+    assert_continue(rare2 == 4); // q
+  }
+  { // second differs from the first
+    const CODE_UNIT* needle = CODE_UNIT_LITERAL("zzzze");
+    size_t rare1, rare2;
+    code_unit_rarest_pair(needle, code_unit_strlen(needle), &rare1, &rare2);
+    assert_continue(needle[rare1] == 'z');
+    assert_continue(rare2 == 4);
+  }
+  { // every unit is the same
+    const CODE_UNIT* needle = CODE_UNIT_LITERAL("aaa");
+    size_t rare1, rare2;
+    code_unit_rarest_pair(needle, code_unit_strlen(needle), &rare1, &rare2);
+    assert_continue(rare1 != rare2);
+    code_unit_rarest_pair(needle, 1, &rare1, &rare2);
+    assert_continue(rare1 == 0 && rare2 == 0);
+  }
+#ifdef USE_WCHAR
+  { // wide units are rare
+    const CODE_UNIT* needle = L"eé✓";
+    size_t rare1, rare2;
+    code_unit_rarest_pair(needle, code_unit_strlen(needle), &rare1, &rare2);
+    assert_continue(rare1 == 2);
+  }
+#endif
+  { // nominal and repeated hits of the rare unit
+    const CODE_UNIT* haystack = CODE_UNIT_LITERAL("zaz zebra azeb zebrazebra");
+    size_t haystack_len = code_unit_strlen(haystack);
+    const CODE_UNIT* needle = CODE_UNIT_LITERAL("zebra");
+    size_t needle_len = code_unit_strlen(needle);
+    size_t rare1, rare2;
+    code_unit_rarest_pair(needle, needle_len, &rare1, &rare2);
+    assert_continue(code_unit_memmem_rare(haystack, haystack_len, needle, needle_len, rare1, rare2) == haystack + 4);
+    assert_continue(code_unit_memmem_rare(haystack + 5, haystack_len - 5, needle, needle_len, rare1, rare2) == haystack + 15);
+    assert_continue(code_unit_memmem_rare(haystack, 8, needle, needle_len, rare1, rare2) == NULL);
+  }
+  { // random, against brute force. the small alphabet makes the rare unit
+    // common, exercising the fallback
+    unsigned int state = 1;
+    CODE_UNIT haystack[300];
+    CODE_UNIT needle[8];
+    for (size_t iteration = 0; iteration < 3000; ++iteration) {
+      state = state * 1103515245 + 12345;
+      size_t haystack_len = (state >> 8) % 300;
+      state = state * 1103515245 + 12345;
+      size_t needle_len = (state >> 8) % 8;
+      state = state * 1103515245 + 12345;
+      size_t alphabet = 1 + (state >> 8) % 4;
+      for (size_t i = 0; i < haystack_len; ++i) {
+        state = state * 1103515245 + 12345;
+        haystack[i] = "zqea"[(state >> 8) % alphabet];
+      }
+      for (size_t i = 0; i < needle_len; ++i) {
+        state = state * 1103515245 + 12345;
+        needle[i] = "zqea"[(state >> 8) % alphabet];
+      }
+      size_t rare1 = 0, rare2 = 0;
+      if (needle_len != 0) {
+        code_unit_rarest_pair(needle, needle_len, &rare1, &rare2);
+      }
+      const CODE_UNIT* expected = naive_memmem(haystack, haystack_len, needle, needle_len);
+      assert_continue(code_unit_memmem_rare(haystack, haystack_len, needle, needle_len, rare1, rare2) == expected);
+    }
+  }
+  { // ranks from a sample
+    unsigned char saved[256];
+    memcpy(saved, code_unit_frequency_rank, sizeof(saved));
+    const char* sample = "zzzzzzzzqqqqe";
+    code_unit_frequency_from_sample(sample, strlen(sample));
+    assert_continue(code_unit_frequency_rank['z'] == 255);
+    assert_continue(code_unit_frequency_rank['q'] == 254);
+    assert_continue(code_unit_frequency_rank['e'] == 253);
+    // unseen bytes keep their order
+    assert_continue(code_unit_frequency_rank[' '] == 252);
+    assert_continue(code_unit_frequency_rank[0x7F] == 0);
+    const CODE_UNIT* needle = CODE_UNIT_LITERAL("zqe ");
+    size_t rare1, rare2;
+    code_unit_rarest_pair(needle, 4, &rare1, &rare2);
+    assert_continue(rare1 == 3);
+    assert_continue(rare2 == 2);
+    memcpy(code_unit_frequency_rank, saved, sizeof(saved));
+  }
+  return has_errors;
+}
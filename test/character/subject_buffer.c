@@ -5,19 +5,30 @@
 #include <stddef.h>
 #include <string.h>
 
-char fread_wrapper_data_arr[100];
+char fread_wrapper_data_arr[10000];
 char* fread_wrapper_data = fread_wrapper_data_arr;
 size_t fread_wrapper_data_size = 0;
+size_t read_wrapper_max_chunk = 2;
 
 void set_data_to_read_next(const char* data) {
   size_t len = strlen(data);
   assert(len <= sizeof(fread_wrapper_data_arr) / sizeof(*fread_wrapper_data));
+  fread_wrapper_data = fread_wrapper_data_arr;
   fread_wrapper_data_size = len;
   memcpy(fread_wrapper_data, data, len * sizeof(*fread_wrapper_data));
 }
 
 #include "character/subject_buffer.h"
 
+// a regular file with the given content, which is removed when closed
+FILE* regular_file_with_content(const char* data) {
+  FILE* f = tmpfile();
+  assert(f != NULL);
+  fputs(data, f);
+  fflush(f);
+  return f;
+}
+
 #include "test_common.h"
 extern int has_errors;
 
@@ -80,6 +91,275 @@ int main() {
     assert_continue(buf.size == 2);
     assert_continue(subject_buffer_start(&buf)[buf.offset++] == '6');
   }
+#ifdef USE_WCHAR
+  { // multibyte sequences give fewer characters than bytes, but the segment
+    // is still filled
+    subject_buffer_state buf;
+    size_t capacity = 4;
+    char byte_buffer[capacity];
+    wchar_t character_buffer[capacity];
+    init_subject_buffer(&buf, capacity, byte_buffer, character_buffer, 0);
+    // the last character of the segment is decoded a byte at a time
+    set_data_to_read_next("abc\xF0\x9F\x98\x80" "d\xC3\xA9" "f");
+    assert_continue(false == subject_buffer_get_first_input(&buf));
+    assert_continue(buf.size == capacity);
+    assert_continue(0 == wmemcmp(subject_buffer_start(&buf), L"abc\U0001F600", 4));
+    buf.offset = 4;
+    assert_continue(true == subject_buffer_shift_and_get_input(&buf));
+    assert_continue(buf.size == 3);
+    assert_continue(0 == wmemcmp(subject_buffer_start(&buf), L"d\u00E9f", 3));
+  }
+#endif
+  { // a pinned position is retained
+    subject_buffer_state buf;
+    size_t capacity = 4;
+    char byte_buffer[capacity];
+#ifdef USE_WCHAR
+    wchar_t character_buffer[capacity];
+    init_subject_buffer(&buf, capacity, byte_buffer, character_buffer, 0);
+#else
+    init_subject_buffer(&buf, capacity, byte_buffer, 0);
+#endif
+    set_data_to_read_next("123456789");
+    assert_continue(false == subject_buffer_get_first_input(&buf));
+    assert_continue(buf.pin == SUBJECT_BUFFER_NO_PIN);
+    buf.pin = 1;
+    buf.offset = 4;
+    assert_continue(false == subject_buffer_shift_and_get_input(&buf));
+    assert_continue(buf.stream_offset == 1);
+    assert_continue(buf.offset == 3);
+    assert_continue(buf.size == capacity);
+    assert_continue(subject_buffer_start(&buf)[0] == '2');
+    assert_continue(subject_buffer_start(&buf)[3] == '5');
+    // the pinned position is the beginning of the segment, so it's discarded
+    buf.offset = 4;
+    assert_continue(false == subject_buffer_shift_and_get_input(&buf));
+    assert_continue(buf.pin == SUBJECT_BUFFER_NO_PIN);
+    assert_continue(buf.stream_offset == 5);
+    assert_continue(buf.offset == 0);
+    assert_continue(subject_buffer_start(&buf)[0] == '6');
+  }
+
+  { // read from fd, with short reads
+    subject_buffer_state buf;
+    size_t capacity = 5;
+    char byte_buffer[capacity];
+#ifdef USE_WCHAR
+    wchar_t character_buffer[capacity];
+    init_subject_buffer_fd(&buf, -1, capacity, byte_buffer, character_buffer, 1);
+#else
+    init_subject_buffer_fd(&buf, -1, capacity, byte_buffer, 1);
+#endif
+    set_data_to_read_next("123456789");
+    assert_continue(false == subject_buffer_get_first_input(&buf));
+    assert_continue(buf.offset == 0);
+    assert_continue(buf.size == capacity);
+    assert_continue(0 == code_unit_memcmp(subject_buffer_start(&buf), CODE_UNIT_LITERAL("12345"), 5));
+    buf.offset = 5;
+    assert_continue(false == subject_buffer_shift_and_get_input(&buf));
+    assert_continue(buf.offset == 1);
+    assert_continue(buf.size == 5);
+    assert_continue(0 == code_unit_memcmp(subject_buffer_start(&buf), CODE_UNIT_LITERAL("56789"), 5));
+    buf.offset = 5;
+    assert_continue(true == subject_buffer_shift_and_get_input(&buf));
+    assert_continue(buf.offset == 1);
+    assert_continue(buf.size == 1);
+    assert_continue(subject_buffer_start(&buf)[0] == '9');
+  }
+  { // prefetch, with lookbehind
+    subject_buffer_state buf;
+    size_t capacity = 3;
+    char byte_buffer[capacity];
+    char prefetch_byte_buffer0[capacity];
+    char prefetch_byte_buffer1[capacity];
+    char* prefetch_byte_buffers[2] = {prefetch_byte_buffer0, prefetch_byte_buffer1};
+    subject_buffer_prefetch prefetch;
+#ifdef USE_WCHAR
+    wchar_t character_buffer[capacity];
+    wchar_t prefetch_character_buffer0[capacity];
+    wchar_t prefetch_character_buffer1[capacity];
+    wchar_t* prefetch_character_buffers[2] = {prefetch_character_buffer0, prefetch_character_buffer1};
+    init_subject_buffer_fd(&buf, -1, capacity, byte_buffer, character_buffer, 1);
+    set_data_to_read_next("123456");
+    assert_continue(subject_buffer_start_prefetch(&buf, &prefetch, prefetch_byte_buffers, prefetch_character_buffers));
+#else
+    init_subject_buffer_fd(&buf, -1, capacity, byte_buffer, 1);
+    set_data_to_read_next("123456");
+    assert_continue(subject_buffer_start_prefetch(&buf, &prefetch, prefetch_byte_buffers));
+#endif
+    assert_continue(false == subject_buffer_get_first_input(&buf));
+    assert_continue(buf.offset == 0);
+    assert_continue(buf.size == capacity);
+    assert_continue(subject_buffer_start(&buf)[buf.offset++] == '1');
+    assert_continue(subject_buffer_start(&buf)[buf.offset++] == '2');
+    assert_continue(subject_buffer_start(&buf)[buf.offset++] == '3');
+    assert_continue(false == subject_buffer_shift_and_get_input(&buf));
+    assert_continue(buf.offset == 1);
+    assert_continue(buf.size == capacity);
+    assert_continue(subject_buffer_start(&buf)[buf.offset - 1] == '3');
+    assert_continue(subject_buffer_start(&buf)[buf.offset++] == '4');
+    assert_continue(subject_buffer_start(&buf)[buf.offset++] == '5');
+    assert_continue(true == subject_buffer_shift_and_get_input(&buf));
+    assert_continue(buf.offset == 1);
+    assert_continue(buf.size == 2);
+    assert_continue(subject_buffer_start(&buf)[buf.offset++] == '6');
+    deinit_subject_buffer(&buf);
+  }
+  { // prefetch, with multibyte sequences split across reads
+    subject_buffer_state buf;
+    size_t capacity = 4;
+    char byte_buffer[capacity];
+    char prefetch_byte_buffer0[capacity];
+    char prefetch_byte_buffer1[capacity];
+    char* prefetch_byte_buffers[2] = {prefetch_byte_buffer0, prefetch_byte_buffer1};
+    subject_buffer_prefetch prefetch;
+    // the truncated sequence (\xE2) is only found invalid after the read
+    // boundary, and the euro sign is split across reads
+    set_data_to_read_next("abc\xE2wxyz\xE2\x82\xAC!");
+#ifdef USE_WCHAR
+    const CODE_UNIT* expected = L"abc\uFFFFwxyz\u20AC!";
+    wchar_t character_buffer[capacity];
+    wchar_t prefetch_character_buffer0[capacity];
+    wchar_t prefetch_character_buffer1[capacity];
+    wchar_t* prefetch_character_buffers[2] = {prefetch_character_buffer0, prefetch_character_buffer1};
+    init_subject_buffer_fd(&buf, -1, capacity, byte_buffer, character_buffer, 0);
+    buf.skip_invalid = false;
+    assert_continue(subject_buffer_start_prefetch(&buf, &prefetch, prefetch_byte_buffers, prefetch_character_buffers));
+#else
+    const CODE_UNIT* expected = "abc\xE2wxyz\xE2\x82\xAC!";
+    init_subject_buffer_fd(&buf, -1, capacity, byte_buffer, 0);
+    assert_continue(subject_buffer_start_prefetch(&buf, &prefetch, prefetch_byte_buffers));
+#endif
+    CODE_UNIT all[32];
+    size_t num_all = 0;
+    bool input_complete = subject_buffer_get_first_input(&buf);
+    while (1) {
+      assert_continue(buf.size <= capacity);
+      assert(num_all + buf.size <= sizeof(all) / sizeof(*all));
+      memcpy(all + num_all, subject_buffer_start(&buf), buf.size * sizeof(CODE_UNIT));
+      num_all += buf.size;
+      if (input_complete) break;
+      buf.offset = buf.size;
+      input_complete = subject_buffer_shift_and_get_input(&buf);
+    }
+    assert_continue(num_all == code_unit_strlen(expected));
+    assert_continue(0 == code_unit_memcmp(all, expected, code_unit_strlen(expected)));
+    deinit_subject_buffer(&buf);
+  }
+  { // ring buffer with large lookbehind
+    subject_buffer_state buf;
+    size_t capacity = subject_buffer_ring_capacity(1);
+    assert_continue(capacity % subject_buffer_ring_granularity() == 0);
+    size_t data_len = capacity + 100;
+    char data[data_len + 1];
+    for (size_t i = 0; i < data_len; ++i) {
+      data[i] = 'a' + i % 26;
+    }
+    data[data_len] = '\0';
+    set_data_to_read_next(data);
+    size_t max_lookbehind = capacity / 2;
+#ifdef USE_WCHAR
+    char byte_buffer[capacity];
+    assert_continue(init_subject_buffer_ring(&buf, capacity, byte_buffer, max_lookbehind));
+#else
+    assert_continue(init_subject_buffer_ring(&buf, capacity, max_lookbehind));
+#endif
+    assert_continue(false == subject_buffer_get_first_input(&buf));
+    assert_continue(buf.size == capacity);
+    CODE_UNIT* first_start = subject_buffer_start(&buf);
+    buf.offset = capacity - 10;
+    assert_continue(true == subject_buffer_shift_and_get_input(&buf));
+    size_t amount_moved = capacity - 10 - max_lookbehind;
+    assert_continue(buf.offset == max_lookbehind);
+    assert_continue(buf.size == capacity - amount_moved + 100);
+    // nothing was moved. the segment begins further into the ring
+    assert_continue(subject_buffer_start(&buf) == first_start + amount_moved);
+    for (size_t i = 0; i < buf.size; ++i) {
+      assert_continue(subject_buffer_start(&buf)[i] == (CODE_UNIT)data[amount_moved + i]);
+    }
+    // again, this time the segment wraps around the end of the ring
+    size_t amount_moved2 = buf.size - max_lookbehind;
+    buf.offset = buf.size;
+    assert_continue(true == subject_buffer_shift_and_get_input(&buf));
+    assert_continue(buf.size == max_lookbehind);
+    assert_continue(subject_buffer_start(&buf) + buf.size > first_start + capacity);
+    for (size_t i = 0; i < buf.size; ++i) {
+      assert_continue(subject_buffer_start(&buf)[i] == (CODE_UNIT)data[amount_moved + amount_moved2 + i]);
+    }
+    deinit_subject_buffer(&buf);
+  }
+  { // mmap regular file
+    FILE* f = regular_file_with_content("123456");
+    subject_buffer_state buf;
+#ifdef USE_WCHAR
+    size_t capacity = 3;
+    wchar_t character_buffer[capacity];
+    assert_continue(init_subject_buffer_mmap(&buf, fileno(f), capacity, character_buffer, 1));
+    assert_continue(false == subject_buffer_get_first_input(&buf));
+    assert_continue(buf.offset == 0);
+    assert_continue(buf.size == capacity);
+    assert_continue(subject_buffer_start(&buf)[buf.offset++] == '1');
+    assert_continue(subject_buffer_start(&buf)[buf.offset++] == '2');
+    assert_continue(subject_buffer_start(&buf)[buf.offset++] == '3');
+    assert_continue(false == subject_buffer_shift_and_get_input(&buf));
+    assert_continue(buf.offset == 1);
+    assert_continue(buf.size == capacity);
+    assert_continue(subject_buffer_start(&buf)[buf.offset - 1] == '3');
+    assert_continue(subject_buffer_start(&buf)[buf.offset++] == '4');
+    assert_continue(subject_buffer_start(&buf)[buf.offset++] == '5');
+    assert_continue(true == subject_buffer_shift_and_get_input(&buf));
+    assert_continue(buf.offset == 1);
+    assert_continue(buf.size == 2);
+    assert_continue(subject_buffer_start(&buf)[buf.offset++] == '6');
+#else
+    assert_continue(init_subject_buffer_mmap(&buf, fileno(f), 1));
+    // entire file is the subject
+    assert_continue(true == subject_buffer_get_first_input(&buf));
+    assert_continue(buf.offset == 0);
+    assert_continue(buf.size == 6);
+    assert_continue(0 == memcmp(subject_buffer_start(&buf), "123456", 6));
+    buf.offset = 4;
+    // no shifting
+    assert_continue(true == subject_buffer_shift_and_get_input(&buf));
+    assert_continue(buf.offset == 4);
+    assert_continue(buf.size == 6);
+    assert_continue(0 == memcmp(subject_buffer_start(&buf), "123456", 6));
+#endif
+    deinit_subject_buffer(&buf);
+    fclose(f);
+  }
+  { // mmap empty regular file
+    FILE* f = regular_file_with_content("");
+    subject_buffer_state buf;
+#ifdef USE_WCHAR
+    wchar_t character_buffer[1];
+    assert_continue(init_subject_buffer_mmap(&buf, fileno(f), 1, character_buffer, 0));
+#else
+    assert_continue(init_subject_buffer_mmap(&buf, fileno(f), 0));
+#endif
+    assert_continue(true == subject_buffer_get_first_input(&buf));
+    assert_continue(buf.size == 0);
+    deinit_subject_buffer(&buf);
+    fclose(f);
+  }
+  { // mmap not possible for pipe
+    int fds[2];
+    assert(pipe(fds) == 0);
+    subject_buffer_state buf;
+    memset(&buf, 0xFF, sizeof(buf));
+#ifdef USE_WCHAR
+    wchar_t character_buffer[1];
+    assert_continue(false == init_subject_buffer_mmap(&buf, fds[0], 1, character_buffer, 0));
+#else
+    assert_continue(false == init_subject_buffer_mmap(&buf, fds[0], 0));
+#endif
+    // still safe to deinit
+    assert_continue(buf.source == SUBJECT_BUFFER_SOURCE_FILE);
+    assert_continue(buf.mapping___ == NULL);
+    deinit_subject_buffer(&buf);
+    close(fds[0]);
+    close(fds[1]);
+  }
 
   return has_errors;
 }
\ No newline at end of file
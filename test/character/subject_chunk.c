@@ -0,0 +1,246 @@
+#include <assert.h>
+#include <locale.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "character/subject_chunk.h"
+
+#include "test_common.h"
+extern int has_errors;
+
+// each piece is one or two characters. with USE_WCHAR, the truncated
+// sequences decode to a noncharacter per byte
+static const char* pieces[] = {"a", "x", "xy", "\xC3\xA9", "\xE2\x9C\x93", "\xC3", "\xE2\x9C"};
+#ifdef USE_WCHAR
+static const size_t pieces_num_characters[] = {1, 1, 2, 1, 1, 1, 2};
+#endif
+
+#define NUM_PIECES 2000
+
+static char content[NUM_PIECES * 3];
+static size_t content_size = 0;
+static uint64_t expected[NUM_PIECES];
+static size_t num_expected = 0;
+
+// content is some arrangement of the pieces. "xy" is the pattern
+static void build_content(void) {
+  uint64_t position = 0;
+  unsigned int state = 12345;
+  for (size_t i = 0; i < NUM_PIECES; ++i) {
+    state = state * 1103515245 + 12345;
+    size_t piece = (state >> 16) % (sizeof(pieces) / sizeof(*pieces));
+    if (piece == 2) {
+      expected[num_expected++] = position;
+    }
+    size_t len = strlen(pieces[piece]);
+    memcpy(content + content_size, pieces[piece], len);
+    content_size += len;
+#ifdef USE_WCHAR
+    position += pieces_num_characters[piece];
+#else
+    position += len;
+#endif
+  }
+}
+
+// non-overlapping matches of a two character pattern, ctx
+static void scan_for_pair(subject_buffer_state* buf, subject_chunk* chunk, void* ctx) {
+  const char* pair = (const char*)ctx;
+  bool complete = subject_chunk_get_first_input(chunk, buf);
+  while (true) {
+    while (subject_buffer_remaining_size(buf) >= 2) {
+      CODE_UNIT* p = subject_buffer_offset(buf);
+      if (p[0] == (CODE_UNIT)pair[0] && p[1] == (CODE_UNIT)pair[1]) {
+        if (!subject_chunk_report_match(chunk, buf, buf->offset, buf->offset + 2)) {
+          return;
+        }
+        buf->offset += 2;
+      } else {
+        ++buf->offset;
+      }
+    }
+    if (complete) {
+      return;
+    }
+    complete = subject_buffer_shift_and_get_input(buf);
+  }
+}
+
+// runs of "a" of different lengths, between other pieces
+static char runs_content[NUM_PIECES * 3];
+static size_t runs_content_size = 0;
+static uint64_t runs_expected[NUM_PIECES];
+static size_t runs_num_expected = 0;
+
+// "aa" is the pattern, which overlaps itself. a single scan matches the
+// beginning of each run, and every second character after
+static void build_runs_content(void) {
+  uint64_t position = 0;
+  unsigned int state = 54321;
+  while (runs_content_size < NUM_PIECES) {
+    state = state * 1103515245 + 12345;
+    size_t run_length = (state >> 16) % 24;
+    for (size_t i = 0; i + 1 < run_length; i += 2) {
+      runs_expected[runs_num_expected++] = position + i;
+    }
+    memset(runs_content + runs_content_size, 'a', run_length);
+    runs_content_size += run_length;
+    position += run_length;
+    const char* separator = (state >> 8) % 2 ? "b" : "\xC3\xA9";
+    size_t len = strlen(separator);
+    memcpy(runs_content + runs_content_size, separator, len);
+    runs_content_size += len;
+#ifdef USE_WCHAR
+    position += 1;
+#else
+    position += len;
+#endif
+  }
+}
+
+#define MAX_CHUNKS 8
+#define CAPACITY 16
+
+int main() {
+  setlocale(LC_ALL, "");
+  build_content();
+  build_runs_content();
+  FILE* f = tmpfile();
+  assert(f != NULL);
+  assert(fwrite(content, 1, content_size, f) == content_size);
+  fflush(f);
+  int fd = fileno(f);
+
+  CODE_UNIT subject_buffers[MAX_CHUNKS][CAPACITY];
+#ifdef USE_WCHAR
+  char byte_buffers[MAX_CHUNKS][CAPACITY];
+#endif
+  uint64_t matches[MAX_CHUNKS][NUM_PIECES];
+  uint64_t merged[NUM_PIECES];
+
+  for (size_t n = 1; n <= MAX_CHUNKS; ++n) { // every chunk count gives the same matches
+    subject_chunk_range ranges[MAX_CHUNKS];
+    size_t num_ranges = subject_chunk_plan(fd, content_size, n, 2, 0, ranges);
+    assert_continue(num_ranges == n);
+    assert_continue(ranges[0].owned_begin == 0);
+    assert_continue(ranges[num_ranges - 1].owned_end == content_size);
+    subject_chunk chunks[MAX_CHUNKS];
+    for (size_t i = 0; i < num_ranges; ++i) {
+      if (i != 0) {
+        assert_continue(ranges[i].owned_begin == ranges[i - 1].owned_end);
+      }
+#if defined(USE_WCHAR) || defined(USE_UTF8)
+      // never splits a sequence
+      assert_continue(((unsigned char)content[ranges[i].owned_begin] & 0xC0) != 0x80);
+#endif
+#ifdef USE_WCHAR
+      init_subject_chunk(&chunks[i], fd, ranges[i], CAPACITY, subject_buffers[i], byte_buffers[i], 0, matches[i], NUM_PIECES);
+#else
+      init_subject_chunk(&chunks[i], fd, ranges[i], CAPACITY, subject_buffers[i], 0, matches[i], NUM_PIECES);
+#endif
+    }
+    assert_continue(subject_chunk_scan(chunks, num_ranges, scan_for_pair, "xy", false));
+    size_t num_merged = subject_chunk_merge_matches(chunks, num_ranges, merged, NUM_PIECES);
+    assert_continue(num_merged == num_expected);
+    assert_continue(0 == memcmp(merged, expected, num_expected * sizeof(*merged)));
+  }
+
+  { // lookbehind is read before the owned range
+    subject_chunk_range ranges[2];
+    size_t num_ranges = subject_chunk_plan(fd, content_size, 2, 2, 3, ranges);
+    assert_continue(num_ranges == 2);
+    assert_continue(ranges[0].read_begin == 0);
+    assert_continue(ranges[1].read_begin < ranges[1].owned_begin);
+    assert_continue(ranges[0].read_end > ranges[0].owned_end);
+    assert_continue(ranges[1].read_end == content_size);
+    subject_chunk chunks[2];
+    for (size_t i = 0; i < num_ranges; ++i) {
+#ifdef USE_WCHAR
+      init_subject_chunk(&chunks[i], fd, ranges[i], CAPACITY, subject_buffers[i], byte_buffers[i], 3, matches[i], NUM_PIECES);
+#else
+      init_subject_chunk(&chunks[i], fd, ranges[i], CAPACITY, subject_buffers[i], 3, matches[i], NUM_PIECES);
+#endif
+    }
+    assert_continue(subject_chunk_scan(chunks, num_ranges, scan_for_pair, "xy", false));
+    size_t num_merged = subject_chunk_merge_matches(chunks, num_ranges, merged, NUM_PIECES);
+    assert_continue(num_merged == num_expected);
+    assert_continue(0 == memcmp(merged, expected, num_expected * sizeof(*merged)));
+  }
+
+  { // a self overlapping pattern gives the same matches as a single scan
+    FILE* runs = tmpfile();
+    assert(runs != NULL);
+    assert(fwrite(runs_content, 1, runs_content_size, runs) == runs_content_size);
+    fflush(runs);
+    for (size_t n = 1; n <= MAX_CHUNKS; ++n) {
+      subject_chunk_range ranges[MAX_CHUNKS];
+      size_t num_ranges = subject_chunk_plan(fileno(runs), runs_content_size, n, 2, 0, ranges);
+      assert_continue(num_ranges == n);
+      subject_chunk chunks[MAX_CHUNKS];
+      for (size_t i = 0; i < num_ranges; ++i) {
+#ifdef USE_WCHAR
+        init_subject_chunk(&chunks[i], fileno(runs), ranges[i], CAPACITY, subject_buffers[i], byte_buffers[i], 0, matches[i], NUM_PIECES);
+#else
+        init_subject_chunk(&chunks[i], fileno(runs), ranges[i], CAPACITY, subject_buffers[i], 0, matches[i], NUM_PIECES);
+#endif
+      }
+      assert_continue(subject_chunk_scan(chunks, num_ranges, scan_for_pair, "aa", false));
+      size_t num_merged = subject_chunk_merge_matches(chunks, num_ranges, merged, NUM_PIECES);
+      assert_continue(num_merged == runs_num_expected);
+      assert_continue(0 == memcmp(merged, runs_expected, runs_num_expected * sizeof(*merged)));
+    }
+    fclose(runs);
+  }
+
+  { // the second chunk begins within the first chunk's last match
+    FILE* small = tmpfile();
+    assert(small != NULL);
+    fputs("aaaaaaa", small);
+    fflush(small);
+    subject_chunk_range ranges[2];
+    assert_continue(2 == subject_chunk_plan(fileno(small), 7, 2, 2, 0, ranges));
+    assert_continue(ranges[1].owned_begin == 3);
+    subject_chunk chunks[2];
+    for (size_t i = 0; i < 2; ++i) {
+#ifdef USE_WCHAR
+      init_subject_chunk(&chunks[i], fileno(small), ranges[i], CAPACITY, subject_buffers[i], byte_buffers[i], 0, matches[i], NUM_PIECES);
+#else
+      init_subject_chunk(&chunks[i], fileno(small), ranges[i], CAPACITY, subject_buffers[i], 0, matches[i], NUM_PIECES);
+#endif
+    }
+    assert_continue(subject_chunk_scan(chunks, 2, scan_for_pair, "aa", false));
+    size_t num_merged = subject_chunk_merge_matches(chunks, 2, merged, NUM_PIECES);
+    assert_continue(num_merged == 3);
+    assert_continue(merged[0] == 0 && merged[1] == 2 && merged[2] == 4);
+    fclose(small);
+  }
+
+  { // matches overflow
+    subject_chunk_range range;
+    assert_continue(1 == subject_chunk_plan(fd, content_size, 1, 2, 0, &range));
+    subject_chunk chunk;
+#ifdef USE_WCHAR
+    init_subject_chunk(&chunk, fd, range, CAPACITY, subject_buffers[0], byte_buffers[0], 0, matches[0], 1);
+#else
+    init_subject_chunk(&chunk, fd, range, CAPACITY, subject_buffers[0], 0, matches[0], 1);
+#endif
+    assert_continue(!subject_chunk_scan(&chunk, 1, scan_for_pair, "xy", false));
+    assert_continue(chunk.matches_overflow);
+    assert_continue(chunk.num_matches == 1);
+    assert_continue(chunk.matches[0] == expected[0]);
+  }
+
+  { // small input gives fewer chunks
+    FILE* small = tmpfile();
+    assert(small != NULL);
+    fputs("xy", small);
+    fflush(small);
+    subject_chunk_range ranges[MAX_CHUNKS];
+    assert_continue(2 == subject_chunk_plan(fileno(small), 2, MAX_CHUNKS, 2, 0, ranges));
+    assert_continue(0 == subject_chunk_plan(fileno(small), 0, MAX_CHUNKS, 2, 0, ranges));
+    fclose(small);
+  }
+
+  fclose(f);
+  return has_errors;
+}
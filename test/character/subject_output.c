@@ -0,0 +1,135 @@
+#include <assert.h>
+#include <locale.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "character/subject_output.h"
+
+#include "test_common.h"
+extern int has_errors;
+
+#ifndef USE_WCHAR
+
+// a regular file with the given content, which is removed when closed
+FILE* regular_file_with_content(const char* data) {
+  FILE* f = tmpfile();
+  assert(f != NULL);
+  fputs(data, f);
+  fflush(f);
+  rewind(f);
+  return f;
+}
+
+// queue each run of 'x' as a span
+static void output_each_x(subject_buffer_state* buf, subject_output* out) {
+  bool complete = subject_buffer_get_first_input(buf);
+  while (true) {
+    while (buf->offset < buf->size) {
+      if (subject_buffer_offset(buf)[0] == 'x') {
+        subject_output_add(out, subject_buffer_offset(buf), subject_buffer_offset(buf) + 1);
+      }
+      ++buf->offset;
+    }
+    if (complete) break;
+    complete = subject_buffer_shift_and_get_input(buf);
+  }
+}
+
+// read everything that was written to the pipe
+static size_t read_pipe(int fd, char* dst, size_t capacity) {
+  size_t total = 0;
+  while (total != capacity) {
+    ssize_t ret = read(fd, dst + total, capacity - total);
+    if (ret <= 0) break;
+    total += ret;
+  }
+  return total;
+}
+
+#endif
+
+int main() {
+  setlocale(LC_ALL, "");
+#ifndef USE_WCHAR
+  const char* input = "axxbcxdxxxefghxijklmnopxx";
+  const char* expected = "xxxxxxxxx";
+
+  { // spans are written before a shift discards them
+    FILE* f = regular_file_with_content(input);
+    int pipe_fds[2];
+    assert(pipe(pipe_fds) == 0);
+    struct iovec iov[3];
+    subject_output out;
+    init_subject_output(&out, pipe_fds[1], iov, sizeof(iov) / sizeof(*iov));
+
+    subject_buffer_state buf;
+    size_t capacity = 4;
+    char byte_buffer[capacity];
+    init_subject_buffer_fd(&buf, fileno(f), capacity, byte_buffer, 0);
+    subject_output_attach(&out, &buf);
+    assert_continue(!out.splice); // the buffer is overwritten by shifts
+    output_each_x(&buf, &out);
+    assert_continue(subject_output_flush(&out));
+    deinit_subject_buffer(&buf);
+    close(pipe_fds[1]);
+
+    char result[64];
+    size_t len = read_pipe(pipe_fds[0], result, sizeof(result));
+    assert_continue(len == strlen(expected));
+    assert_continue(0 == memcmp(result, expected, len));
+    close(pipe_fds[0]);
+    fclose(f);
+  }
+
+  { // adjacent spans are joined
+    struct iovec iov[2];
+    subject_output out;
+    init_subject_output(&out, -1, iov, 2);
+    const char* s = "abcdef";
+    subject_output_add(&out, s, s + 2);
+    subject_output_add(&out, s + 2, s + 3);
+    subject_output_add(&out, s + 3, s + 3);
+    assert_continue(out.num_iov == 1);
+    assert_continue(iov[0].iov_len == 3);
+    subject_output_add(&out, s + 4, s + 6);
+    assert_continue(out.num_iov == 2);
+    out.num_iov = 0; // discard
+  }
+
+  { // mapped subject is spliced into a pipe
+    FILE* f = regular_file_with_content(input);
+    int pipe_fds[2];
+    assert(pipe(pipe_fds) == 0);
+    struct iovec iov[2];
+    subject_output out;
+    init_subject_output(&out, pipe_fds[1], iov, sizeof(iov) / sizeof(*iov));
+
+    subject_buffer_state buf;
+    assert_continue(init_subject_buffer_mmap(&buf, fileno(f), 0));
+    subject_output_attach(&out, &buf);
+    assert_continue(out.splice);
+    output_each_x(&buf, &out);
+    assert_continue(subject_output_flush(&out));
+    close(pipe_fds[1]);
+
+    char result[64];
+    size_t len = read_pipe(pipe_fds[0], result, sizeof(result));
+    assert_continue(len == strlen(expected));
+    assert_continue(0 == memcmp(result, expected, len));
+    deinit_subject_buffer(&buf);
+    close(pipe_fds[0]);
+    fclose(f);
+  }
+
+  { // write error
+    struct iovec iov[1];
+    subject_output out;
+    init_subject_output(&out, -1, iov, 1);
+    const char* s = "ab";
+    subject_output_add(&out, s, s + 1);
+    assert_continue(!subject_output_flush(&out));
+    assert_continue(out.error);
+  }
+#endif
+  return has_errors;
+}
@@ -0,0 +1,110 @@
+#include <assert.h>
+#include <locale.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "character/subject_schedule.h"
+
+#include "test_common.h"
+extern int has_errors;
+
+#define NUM_FILES 40
+#define CAPACITY 8
+
+typedef struct {
+  size_t num_x[NUM_FILES];
+  size_t expected_num_x[NUM_FILES];
+  bool expected_opened[NUM_FILES];
+  size_t emitted[NUM_FILES];
+  bool emitted_opened[NUM_FILES];
+  size_t num_emitted;
+} scan_results;
+
+static void count_x(subject_buffer_state* buf, size_t file_index, void* ctx) {
+  scan_results* results = (scan_results*)ctx;
+  size_t count = 0;
+  bool complete = subject_buffer_get_first_input(buf);
+  while (true) {
+    while (buf->offset < buf->size) {
+      if (subject_buffer_offset(buf)[0] == 'x') {
+        ++count;
+      }
+      ++buf->offset;
+    }
+    if (complete) break;
+    complete = subject_buffer_shift_and_get_input(buf);
+  }
+  results->num_x[file_index] = count;
+}
+
+static void record_emit(size_t file_index, bool opened, void* ctx) {
+  scan_results* results = (scan_results*)ctx;
+  results->emitted_opened[results->num_emitted] = opened;
+  results->emitted[results->num_emitted++] = file_index;
+}
+
+static char arena[1 << 16] __attribute__((aligned(16)));
+
+int main() {
+  setlocale(LC_ALL, "");
+  char dir[] = "/tmp/subject_schedule_XXXXXX";
+  assert(mkdtemp(dir) != NULL);
+
+  char path_storage[NUM_FILES][sizeof(dir) + 16];
+  const char* paths[NUM_FILES];
+  scan_results results;
+  for (size_t i = 0; i < NUM_FILES; ++i) {
+    snprintf(path_storage[i], sizeof(path_storage[i]), "%s/%zu", dir, i);
+    paths[i] = path_storage[i];
+    results.expected_opened[i] = i % 7 != 3; // some files don't exist
+    results.expected_num_x[i] = 0;
+    if (!results.expected_opened[i]) {
+      continue;
+    }
+    FILE* f = fopen(paths[i], "w");
+    assert(f != NULL);
+    // varying sizes, some much larger than others
+    size_t len = (i % 5 == 0) ? 1000 + i : i;
+    for (size_t j = 0; j < len; ++j) {
+      bool is_x = (i + j) % 3 == 0;
+      results.expected_num_x[i] += is_x;
+      fputs(is_x ? "x" : "\xC3\xA9", f);
+    }
+    fclose(f);
+  }
+
+  for (size_t num_workers = 1; num_workers <= 4; ++num_workers) {
+    results.num_emitted = 0;
+    assert(subject_schedule_arena_size(NUM_FILES, num_workers, CAPACITY) <= sizeof(arena));
+    assert_continue(subject_schedule_run(paths, NUM_FILES, num_workers, CAPACITY, 0, arena, count_x, record_emit, &results));
+    // deterministic order
+    assert_continue(results.num_emitted == NUM_FILES);
+    for (size_t i = 0; i < NUM_FILES; ++i) {
+      assert_continue(results.emitted[i] == i);
+      assert_continue(results.emitted_opened[i] == results.expected_opened[i]);
+      if (results.expected_opened[i]) {
+        assert_continue(results.num_x[i] == results.expected_num_x[i]);
+      }
+    }
+  }
+
+  { // no files
+    results.num_emitted = 0;
+    assert_continue(subject_schedule_run(paths, 0, 2, CAPACITY, 0, arena, count_x, record_emit, &results));
+    assert_continue(results.num_emitted == 0);
+  }
+
+  { // capacity from the pattern
+    assert_continue(subject_schedule_capacity(1, 0) == SUBJECT_SCHEDULE_MIN_CAPACITY);
+    assert_continue(subject_schedule_capacity(SUBJECT_SCHEDULE_MIN_CAPACITY, 5) == SUBJECT_SCHEDULE_MIN_CAPACITY + 6);
+  }
+
+  for (size_t i = 0; i < NUM_FILES; ++i) {
+    if (results.expected_opened[i]) {
+      remove(paths[i]);
+    }
+  }
+  remove(dir);
+  return has_errors;
+}
@@ -0,0 +1,68 @@
+#include "character/utf8.h"
+
+#include "test_common.h"
+extern int has_errors;
+
+// decode a range expected to hold exactly one valid sequence
+static uint_fast32_t decode_whole(const char* s, size_t len) {
+  uint_fast32_t out = 0;
+  size_t out_len = 0;
+  utf8_decode_one_type result = utf8_decode_one((const unsigned char*)s, (const unsigned char*)s + len, &out, &out_len);
+  assert_continue(result == UTF8_DECODE_OK);
+  assert_continue(out_len == len);
+  return out;
+}
+
+static utf8_decode_one_type decode_type(const char* s, size_t len) {
+  uint_fast32_t out;
+  size_t out_len;
+  return utf8_decode_one((const unsigned char*)s, (const unsigned char*)s + len, &out, &out_len);
+}
+
+int main(void) {
+  { // each length
+    assert_continue(decode_whole("a", 1) == 'a');
+    assert_continue(decode_whole("\xC3\xA9", 2) == 0xE9);
+    assert_continue(decode_whole("\xE2\x9C\x93", 3) == 0x2713);
+    assert_continue(decode_whole("\xF0\x9F\x98\x80", 4) == 0x1F600);
+    assert_continue(decode_whole("\xF4\x8F\xBF\xBF", 4) == 0x10FFFF);
+  }
+  { // only the first sequence is decoded
+    uint_fast32_t out;
+    size_t out_len;
+    const char* s = "\xC3\xA9z";
+    assert_continue(UTF8_DECODE_OK == utf8_decode_one((const unsigned char*)s, (const unsigned char*)s + 3, &out, &out_len));
+    assert_continue(out == 0xE9);
+    assert_continue(out_len == 2);
+  }
+  { // invalid
+    assert_continue(decode_type("\x80", 1) == UTF8_DECODE_INVALID);         // stray continuation
+    assert_continue(decode_type("\xC0\x80", 2) == UTF8_DECODE_INVALID);     // overlong
+    assert_continue(decode_type("\xE0\x80\x80", 3) == UTF8_DECODE_INVALID); // overlong
+    assert_continue(decode_type("\xED\xA0\x80", 3) == UTF8_DECODE_INVALID); // surrogate
+    assert_continue(decode_type("\xF4\x90\x80\x80", 4) == UTF8_DECODE_INVALID); // past U+10FFFF
+    assert_continue(decode_type("\xF5\x80\x80\x80", 4) == UTF8_DECODE_INVALID);
+    assert_continue(decode_type("\xE2\x41", 2) == UTF8_DECODE_INVALID); // not continuation
+  }
+  { // incomplete
+    assert_continue(decode_type("\xC3", 1) == UTF8_DECODE_INCOMPLETE);
+    assert_continue(decode_type("\xE2\x9C", 2) == UTF8_DECODE_INCOMPLETE);
+    assert_continue(decode_type("\xF0\x9F\x98", 3) == UTF8_DECODE_INCOMPLETE);
+  }
+  { // encode round trip
+    const uint_fast32_t code_points[] = {0, 'a', 0x7F, 0x80, 0xE9, 0x7FF, 0x800, 0x2713, 0xFFFF, 0x10000, 0x1F600, 0x10FFFF};
+    for (size_t i = 0; i < sizeof(code_points) / sizeof(*code_points); ++i) {
+      char encoded[4];
+      size_t len = utf8_encode(code_points[i], encoded);
+      assert_continue(len != 0);
+      assert_continue(decode_whole(encoded, len) == code_points[i]);
+    }
+  }
+  { // not encodable
+    char encoded[4];
+    assert_continue(utf8_encode(0xD800, encoded) == 0);
+    assert_continue(utf8_encode(0xDFFF, encoded) == 0);
+    assert_continue(utf8_encode(0x110000, encoded) == 0);
+  }
+  return has_errors;
+}
@@ -6,72 +6,16 @@
 #include "test_common.h"
 extern int has_errors;
 
-int main(void) {
-  setlocale(LC_ALL, "");
+// the subject decoding tests, for the currently bound kernels
+static void test_subject_decoding(void) {
   { // empty input output
-    convert_pattern_to_wchar_range_result ret = convert_pattern_to_wchar_range(NULL, NULL, NULL);
-    assert_continue(ret.type == CONVERT_PATTERN_WCHAR_OK);
-    assert_continue(ret.value.out_end == NULL);
-  }
-  { // includes null
-    const char input[] = {'a', 'b', '\0', 'w'};
-    size_t input_size = sizeof(input) / sizeof(*input);
-    const wchar_t expected_output[] = {L'a', L'b', L'\0', L'w', 0};
-    size_t expected_output_size = sizeof(expected_output) / sizeof(*expected_output);
-    wchar_t output[expected_output_size];
-    memset(output, 0, sizeof(output));
-    convert_pattern_to_wchar_range_result ret = convert_pattern_to_wchar_range(input, input + input_size, output);
-    assert_continue(ret.type == CONVERT_PATTERN_WCHAR_OK);
-    assert_continue(ret.value.out_end == output + input_size);
-    assert_continue(0 == memcmp(expected_output, output, expected_output_size));
-  }
-  { // simple utf8 conversion. fits in utf16 or utf32
-    const char input[] = {0xE2, 0x9C, 0x93};
-    size_t input_size = sizeof(input) / sizeof(*input);
-    const wchar_t expected_output[] = {L'✓', 0};
-    size_t expected_output_size = sizeof(expected_output) / sizeof(*expected_output);
-    wchar_t output[expected_output_size];
-    memset(output, 0, sizeof(output));
-    convert_pattern_to_wchar_range_result ret = convert_pattern_to_wchar_range(input, input + input_size, output);
-    assert_continue(ret.type == CONVERT_PATTERN_WCHAR_OK);
-    assert_continue(ret.value.out_end == output + 1);
-    assert_continue(0 == memcmp(expected_output, output, expected_output_size));
-  }
-  { // error from bad utf8
-    const char input[] = {0xFF};
-    size_t input_size = sizeof(input) / sizeof(*input);
-    convert_pattern_to_wchar_range_result ret = convert_pattern_to_wchar_range(input, input + input_size, NULL);
-    assert_continue(ret.type == CONVERT_PATTERN_WCHAR_ERROR);
-    assert_continue(ret.value.offending_location == input);
-  }
-  { // error from incomplete multibyte
-    const char input[] = {0xE2, 0x9C};
-    size_t input_size = sizeof(input) / sizeof(*input);
-    convert_pattern_to_wchar_range_result ret = convert_pattern_to_wchar_range(input, input + input_size, NULL);
-    assert_continue(ret.type == CONVERT_PATTERN_WCHAR_ERROR);
-    assert_continue(ret.value.offending_location == input);
-  }
-  { // same as above, but at a different position
-    const char input[] = {'a', 0xE2, 0x9C};
-    size_t input_size = sizeof(input) / sizeof(*input);
-    const wchar_t expected_output[] = {L'a', 0};
-    size_t expected_output_size = sizeof(expected_output) / sizeof(*expected_output);
-    wchar_t output[expected_output_size];
-    memset(output, 0, sizeof(output));
-    convert_pattern_to_wchar_range_result ret = convert_pattern_to_wchar_range(input, input + input_size, output);
-    assert_continue(ret.type == CONVERT_PATTERN_WCHAR_ERROR);
-    assert_continue(ret.value.offending_location == input + 1);
-    assert_continue(0 == memcmp(expected_output, output, expected_output_size));
-  }
-  if (has_errors) {
-    return has_errors;
-  }
-  { // empty input output
-    assert_continue(NULL == convert_subject_to_wchar_range(NULL, NULL, false, NULL, NULL, false));
-    assert_continue(NULL == convert_subject_to_wchar_range(NULL, NULL, true, NULL, NULL, false));
+    utf8_decode_state ps;
+    memset(&ps, 0, sizeof(ps));
+    assert_continue(NULL == convert_subject_to_wchar_range(NULL, NULL, false, &ps, NULL, false));
+    assert_continue(NULL == convert_subject_to_wchar_range(NULL, NULL, true, &ps, NULL, false));
   }
   { // simple (including null)
-    mbstate_t ps;
+    utf8_decode_state ps;
     memset(&ps, 0, sizeof(ps));
     const char input[] = {'a', 0, 'a'};
     size_t input_size = sizeof(input) / sizeof(*input);
@@ -83,7 +27,7 @@ int main(void) {
     assert_continue(0 == memcmp(expected_output, output, expected_output_size));
   }
   { // retained state between calls
-    mbstate_t ps;
+    utf8_decode_state ps;
     memset(&ps, 0, sizeof(ps));
     {
       const char input[] = {0xE2, 0x9C};
@@ -100,7 +44,7 @@ int main(void) {
     }
   }
   { // decode error
-    mbstate_t ps;
+    utf8_decode_state ps;
     memset(&ps, 0, sizeof(ps));
     const char input[] = {0xFF, 0xFF, 'a'};
     size_t input_size = sizeof(input) / sizeof(*input);
@@ -112,7 +56,7 @@ int main(void) {
     assert_continue(0 == memcmp(expected_output, output, expected_output_size));
   }
   { // decode error - skipped
-    mbstate_t ps;
+    utf8_decode_state ps;
     memset(&ps, 0, sizeof(ps));
     const char input[] = {0xFF, 0xFF, 'a'};
     size_t input_size = sizeof(input) / sizeof(*input);
@@ -124,7 +68,7 @@ int main(void) {
     assert_continue(0 == memcmp(expected_output, output, expected_output_size));
   }
   { // incomplete multibyte at end of input
-    mbstate_t ps;
+    utf8_decode_state ps;
     memset(&ps, 0, sizeof(ps));
     const char input[] = {0xE2, 0x9C};
     size_t input_size = sizeof(input) / sizeof(*input);
@@ -136,7 +80,7 @@ int main(void) {
     assert_continue(0 == memcmp(expected_output, output, expected_output_size));
   }
   { // incomplete multibyte at end of input - skipped
-    mbstate_t ps;
+    utf8_decode_state ps;
     memset(&ps, 0, sizeof(ps));
     const char input[] = {0xE2, 0x9C};
     size_t input_size = sizeof(input) / sizeof(*input);
@@ -147,5 +91,233 @@ int main(void) {
     assert_continue(output + expected_output_size - 1 == convert_subject_to_wchar_range(input, input + input_size, true, &ps, output, true));
     assert_continue(0 == memcmp(expected_output, output, expected_output_size));
   }
+  { // long ascii run with multibyte in the middle (vectorized path)
+    utf8_decode_state ps;
+    memset(&ps, 0, sizeof(ps));
+    const char input[] = "0123456789abcdefghijklmnopqrstuvwxyz\xE2\x9C\x93" "ABCDEFGHIJKLMNOPQRSTUVWXYZ\xF0\x9F\x98\x80!";
+    size_t input_size = sizeof(input) - 1;
+    const wchar_t expected_output[] = L"0123456789abcdefghijklmnopqrstuvwxyz\u2713ABCDEFGHIJKLMNOPQRSTUVWXYZ\U0001F600!";
+    size_t expected_output_size = sizeof(expected_output) / sizeof(*expected_output) - 1;
+    wchar_t output[input_size];
+    assert_continue(output + expected_output_size == convert_subject_to_wchar_range(input, input + input_size, true, &ps, output, false));
+    assert_continue(0 == wmemcmp(expected_output, output, expected_output_size));
+  }
+  { // overlong, surrogate, and out of range are each invalid per byte
+    utf8_decode_state ps;
+    memset(&ps, 0, sizeof(ps));
+    const char input[] = {0xC0, 0x80, 0xED, 0xA0, 0x80, 0xF4, 0x90, 0x80, 0x80, 'a'};
+    size_t input_size = sizeof(input) / sizeof(*input);
+    wchar_t output[input_size];
+    assert_continue(output + input_size == convert_subject_to_wchar_range(input, input + input_size, true, &ps, output, false));
+    for (size_t i = 0; i < input_size - 1; ++i) {
+      assert_continue(output[i] == L'\uFFFF');
+    }
+    assert_continue(output[input_size - 1] == L'a');
+  }
+  { // retained state, then invalid continuation. same as a single call
+    utf8_decode_state ps;
+    memset(&ps, 0, sizeof(ps));
+    const char input[] = {0xE2, 0x9C, 'a'};
+    wchar_t output[3];
+    wchar_t* out = convert_subject_to_wchar_range(input, input + 2, false, &ps, output, false);
+    assert_continue(out == output);
+    out = convert_subject_to_wchar_range(input + 2, input + 3, false, &ps, out, false);
+    assert_continue(out == output + 3);
+    assert_continue(output[0] == L'\uFFFF');
+    assert_continue(output[1] == L'\uFFFF');
+    assert_continue(output[2] == L'a');
+  }
+  { // retained state, then end of input
+    utf8_decode_state ps;
+    memset(&ps, 0, sizeof(ps));
+    const char input[] = {0xF0, 0x9F};
+    wchar_t output[2];
+    assert_continue(output == convert_subject_to_wchar_range(input, input + 2, false, &ps, output, false));
+    assert_continue(output + 2 == convert_subject_to_wchar_range(NULL, NULL, true, &ps, output, false));
+    assert_continue(output[0] == L'\uFFFF');
+    assert_continue(output[1] == L'\uFFFF');
+  }
+  { // any split of the input gives the same output as mbrtowc on the whole
+    const char* input = "ab\xC3\xA9\xE2\x9C\x93\xF0\x9F\x98\x80\x80\xC3z\xE2\x9C" "0123456789abcdefghij\xC3\xA9\xFF";
+    size_t input_size = strlen(input);
+
+    wchar_t expected[input_size];
+    size_t expected_size = 0;
+    {
+      mbstate_t mbs;
+      memset(&mbs, 0, sizeof(mbs));
+      const char* pos = input;
+      const char* end = input + input_size;
+      while (pos != end) {
+        size_t r = mbrtowc(expected + expected_size, pos, end - pos, &mbs);
+        if (r == (size_t)-1 || r == (size_t)-2) {
+          expected[expected_size++] = L'\uFFFF';
+          pos += 1;
+          memset(&mbs, 0, sizeof(mbs));
+        } else {
+          expected_size += 1;
+          pos += r == 0 ? 1 : r;
+        }
+      }
+    }
+
+    for (size_t split1 = 0; split1 <= input_size; ++split1) {
+      for (size_t split2 = split1; split2 <= input_size; ++split2) {
+        utf8_decode_state ps;
+        memset(&ps, 0, sizeof(ps));
+        wchar_t output[input_size];
+        wchar_t* out = output;
+        out = convert_subject_to_wchar_range(input, input + split1, false, &ps, out, false);
+        out = convert_subject_to_wchar_range(input + split1, input + split2, false, &ps, out, false);
+        out = convert_subject_to_wchar_range(input + split2, input + input_size, true, &ps, out, false);
+        assert_continue((size_t)(out - output) == expected_size);
+        assert_continue(0 == wmemcmp(expected, output, expected_size));
+      }
+    }
+  }
+  { // multibyte runs longer than a block (validated by the vectorized kernels)
+    const char piece[] = "h\xC3\xA9\xE2\x9C\x93\xF0\x9F\x98\x80";
+    const wchar_t expected_piece[] = L"h\u00E9\u2713\U0001F600";
+    enum { NUM_PIECES = 40, PIECE_SIZE = sizeof(piece) - 1, EXPECTED_PIECE_SIZE = sizeof(expected_piece) / sizeof(*expected_piece) - 1 };
+    char input[NUM_PIECES * PIECE_SIZE];
+    for (size_t i = 0; i < NUM_PIECES; ++i) {
+      memcpy(input + i * PIECE_SIZE, piece, PIECE_SIZE);
+    }
+    utf8_decode_state ps;
+    memset(&ps, 0, sizeof(ps));
+    wchar_t output[sizeof(input)];
+    assert_continue(output + NUM_PIECES * EXPECTED_PIECE_SIZE == convert_subject_to_wchar_range(input, input + sizeof(input), true, &ps, output, false));
+    for (size_t i = 0; i < NUM_PIECES; ++i) {
+      assert_continue(0 == wmemcmp(expected_piece, output + i * EXPECTED_PIECE_SIZE, EXPECTED_PIECE_SIZE));
+    }
+#if __SIZEOF_WCHAR_T__ == 4
+    if (code_unit_kernels.isa >= CODE_UNIT_ISA_AVX2) {
+      // the kernel decodes the valid multibyte blocks itself
+      wchar_t* out = output;
+      const unsigned char* decoded = code_unit_kernels.utf8_decode((const unsigned char*)input, (const unsigned char*)input + sizeof(input), &out);
+      assert_continue(decoded > (const unsigned char*)input + sizeof(input) - 32);
+      assert_continue(0 == wmemcmp(expected_piece, output, EXPECTED_PIECE_SIZE));
+    }
+#endif
+  }
+  { // invalid bytes among long multibyte runs, with any split of the input.
+    // each invalid byte is a noncharacter, as decoded one sequence at a time
+    const char* pieces[] = {
+        "\xE0\x80\x80", // overlong
+        "\xED\xA0\x80", // surrogate
+        "\xF4\x90\x80\x80", // past U+10FFFF
+        "\xC0\xAF", // overlong
+        "\x80", // stray continuation
+        "\xE2\x9C" "a", // cut off
+        "\xF5", // not a lead
+    };
+    const char* valid = "\xC3\xA9\xE2\x9C\x93\xF0\x9F\x98\x80xyz\xC3\xA9\xE2\x9C\x93\xF0\x9F\x98\x80";
+    char input[512];
+    size_t input_size = 0;
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(*pieces); ++i) {
+      // the invalid bytes are put at a different offset in each block
+      for (size_t j = 0; j <= i; ++j) {
+        input[input_size++] = 'a';
+      }
+      memcpy(input + input_size, valid, strlen(valid));
+      input_size += strlen(valid);
+      memcpy(input + input_size, pieces[i], strlen(pieces[i]));
+      input_size += strlen(pieces[i]);
+    }
+    assert_continue(input_size <= sizeof(input));
+
+    wchar_t expected[sizeof(input)];
+    size_t expected_size = 0;
+    for (const unsigned char* pos = (const unsigned char*)input; pos != (const unsigned char*)input + input_size;) {
+      uint_fast32_t ch;
+      size_t len;
+      if (utf8_decode_one(pos, (const unsigned char*)input + input_size, &ch, &len) == UTF8_DECODE_OK) {
+        expected[expected_size++] = ch;
+        pos += len;
+      } else {
+        expected[expected_size++] = L'\uFFFF';
+        pos += 1;
+      }
+    }
+
+    for (size_t split = 0; split <= input_size; ++split) {
+      utf8_decode_state ps;
+      memset(&ps, 0, sizeof(ps));
+      wchar_t output[sizeof(input)];
+      wchar_t* out = output;
+      out = convert_subject_to_wchar_range(input, input + split, false, &ps, out, false);
+      out = convert_subject_to_wchar_range(input + split, input + input_size, true, &ps, out, false);
+      assert_continue((size_t)(out - output) == expected_size);
+      assert_continue(0 == wmemcmp(expected, output, expected_size));
+    }
+  }
+}
+
+int main(void) {
+  { // empty input output
+    convert_pattern_to_wchar_range_result ret = convert_pattern_to_wchar_range(NULL, NULL, NULL);
+    assert_continue(ret.type == CONVERT_PATTERN_WCHAR_OK);
+    assert_continue(ret.value.out_end == NULL);
+  }
+  { // includes null
+    const char input[] = {'a', 'b', '\0', 'w'};
+    size_t input_size = sizeof(input) / sizeof(*input);
+    const wchar_t expected_output[] = {L'a', L'b', L'\0', L'w', 0};
+    size_t expected_output_size = sizeof(expected_output) / sizeof(*expected_output);
+    wchar_t output[expected_output_size];
+    memset(output, 0, sizeof(output));
+    convert_pattern_to_wchar_range_result ret = convert_pattern_to_wchar_range(input, input + input_size, output);
+    assert_continue(ret.type == CONVERT_PATTERN_WCHAR_OK);
+    assert_continue(ret.value.out_end == output + input_size);
+    assert_continue(0 == memcmp(expected_output, output, expected_output_size));
+  }
+  { // simple utf8 conversion. fits in utf16 or utf32
+    const char input[] = {0xE2, 0x9C, 0x93};
+    size_t input_size = sizeof(input) / sizeof(*input);
+    const wchar_t expected_output[] = {L'✓', 0};
+    size_t expected_output_size = sizeof(expected_output) / sizeof(*expected_output);
+    wchar_t output[expected_output_size];
+    memset(output, 0, sizeof(output));
+    convert_pattern_to_wchar_range_result ret = convert_pattern_to_wchar_range(input, input + input_size, output);
+    assert_continue(ret.type == CONVERT_PATTERN_WCHAR_OK);
+    assert_continue(ret.value.out_end == output + 1);
+    assert_continue(0 == memcmp(expected_output, output, expected_output_size));
+  }
+  { // error from bad utf8
+    const char input[] = {0xFF};
+    size_t input_size = sizeof(input) / sizeof(*input);
+    convert_pattern_to_wchar_range_result ret = convert_pattern_to_wchar_range(input, input + input_size, NULL);
+    assert_continue(ret.type == CONVERT_PATTERN_WCHAR_ERROR);
+    assert_continue(ret.value.offending_location == input);
+  }
+  { // error from incomplete multibyte
+    const char input[] = {0xE2, 0x9C};
+    size_t input_size = sizeof(input) / sizeof(*input);
+    convert_pattern_to_wchar_range_result ret = convert_pattern_to_wchar_range(input, input + input_size, NULL);
+    assert_continue(ret.type == CONVERT_PATTERN_WCHAR_ERROR);
+    assert_continue(ret.value.offending_location == input);
+  }
+  { // same as above, but at a different position
+    const char input[] = {'a', 0xE2, 0x9C};
+    size_t input_size = sizeof(input) / sizeof(*input);
+    const wchar_t expected_output[] = {L'a', 0};
+    size_t expected_output_size = sizeof(expected_output) / sizeof(*expected_output);
+    wchar_t output[expected_output_size];
+    memset(output, 0, sizeof(output));
+    convert_pattern_to_wchar_range_result ret = convert_pattern_to_wchar_range(input, input + input_size, output);
+    assert_continue(ret.type == CONVERT_PATTERN_WCHAR_ERROR);
+    assert_continue(ret.value.offending_location == input + 1);
+    assert_continue(0 == memcmp(expected_output, output, expected_output_size));
+  }
+  if (has_errors) {
+    return has_errors;
+  }
+  // the reference decoding uses mbrtowc, regardless of the environment
+  assert_continue(setlocale(LC_ALL, "C.UTF-8") != NULL);
+  // every variant which the cpu supports
+  for (int limit = CODE_UNIT_ISA_SCALAR; limit <= CODE_UNIT_ISA_AVX512BW; ++limit) {
+    code_unit_dispatch((code_unit_isa)limit);
+    test_subject_decoding();
+  }
   return has_errors;
 }
@@ -407,6 +407,29 @@ int main(void) {
     assert_continue(array_output[1].offset == 0);
     assert_continue(array_output[1].value.symbol_value_lookup == 0);
   }
+#ifdef USE_UTF8
+  { // a literal is one code point, spanning several code units
+    const CODE_UNIT* expr = CODE_UNIT_LITERAL("'\xC3\xA9'");
+    arith_token array_output[2];
+    memset(array_output, 0, sizeof(array_output));
+
+    token_exp_no_sym(expr, expr + code_unit_strlen(expr), array_output);
+    assert_continue(array_output[0].type == ARITH_U32);
+    assert_continue(array_output[0].offset == 0);
+    assert_continue(array_output[0].value.u32 == 0xE9);
+    assert_continue(array_output[1].type == ARITH_INVALID);
+  }
+  {
+    const CODE_UNIT* expr = CODE_UNIT_LITERAL("'\xC3'");
+    arith_token array_output[2];
+    memset(array_output, 0, sizeof(array_output));
+
+    arith_tokenize_capacity ret = token_exp_no_sym(expr, expr + code_unit_strlen(expr), array_output);
+    assert_continue(ret.type == ARITH_TOKENIZE_CAPACITY_ERROR);
+    assert_continue(ret.value.err.offset == 1);
+    assert_continue(0 == strcmp(ret.value.err.reason, "literal is not valid utf-8"));
+  }
+#endif
   {
     const CODE_UNIT* expr = CODE_UNIT_LITERAL("'\\z");
     arith_token array_output[2];
@@ -339,6 +339,7 @@ int main(void) {
     assert_continue(0 == strcmp(cap.reason, "hex content overlong. expecting '}'"));
     assert_continue(cap.offset == 11);
   }
+#ifndef USE_UTF8
   {
     const CODE_UNIT* program = CODE_UNIT_LITERAL("\\x{aaaaaaaa}");
     expr_tokenize_arg arg = expr_tokenize_arg_init(program, program + code_unit_strlen(program));
@@ -373,6 +374,37 @@ int main(void) {
     assert_continue(tokens[0].offset == 0);
     assert_continue(tokens[0].value.literal == (CODE_UNIT)0xaa);
   }
+#else
+  { // in utf-8 mode, the hex value is a code point which must be encodable
+    const CODE_UNIT* program = CODE_UNIT_LITERAL("\\x{aaaaaaaa}");
+    expr_tokenize_arg arg = expr_tokenize_arg_init(program, program + code_unit_strlen(program));
+    expr_tokenize_result cap = tokenize_expression(&arg);
+    assert_continue(0 == strcmp(cap.reason, "hex value is not an encodable code point"));
+    assert_continue(cap.offset == 0);
+  }
+  { // in utf-8 mode, the hex value is matched as its encoded sequence
+    const CODE_UNIT* program = CODE_UNIT_LITERAL("a\\x{e9}");
+    expr_tokenize_arg arg = expr_tokenize_arg_init(program, program + code_unit_strlen(program));
+    expr_tokenize_result cap = tokenize_expression(&arg);
+    assert_continue(cap.reason == NULL);
+    size_t output_size = expr_tokenize_arg_get_cap(&arg);
+    assert_continue(output_size == 3);
+    expr_token tokens[output_size];
+    expr_tokenize_arg_set_to_fill(&arg, tokens);
+    cap = tokenize_expression(&arg);
+    assert_continue(cap.reason == NULL);
+    assert_continue((size_t)(arg.out - tokens) == output_size);
+
+    assert_continue(tokens[0].type == EXPR_TOKEN_LITERAL);
+    assert_continue(tokens[0].value.literal == 'a');
+    assert_continue(tokens[1].type == EXPR_TOKEN_LITERAL);
+    assert_continue(tokens[1].offset == 1);
+    assert_continue(tokens[1].value.literal == (CODE_UNIT)0xC3);
+    assert_continue(tokens[2].type == EXPR_TOKEN_LITERAL);
+    assert_continue(tokens[2].offset == 1);
+    assert_continue(tokens[2].value.literal == (CODE_UNIT)0xA9);
+  }
+#endif
   if (has_errors) return has_errors;
 
   { // marker
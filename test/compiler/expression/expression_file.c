@@ -0,0 +1,119 @@
+#include "compiler/expression/expression_file.h"
+#include "compiler/expression/expression_match.h"
+
+#include "test_common.h"
+#include "test_expression.h"
+extern int has_errors;
+
+#define MAX_FILE 4096
+
+// the number of matches in the subject, and the end of the last one
+static size_t count_matches(const expression_pattern* pattern, const CODE_UNIT* subject, size_t* last_end) {
+  size_t subject_len = code_unit_strlen(subject);
+  size_t capacity = expression_pattern_min_capacity(pattern);
+  if (capacity < subject_len) capacity = subject_len;
+  CODE_UNIT subject_buffer[capacity];
+  subject_buffer_state buf;
+#ifdef USE_WCHAR
+  init_subject_buffer(&buf, capacity, NULL, subject_buffer, pattern->max_lookbehind_characters);
+#else
+  init_subject_buffer(&buf, capacity, subject_buffer, pattern->max_lookbehind_characters);
+#endif
+  memcpy(subject_buffer, subject, subject_len * sizeof(CODE_UNIT));
+  buf.size = subject_len;
+  buf.offset = 0;
+  bool input_complete = true;
+  size_t ret = 0;
+  size_t begin;
+  while (expression_match(pattern, &buf, &input_complete, &begin)) {
+    *last_end = buf.offset;
+    ++ret;
+  }
+  return ret;
+}
+
+static char file[MAX_FILE] __attribute__((aligned(FUNCTION_DATA_CACHE_LINE)));
+
+int main() {
+  init_definitions();
+
+  { // the pattern read from the file matches the same as the compiled one
+    const CODE_UNIT* subject = CODE_UNIT_LITERAL("a1bcd_xa2bcd_a33bcd{0}");
+    compiled_pattern compiled;
+    assert_continue(compile(CODE_UNIT_LITERAL("{0}a{arith,c-'0'<10}{str,bcd}{1}"), &compiled));
+    size_t file_size = expression_file_size(compiled.presetup_info, compiled.num_elements);
+    assert_continue(file_size <= MAX_FILE);
+    expression_file_write(file, compiled.presetup_info, compiled.num_elements, compiled.data, &compiled.setup_result);
+    interpret_setup_result setup_result = compiled.setup_result;
+    memset(&compiled, 0, sizeof(compiled)); // not used from here
+
+    expression_file_read_result result = expression_file_read(file, file_size, num_functions, definitions, NULL);
+    assert_continue(result.reason == NULL);
+    assert_continue(result.num_elements == 5);
+    function_setup_info elements[result.num_elements];
+    result = expression_file_read(file, file_size, num_functions, definitions, elements);
+    assert_continue(result.reason == NULL);
+    assert_continue((const char*)result.data >= file && (const char*)result.data < file + file_size);
+    assert_continue(result.setup_result.value.ok.max_size_characters == setup_result.value.ok.max_size_characters);
+    assert_continue(result.setup_result.value.ok.max_lookbehind_characters == setup_result.value.ok.max_lookbehind_characters);
+    assert_continue(elements[1].definition == function_definition_for_literal());
+    assert_continue(elements[2].definition->opcode == FUNCTION_OPCODE_ARITH);
+    // the markers are kept
+    assert_continue(elements[0].begin_marker.present && elements[0].begin_marker.marker_number == 0);
+    assert_continue(!elements[1].begin_marker.present && !elements[1].end_marker.present);
+    assert_continue(elements[4].begin_marker.present && elements[4].begin_marker.marker_number == 1);
+
+    expression_op program[result.num_elements];
+    expression_pattern pattern;
+    assert_continue(init_expression_pattern(&pattern, elements, result.num_elements, result.data, &result.setup_result, program));
+    assert_continue(pattern.num_markers == 2);
+    size_t last_end = 0;
+    assert_continue(count_matches(&pattern, subject, &last_end) == 2);
+    assert_continue(last_end == 12);
+  }
+  { // invalid files
+    compiled_pattern compiled;
+    assert_continue(compile(CODE_UNIT_LITERAL("ab{str,cd}"), &compiled));
+    size_t file_size = expression_file_size(compiled.presetup_info, compiled.num_elements);
+    expression_file_write(file, compiled.presetup_info, compiled.num_elements, compiled.data, &compiled.setup_result);
+    assert_continue(expression_file_read(file, file_size, num_functions, definitions, NULL).reason == NULL);
+
+    // truncated
+    assert_continue(expression_file_read(file, file_size - 1, num_functions, definitions, NULL).reason != NULL);
+    assert_continue(expression_file_read(file, 4, num_functions, definitions, NULL).reason != NULL);
+
+    // another version
+    expression_file_header header;
+    memcpy(&header, file, sizeof(header));
+    expression_file_header changed = header;
+    changed.version += 1;
+    memcpy(file, &changed, sizeof(changed));
+    assert_continue(expression_file_read(file, file_size, num_functions, definitions, NULL).reason != NULL);
+
+    // another code unit width
+    changed = header;
+    changed.code_unit_size += 1;
+    memcpy(file, &changed, sizeof(changed));
+    assert_continue(expression_file_read(file, file_size, num_functions, definitions, NULL).reason != NULL);
+
+    // not a pattern file
+    changed = header;
+    changed.magic[0] = 'x';
+    memcpy(file, &changed, sizeof(changed));
+    assert_continue(expression_file_read(file, file_size, num_functions, definitions, NULL).reason != NULL);
+    memcpy(file, &header, sizeof(header));
+
+    // str isn't registered
+    function_definition without_str[1] = {*function_definition_for_arith()};
+    function_setup_info elements[MAX_TOKENS];
+    assert_continue(expression_file_read(file, file_size, 1, without_str, elements).reason != NULL);
+
+    // str is registered, but isn't the built-in
+    function_definition other_str[1] = {*function_definition_for_str()};
+    other_str[0].opcode = FUNCTION_OPCODE_CALL;
+    assert_continue(expression_file_read(file, file_size, 1, other_str, elements).reason != NULL);
+
+    assert_continue(expression_file_read(file, file_size, num_functions, definitions, elements).reason == NULL);
+  }
+  return has_errors;
+}
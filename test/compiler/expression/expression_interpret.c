@@ -30,6 +30,7 @@ int main() {
     presetup_arg.error_msg_output = NULL;
     presetup_arg.functions = function_definition_for_literal();
     presetup_arg.num_function = 1;
+    presetup_arg.registry = NULL;
     presetup_arg.presetup_info_output = presetup_info;
 
     interpret_presetup_result presetup_result = interpret_presetup(&presetup_arg);
@@ -37,7 +38,7 @@ int main() {
     assert_continue(presetup_result.success);
     assert_continue(presetup_result.value.data_size_bytes == sizeof(CODE_UNIT) * 4);
 
-    char data[presetup_result.value.data_size_bytes];
+    char data[presetup_result.value.data_size_bytes] __attribute__((aligned(FUNCTION_DATA_CACHE_LINE)));
 
     interpret_setup_arg setup_arg;
     setup_arg.begin = tokens;
@@ -88,6 +89,7 @@ int main() {
     presetup_arg.error_msg_output = NULL;
     presetup_arg.functions = function_definition_for_literal();
     presetup_arg.num_function = 1;
+    presetup_arg.registry = NULL;
     presetup_arg.presetup_info_output = presetup_info;
 
     interpret_presetup_arg presetup_arg_copy = presetup_arg;
@@ -132,6 +134,7 @@ int main() {
     function_definition_sort(definitions, num_functions);
     presetup_arg.functions = definitions;
     presetup_arg.num_function = num_functions;
+    presetup_arg.registry = NULL;
     presetup_arg.presetup_info_output = presetup_info;
 
     interpret_presetup_arg presetup_arg_copy = presetup_arg;
@@ -174,12 +177,13 @@ int main() {
     function_definition_sort(definitions, num_functions);
     presetup_arg.functions = definitions;
     presetup_arg.num_function = num_functions;
+    presetup_arg.registry = NULL;
     presetup_arg.presetup_info_output = presetup_info;
 
     interpret_presetup_result presetup_result = interpret_presetup(&presetup_arg);
     assert_continue(presetup_result.success);
 
-    char data[presetup_result.value.data_size_bytes];
+    char data[presetup_result.value.data_size_bytes] __attribute__((aligned(FUNCTION_DATA_CACHE_LINE)));
 
     interpret_setup_arg setup_arg;
     setup_arg.begin = tokens;
@@ -229,6 +233,7 @@ int main() {
     function_definition_sort(definitions, num_functions);
     presetup_arg.functions = definitions;
     presetup_arg.num_function = num_functions;
+    presetup_arg.registry = NULL;
     presetup_arg.presetup_info_output = presetup_info;
 
     interpret_presetup_arg presetup_arg_copy = presetup_arg;
@@ -243,6 +248,438 @@ int main() {
     assert_continue(0 == code_unit_strcmp(error_msg, msg));
     assert_continue(presetup_result.value.err.offset == 14);
   }
+  { // str entrypoint, finding an incomplete match at the end of the segment
+    const CODE_UNIT* program = CODE_UNIT_LITERAL("{str,abab}");
+    expr_tokenize_arg arg = expr_tokenize_arg_init(program, program + code_unit_strlen(program));
+    expr_tokenize_result cap = tokenize_expression(&arg);
+    assert_continue(cap.reason == NULL);
+    size_t output_size = expr_tokenize_arg_get_cap(&arg);
+    expr_token tokens[output_size];
+    expr_tokenize_arg_set_to_fill(&arg, tokens);
+    cap = tokenize_expression(&arg);
+    assert_continue(cap.reason == NULL);
+
+    size_t num_function_calls = interpret_presetup_get_number_of_function_calls(tokens, tokens + output_size);
+    function_setup_info presetup_info[num_function_calls];
+    interpret_presetup_arg presetup_arg;
+    presetup_arg.begin = tokens;
+    presetup_arg.end = tokens + output_size;
+    presetup_arg.error_msg_output = NULL;
+    function_definition definitions[2] = {
+      *function_definition_for_literal(),
+      *function_definition_for_str()
+    };
+    size_t num_functions = sizeof(definitions) / sizeof(*definitions);
+    function_definition_sort(definitions, num_functions);
+    presetup_arg.functions = definitions;
+    presetup_arg.num_function = num_functions;
+    presetup_arg.registry = NULL;
+    presetup_arg.presetup_info_output = presetup_info;
+    interpret_presetup_result presetup_result = interpret_presetup(&presetup_arg);
+    assert_continue(presetup_result.success);
+
+    char data[presetup_result.value.data_size_bytes] __attribute__((aligned(FUNCTION_DATA_CACHE_LINE)));
+    interpret_setup_arg setup_arg;
+    setup_arg.begin = tokens;
+    setup_arg.data = data;
+    setup_arg.end = tokens + output_size;
+    setup_arg.error_msg_output = NULL;
+    setup_arg.presetup_info = presetup_info;
+    interpret_setup_result setup_result = interpret_setup(&setup_arg);
+    assert_continue(setup_result.success);
+    assert_continue(setup_result.value.ok.max_size_characters == 4);
+
+    const function_definition* str = function_definition_for_str();
+    const CODE_UNIT* subject = CODE_UNIT_LITERAL("xabababxaba");
+    size_t subject_len = code_unit_strlen(subject);
+    CODE_UNIT subject_buffer[subject_len];
+    subject_buffer_state buf;
+#ifdef USE_WCHAR
+    init_subject_buffer(&buf, subject_len, NULL, subject_buffer, 0);
+#else
+    init_subject_buffer(&buf, subject_len, subject_buffer, 0);
+#endif
+    memcpy(subject_buffer, subject, subject_len * sizeof(CODE_UNIT));
+    buf.size = subject_len;
+    buf.offset = 0;
+    size_t match_begin;
+    assert_continue(str->entrypoint_interpret(&buf, data, presetup_result.value.data_size_bytes, &match_begin) == MATCH_SUCCESS);
+    assert_continue(buf.offset == 5);
+    assert_continue(match_begin == 1);
+    // the longest incomplete match
+    assert_continue(str->entrypoint_interpret(&buf, data, presetup_result.value.data_size_bytes, &match_begin) == MATCH_INCOMPLETE);
+    assert_continue(buf.offset == 8);
+  }
+  { // each element's data is aligned, and kept within a cache line if it fits
+    assert_continue(function_data_offset(0, 0) == 0);
+    assert_continue(function_data_offset(3, 1) == 3);
+    assert_continue(function_data_offset(3, 2) == 4);
+    assert_continue(function_data_offset(1, 4) == 4);
+    assert_continue(function_data_offset(9, 7) == 16);
+    assert_continue(function_data_offset(17, 100) == 32);
+    assert_continue(function_data_offset(60, 8) == 64);
+    assert_continue(function_data_offset(48, 16) == 48);
+    assert_continue(function_data_offset(48, 17) == 64);
+  }
+  { // each registered function is found in the registry, and nothing else is
+    enum { NUM_FUNCTIONS = 300 };
+    static CODE_UNIT names[NUM_FUNCTIONS][3];
+    static function_definition functions[NUM_FUNCTIONS];
+    for (size_t i = 0; i < NUM_FUNCTIONS; ++i) {
+      names[i][0] = 'f';
+      names[i][1] = 'a' + i % 26;
+      names[i][2] = 'a' + i / 26;
+      functions[i] = *function_definition_for_str();
+      functions[i].name.begin = names[i];
+      functions[i].name.end = names[i] + 3;
+    }
+    functions[NUM_FUNCTIONS - 1] = *function_definition_for_empty(); // empty name
+    uint32_t seeds[NUM_FUNCTIONS];
+    uint32_t slots[NUM_FUNCTIONS];
+    static size_t work[FUNCTION_REGISTRY_WORK_SIZE(NUM_FUNCTIONS)];
+    function_registry registry;
+    assert_continue(init_function_registry(&registry, functions, NUM_FUNCTIONS, seeds, slots, work));
+    for (size_t i = 0; i < NUM_FUNCTIONS; ++i) {
+      assert_continue(function_registry_lookup(&registry, functions[i].name) == &functions[i]);
+    }
+    const CODE_UNIT* missing = CODE_UNIT_LITERAL("fzzz");
+    expr_token_string_range name = {missing, missing + 4};
+    assert_continue(function_registry_lookup(&registry, name) == NULL);
+    name.end = missing + 2;
+    assert_continue(function_registry_lookup(&registry, name) == NULL);
+
+    // same name twice
+    functions[1].name = functions[0].name;
+    assert_continue(!init_function_registry(&registry, functions, NUM_FUNCTIONS, seeds, slots, work));
+
+    assert_continue(init_function_registry(&registry, functions, 0, seeds, slots, work));
+    assert_continue(function_registry_lookup(&registry, name) == NULL);
+  }
+  { // presetup with a registry
+    const CODE_UNIT* program = CODE_UNIT_LITERAL("{0}{str,ab}{arith,c=c}");
+    expr_tokenize_arg arg = expr_tokenize_arg_init(program, program + code_unit_strlen(program));
+    assert_continue(tokenize_expression(&arg).reason == NULL);
+    size_t num_tokens = expr_tokenize_arg_get_cap(&arg);
+    expr_token tokens[num_tokens];
+    expr_tokenize_arg_set_to_fill(&arg, tokens);
+    tokenize_expression(&arg);
+
+    function_definition definitions[] = {
+      *function_definition_for_str(),
+      *function_definition_for_arith(),
+      *function_definition_for_empty()
+    }; // not sorted
+    size_t num_functions = sizeof(definitions) / sizeof(*definitions);
+    uint32_t seeds[num_functions];
+    uint32_t slots[num_functions];
+    size_t work[FUNCTION_REGISTRY_WORK_SIZE(num_functions)];
+    function_registry registry;
+    assert_continue(init_function_registry(&registry, definitions, num_functions, seeds, slots, work));
+
+    size_t num_function_calls = interpret_presetup_get_number_of_function_calls(tokens, tokens + num_tokens);
+    function_setup_info presetup_info[num_function_calls];
+    interpret_presetup_arg presetup_arg;
+    presetup_arg.begin = tokens;
+    presetup_arg.end = tokens + num_tokens;
+    presetup_arg.num_function = 0;
+    presetup_arg.functions = NULL;
+    presetup_arg.registry = &registry;
+    presetup_arg.presetup_info_output = presetup_info;
+    presetup_arg.error_msg_output = NULL;
+    assert_continue(interpret_presetup(&presetup_arg).success);
+    assert_continue(presetup_arg.presetup_info_output - presetup_info == 3);
+    assert_continue(presetup_info[0].definition == &definitions[2]);
+    assert_continue(presetup_info[1].definition == &definitions[0]);
+    assert_continue(presetup_info[2].definition == &definitions[1]);
+  }
+  { // runs of literals at the top level are coalesced into str
+    const CODE_UNIT* program = CODE_UNIT_LITERAL("abc{0}d{str,ef}gh{arith,c=c}");
+    expr_tokenize_arg arg = expr_tokenize_arg_init(program, program + code_unit_strlen(program));
+    assert_continue(tokenize_expression(&arg).reason == NULL);
+    size_t num_literal_tokens = expr_tokenize_arg_get_cap(&arg);
+    expr_token literal_tokens[num_literal_tokens];
+    expr_tokenize_arg_set_to_fill(&arg, literal_tokens);
+    tokenize_expression(&arg);
+
+    size_t num_tokens = expr_coalesce_literals(literal_tokens, literal_tokens + num_literal_tokens, function_definition_for_str()->name, NULL);
+    assert_continue(num_tokens == num_literal_tokens + 4);
+    expr_token tokens[num_tokens];
+    assert_continue(expr_coalesce_literals(literal_tokens, literal_tokens + num_literal_tokens, function_definition_for_str()->name, tokens) == num_tokens);
+
+    // {str,abc}
+    assert_continue(tokens[0].type == EXPR_TOKEN_FUNCTION);
+    assert_continue(tokens[0].offset == 0);
+    assert_continue(tokens[0].value.function.num_args == 1);
+    assert_continue(!tokens[0].value.function.begin_marker.present);
+    assert_continue(0 == code_unit_range_cmp(tokens[0].value.function.name.begin, tokens[0].value.function.name.end, //
+                                             function_definition_for_str()->name.begin, function_definition_for_str()->name.end));
+    assert_continue(tokens[1].type == EXPR_TOKEN_LITERAL && tokens[1].value.literal == 'a');
+    assert_continue(tokens[3].type == EXPR_TOKEN_LITERAL && tokens[3].value.literal == 'c');
+    assert_continue(tokens[4].type == EXPR_TOKEN_ENDARG);
+    // {0}, then d alone is left as a literal
+    assert_continue(tokens[5].type == EXPR_TOKEN_FUNCTION && tokens[5].value.function.begin_marker.present);
+    assert_continue(tokens[6].type == EXPR_TOKEN_LITERAL && tokens[6].value.literal == 'd');
+    // the arguments aren't changed
+    assert_continue(tokens[7].type == EXPR_TOKEN_FUNCTION);
+    assert_continue(tokens[8].type == EXPR_TOKEN_LITERAL && tokens[9].type == EXPR_TOKEN_LITERAL);
+    assert_continue(tokens[10].type == EXPR_TOKEN_ENDARG);
+    // {str,gh}
+    assert_continue(tokens[11].type == EXPR_TOKEN_FUNCTION && tokens[11].offset == 15);
+    assert_continue(tokens[14].type == EXPR_TOKEN_ENDARG);
+    assert_continue(tokens[15].type == EXPR_TOKEN_FUNCTION);
+    assert_continue(tokens[num_tokens - 1].type == EXPR_TOKEN_ENDARG);
+
+    function_definition definitions[] = {
+      *function_definition_for_arith(),
+      *function_definition_for_empty(),
+      *function_definition_for_str()
+    };
+    size_t num_functions = sizeof(definitions) / sizeof(*definitions);
+    function_definition_sort(definitions, num_functions);
+    size_t num_function_calls = interpret_presetup_get_number_of_function_calls(tokens, tokens + num_tokens);
+    function_setup_info presetup_info[num_function_calls];
+    interpret_presetup_arg presetup_arg;
+    presetup_arg.begin = tokens;
+    presetup_arg.end = tokens + num_tokens;
+    presetup_arg.num_function = num_functions;
+    presetup_arg.registry = NULL;
+    presetup_arg.functions = definitions;
+    presetup_arg.presetup_info_output = presetup_info;
+    presetup_arg.error_msg_output = NULL;
+    assert_continue(interpret_presetup(&presetup_arg).success);
+    assert_continue(presetup_arg.presetup_info_output - presetup_info == 6);
+    assert_continue(presetup_info[2].definition == function_definition_for_literal());
+  }
+
+  { // arith setup moves past its argument, to the next function
+    const CODE_UNIT* program = CODE_UNIT_LITERAL("{arith,c='x'}y");
+    expr_tokenize_arg arg = expr_tokenize_arg_init(program, program + code_unit_strlen(program));
+    expr_tokenize_result cap = tokenize_expression(&arg);
+    assert_continue(cap.reason == NULL);
+    size_t output_size = expr_tokenize_arg_get_cap(&arg);
+    expr_token tokens[output_size];
+    expr_tokenize_arg_set_to_fill(&arg, tokens);
+    cap = tokenize_expression(&arg);
+    assert_continue(cap.reason == NULL);
+
+    size_t num_function_calls = interpret_presetup_get_number_of_function_calls(tokens, tokens + output_size);
+    function_setup_info presetup_info[num_function_calls];
+    interpret_presetup_arg presetup_arg;
+    presetup_arg.begin = tokens;
+    presetup_arg.end = tokens + output_size;
+    presetup_arg.error_msg_output = NULL;
+    function_definition definitions[2] = {
+      *function_definition_for_literal(),
+      *function_definition_for_arith()
+    };
+    size_t num_functions = sizeof(definitions) / sizeof(*definitions);
+    function_definition_sort(definitions, num_functions);
+    presetup_arg.functions = definitions;
+    presetup_arg.num_function = num_functions;
+    presetup_arg.registry = NULL;
+    presetup_arg.presetup_info_output = presetup_info;
+    interpret_presetup_result presetup_result = interpret_presetup(&presetup_arg);
+    assert_continue(presetup_result.success);
+    assert_continue(presetup_arg.presetup_info_output == presetup_info + 2);
+
+    char data[presetup_result.value.data_size_bytes] __attribute__((aligned(FUNCTION_DATA_CACHE_LINE)));
+    const expr_token* function_start = tokens;
+    const function_setup_info* info = presetup_info;
+    function_setup_result result = function_definition_for_arith()->setup(&function_start, &info, data, presetup_info[0].function_data_size);
+    assert_continue(result.success);
+    assert_continue(function_start == tokens + output_size - 1); // at y
+    assert_continue(info == presetup_info + 1);
+  }
+
+  { // arith interprets its own expression
+    const CODE_UNIT* program = CODE_UNIT_LITERAL("{arith,c='x'}");
+    expr_tokenize_arg arg = expr_tokenize_arg_init(program, program + code_unit_strlen(program));
+    expr_tokenize_result cap = tokenize_expression(&arg);
+    assert_continue(cap.reason == NULL);
+    size_t output_size = expr_tokenize_arg_get_cap(&arg);
+    expr_token tokens[output_size];
+    expr_tokenize_arg_set_to_fill(&arg, tokens);
+    cap = tokenize_expression(&arg);
+    assert_continue(cap.reason == NULL);
+
+    size_t num_function_calls = interpret_presetup_get_number_of_function_calls(tokens, tokens + output_size);
+    function_setup_info presetup_info[num_function_calls];
+    interpret_presetup_arg presetup_arg;
+    presetup_arg.begin = tokens;
+    presetup_arg.end = tokens + output_size;
+    presetup_arg.error_msg_output = NULL;
+    function_definition definitions[2] = {
+      *function_definition_for_literal(),
+      *function_definition_for_arith()
+    };
+    size_t num_functions = sizeof(definitions) / sizeof(*definitions);
+    function_definition_sort(definitions, num_functions);
+    presetup_arg.functions = definitions;
+    presetup_arg.num_function = num_functions;
+    presetup_arg.registry = NULL;
+    presetup_arg.presetup_info_output = presetup_info;
+    interpret_presetup_result presetup_result = interpret_presetup(&presetup_arg);
+    assert_continue(presetup_result.success);
+
+    char data[presetup_result.value.data_size_bytes] __attribute__((aligned(FUNCTION_DATA_CACHE_LINE)));
+    interpret_setup_arg setup_arg;
+    setup_arg.begin = tokens;
+    setup_arg.data = data;
+    setup_arg.end = tokens + output_size;
+    setup_arg.error_msg_output = NULL;
+    setup_arg.presetup_info = presetup_info;
+    interpret_setup_result setup_result = interpret_setup(&setup_arg);
+    assert_continue(setup_result.success);
+
+    const function_definition* arith = function_definition_for_arith();
+    char byte_buffer[3];
+    subject_buffer_state buf;
+#ifdef USE_WCHAR
+    wchar_t character_buffer[3];
+    init_subject_buffer(&buf, 3, byte_buffer, character_buffer, 0);
+#else
+    init_subject_buffer(&buf, 3, byte_buffer, 0);
+#endif
+    buf.size = 3;
+    buf.offset = 0;
+    memcpy(subject_buffer_start(&buf), CODE_UNIT_LITERAL("xyx"), 3 * sizeof(CODE_UNIT));
+    assert_continue(arith->interpret(&buf, data, presetup_result.value.data_size_bytes) == MATCH_SUCCESS);
+    assert_continue(buf.offset == 1);
+    assert_continue(arith->interpret(&buf, data, presetup_result.value.data_size_bytes) == MATCH_FAILURE);
+    assert_continue(buf.offset == 2);
+    assert_continue(arith->interpret(&buf, data, presetup_result.value.data_size_bytes) == MATCH_SUCCESS);
+    assert_continue(arith->interpret(&buf, data, presetup_result.value.data_size_bytes) == MATCH_INCOMPLETE);
+  }
+
+#ifdef USE_UTF8
+  { // arith decodes the code point at each position
+    const CODE_UNIT* program = CODE_UNIT_LITERAL("{arith,c='\xC3\xA9'}");
+    expr_tokenize_arg arg = expr_tokenize_arg_init(program, program + code_unit_strlen(program));
+    expr_tokenize_result cap = tokenize_expression(&arg);
+    assert_continue(cap.reason == NULL);
+    size_t output_size = expr_tokenize_arg_get_cap(&arg);
+    expr_token tokens[output_size];
+    expr_tokenize_arg_set_to_fill(&arg, tokens);
+    cap = tokenize_expression(&arg);
+    assert_continue(cap.reason == NULL);
+
+    size_t num_function_calls = interpret_presetup_get_number_of_function_calls(tokens, tokens + output_size);
+    function_setup_info presetup_info[num_function_calls];
+    interpret_presetup_arg presetup_arg;
+    presetup_arg.begin = tokens;
+    presetup_arg.end = tokens + output_size;
+    presetup_arg.error_msg_output = NULL;
+    function_definition definitions[2] = {
+      *function_definition_for_literal(),
+      *function_definition_for_arith()
+    };
+    size_t num_functions = sizeof(definitions) / sizeof(*definitions);
+    function_definition_sort(definitions, num_functions);
+    presetup_arg.functions = definitions;
+    presetup_arg.num_function = num_functions;
+    presetup_arg.registry = NULL;
+    presetup_arg.presetup_info_output = presetup_info;
+    interpret_presetup_result presetup_result = interpret_presetup(&presetup_arg);
+    assert_continue(presetup_result.success);
+
+    char data[presetup_result.value.data_size_bytes] __attribute__((aligned(FUNCTION_DATA_CACHE_LINE)));
+    interpret_setup_arg setup_arg;
+    setup_arg.begin = tokens;
+    setup_arg.data = data;
+    setup_arg.end = tokens + output_size;
+    setup_arg.error_msg_output = NULL;
+    setup_arg.presetup_info = presetup_info;
+    interpret_setup_result setup_result = interpret_setup(&setup_arg);
+    assert_continue(setup_result.success);
+    assert_continue(setup_result.value.ok.max_size_characters == 4);
+
+    const function_definition* arith = function_definition_for_arith();
+    const char subject[] = "a\xE2\x9C\x93\xC3\xA9" "b\xC3";
+    size_t subject_len = sizeof(subject) - 1;
+    char byte_buffer[subject_len];
+    subject_buffer_state buf;
+    init_subject_buffer(&buf, subject_len, byte_buffer, 0);
+    memcpy(byte_buffer, subject, subject_len);
+    buf.size = subject_len;
+    buf.offset = 0;
+    // found after the 3 byte character, not within it
+    size_t match_begin;
+    assert_continue(arith->entrypoint_interpret(&buf, data, presetup_result.value.data_size_bytes, &match_begin) == MATCH_SUCCESS);
+    assert_continue(match_begin == 4 && buf.offset == 6);
+    // the trailing byte begins an incomplete character
+    assert_continue(arith->entrypoint_interpret(&buf, data, presetup_result.value.data_size_bytes, &match_begin) == MATCH_INCOMPLETE);
+    assert_continue(buf.offset == 7);
+    buf.offset = 4;
+    assert_continue(arith->interpret(&buf, data, presetup_result.value.data_size_bytes) == MATCH_SUCCESS);
+    assert_continue(buf.offset == 6);
+    assert_continue(arith->interpret(&buf, data, presetup_result.value.data_size_bytes) == MATCH_FAILURE);
+    buf.offset = 7;
+    assert_continue(arith->interpret(&buf, data, presetup_result.value.data_size_bytes) == MATCH_INCOMPLETE);
+  }
+#endif
+
+#if !defined(USE_WCHAR) && !defined(USE_UTF8)
+  for (size_t variant = 0; variant < 2; ++variant) { // arith searches for a small set of code units
+    // the first is true for three code units, and the second for too many
+    const CODE_UNIT* program = variant == 0 ? CODE_UNIT_LITERAL("{arith,c-'a'<3}") : CODE_UNIT_LITERAL("{arith,c-'a'<30}");
+    expr_tokenize_arg arg = expr_tokenize_arg_init(program, program + code_unit_strlen(program));
+    expr_tokenize_result cap = tokenize_expression(&arg);
+    assert_continue(cap.reason == NULL);
+    size_t output_size = expr_tokenize_arg_get_cap(&arg);
+    expr_token tokens[output_size];
+    expr_tokenize_arg_set_to_fill(&arg, tokens);
+    cap = tokenize_expression(&arg);
+    assert_continue(cap.reason == NULL);
+
+    size_t num_function_calls = interpret_presetup_get_number_of_function_calls(tokens, tokens + output_size);
+    function_setup_info presetup_info[num_function_calls];
+    interpret_presetup_arg presetup_arg;
+    presetup_arg.begin = tokens;
+    presetup_arg.end = tokens + output_size;
+    presetup_arg.error_msg_output = NULL;
+    function_definition definitions[2] = {
+      *function_definition_for_literal(),
+      *function_definition_for_arith()
+    };
+    size_t num_functions = sizeof(definitions) / sizeof(*definitions);
+    function_definition_sort(definitions, num_functions);
+    presetup_arg.functions = definitions;
+    presetup_arg.num_function = num_functions;
+    presetup_arg.registry = NULL;
+    presetup_arg.presetup_info_output = presetup_info;
+    interpret_presetup_result presetup_result = interpret_presetup(&presetup_arg);
+    assert_continue(presetup_result.success);
+
+    char data[presetup_result.value.data_size_bytes] __attribute__((aligned(FUNCTION_DATA_CACHE_LINE)));
+    interpret_setup_arg setup_arg;
+    setup_arg.begin = tokens;
+    setup_arg.data = data;
+    setup_arg.end = tokens + output_size;
+    setup_arg.error_msg_output = NULL;
+    setup_arg.presetup_info = presetup_info;
+    interpret_setup_result setup_result = interpret_setup(&setup_arg);
+    assert_continue(setup_result.success);
+    assert_continue(setup_result.value.ok.max_size_characters == 1);
+    assert_continue(((function_definition_arith_data*)data)->use_set == (variant == 0));
+
+    const function_definition* arith = function_definition_for_arith();
+    const char subject[] = "XYZ#c__________________________________b#";
+    size_t subject_len = sizeof(subject) - 1;
+    char subject_buffer[subject_len];
+    subject_buffer_state buf;
+    init_subject_buffer(&buf, subject_len, subject_buffer, 0);
+    memcpy(subject_buffer, subject, subject_len);
+    buf.size = subject_len;
+    buf.offset = 0;
+    size_t match_begin;
+    assert_continue(arith->entrypoint_interpret(&buf, data, presetup_result.value.data_size_bytes, &match_begin) == MATCH_SUCCESS);
+    assert_continue(match_begin == 4 && buf.offset == 5);
+    assert_continue(arith->entrypoint_interpret(&buf, data, presetup_result.value.data_size_bytes, &match_begin) == MATCH_SUCCESS);
+    assert_continue(match_begin == subject_len - 2 && buf.offset == subject_len - 1);
+    assert_continue(arith->entrypoint_interpret(&buf, data, presetup_result.value.data_size_bytes, &match_begin) == MATCH_FAILURE);
+    assert_continue(buf.offset == subject_len);
+  }
+#endif
 
   return has_errors;
 }
\ No newline at end of file
@@ -0,0 +1,346 @@
+#include "compiler/expression/expression_match.h"
+
+#include "test_common.h"
+#include "test_expression.h"
+extern int has_errors;
+
+#define MAX_MATCHES 16
+
+// each match as its position within the subject. returns the number of matches
+static size_t match_all(const expression_pattern* pattern, const CODE_UNIT* subject, size_t capacity, uint64_t* begins, uint64_t* ends) {
+  subject_source source = {subject, code_unit_strlen(subject)};
+  CODE_UNIT subject_buffer[capacity];
+  subject_buffer_state buf;
+  init_subject_buffer_callback(&buf, capacity, subject_buffer, pattern->max_lookbehind_characters, give_subject, &source);
+  bool input_complete = subject_buffer_get_first_input(&buf);
+  size_t num_matches = 0;
+  size_t begin;
+  while (num_matches < MAX_MATCHES && expression_match(pattern, &buf, &input_complete, &begin)) {
+    begins[num_matches] = buf.stream_offset + begin;
+    ends[num_matches] = buf.stream_offset + buf.offset;
+    ++num_matches;
+  }
+  deinit_subject_buffer(&buf);
+  return num_matches;
+}
+
+// the same as match_all, with an iterator
+static size_t iterate_all(const expression_pattern* pattern, const CODE_UNIT* subject, size_t capacity, bool overlapping, uint64_t* begins, uint64_t* ends) {
+  subject_source source = {subject, code_unit_strlen(subject)};
+  CODE_UNIT subject_buffer[capacity];
+  subject_buffer_state buf;
+  init_subject_buffer_callback(&buf, capacity, subject_buffer, pattern->max_lookbehind_characters, give_subject, &source);
+  expression_match_iterator it;
+  init_expression_match_iterator(&it, pattern, &buf, subject_buffer_get_first_input(&buf), overlapping);
+  size_t num_matches = 0;
+  while (num_matches < MAX_MATCHES && expression_match_next(&it, &begins[num_matches], &ends[num_matches])) {
+    ++num_matches;
+  }
+  deinit_subject_buffer(&buf);
+  return num_matches;
+}
+
+// the number of matches, and whether there's any
+static uint64_t count_all(const expression_pattern* pattern, const CODE_UNIT* subject, size_t capacity, bool* exists) {
+  subject_source source = {subject, code_unit_strlen(subject)};
+  CODE_UNIT subject_buffer[capacity];
+  subject_buffer_state buf;
+  init_subject_buffer_callback(&buf, capacity, subject_buffer, pattern->max_lookbehind_characters, give_subject, &source);
+  bool input_complete = subject_buffer_get_first_input(&buf);
+  *exists = expression_match_exists(pattern, &buf, &input_complete);
+  deinit_subject_buffer(&buf);
+
+  source.subject = subject;
+  source.remaining = code_unit_strlen(subject);
+  init_subject_buffer_callback(&buf, capacity, subject_buffer, pattern->max_lookbehind_characters, give_subject, &source);
+  uint64_t ret = expression_match_count(pattern, &buf, subject_buffer_get_first_input(&buf));
+  deinit_subject_buffer(&buf);
+  return ret;
+}
+
+// the same as match_all, read from a file with the given content. a file
+// read with USE_WCHAR gives fewer characters than bytes
+static size_t match_file(const expression_pattern* pattern, const char* content, size_t capacity, uint64_t* begins, uint64_t* ends) {
+  FILE* f = tmpfile();
+  assert(f != NULL);
+  fputs(content, f);
+  fflush(f);
+  rewind(f);
+  char byte_buffer[capacity];
+  subject_buffer_state buf;
+#ifdef USE_WCHAR
+  wchar_t character_buffer[capacity];
+  init_subject_buffer(&buf, capacity, byte_buffer, character_buffer, pattern->max_lookbehind_characters);
+#else
+  init_subject_buffer(&buf, capacity, byte_buffer, pattern->max_lookbehind_characters);
+#endif
+  buf.input_file = f;
+  bool input_complete = subject_buffer_get_first_input(&buf);
+  size_t num_matches = 0;
+  size_t begin;
+  while (num_matches < MAX_MATCHES && expression_match(pattern, &buf, &input_complete, &begin)) {
+    begins[num_matches] = buf.stream_offset + begin;
+    ends[num_matches] = buf.stream_offset + buf.offset;
+    ++num_matches;
+  }
+  deinit_subject_buffer(&buf);
+  fclose(f);
+  return num_matches;
+}
+
+// the matches are the same for every buffer capacity, and from the iterator
+static void check_matches_with(const CODE_UNIT* program, const CODE_UNIT* subject, bool overlapping, size_t num_expected, const uint64_t* expected_begins, const uint64_t* expected_ends) {
+  compiled_pattern compiled;
+  assert_continue(compile(program, &compiled));
+  size_t min_capacity = expression_pattern_min_capacity(&compiled.pattern);
+  for (size_t capacity = min_capacity; capacity < min_capacity + 20; ++capacity) {
+    for (int iterator = overlapping; iterator < 2; ++iterator) {
+      uint64_t begins[MAX_MATCHES];
+      uint64_t ends[MAX_MATCHES];
+      size_t num_matches = iterator ? iterate_all(&compiled.pattern, subject, capacity, overlapping, begins, ends)
+                                    : match_all(&compiled.pattern, subject, capacity, begins, ends);
+      assert_continue(num_matches == num_expected);
+      for (size_t i = 0; i < num_matches && i < num_expected; ++i) {
+        assert_continue(begins[i] == expected_begins[i]);
+        assert_continue(ends[i] == expected_ends[i]);
+      }
+    }
+    if (!overlapping) {
+      bool exists;
+      assert_continue(count_all(&compiled.pattern, subject, capacity, &exists) == num_expected);
+      assert_continue(exists == (num_expected != 0));
+    }
+  }
+}
+
+static void check_matches(const CODE_UNIT* program, const CODE_UNIT* subject, size_t num_expected, const uint64_t* expected_begins, const uint64_t* expected_ends) {
+  check_matches_with(program, subject, false, num_expected, expected_begins, expected_ends);
+}
+
+int main() {
+  init_definitions();
+  { // literals
+    uint64_t begins[] = {3, 8, 14};
+    uint64_t ends[] = {6, 11, 17};
+    check_matches(CODE_UNIT_LITERAL("abc"), CODE_UNIT_LITERAL("xababc__abcabxabc"), 3, begins, ends);
+  }
+  { // a single literal
+    uint64_t begins[] = {0, 2, 3, 7};
+    uint64_t ends[] = {1, 3, 4, 8};
+    check_matches(CODE_UNIT_LITERAL("a"), CODE_UNIT_LITERAL("abaa___a"), 4, begins, ends);
+  }
+  { // a candidate overlaps the next one
+    uint64_t begins[] = {2};
+    uint64_t ends[] = {5};
+    check_matches(CODE_UNIT_LITERAL("aab"), CODE_UNIT_LITERAL("aaaab"), 1, begins, ends);
+  }
+  { // str entrypoint, then the rest
+    uint64_t begins[] = {4, 14};
+    uint64_t ends[] = {10, 20};
+    check_matches(CODE_UNIT_LITERAL("{str,abab}x{arith,c-'0'<10}"), CODE_UNIT_LITERAL("ababababx1____ababx5"), 2, begins, ends);
+  }
+  { // marker before the entrypoint element
+    uint64_t begins[] = {4};
+    uint64_t ends[] = {6};
+    check_matches(CODE_UNIT_LITERAL("{0}ab{1}"), CODE_UNIT_LITERAL("aaaaab"), 1, begins, ends);
+  }
+  { // the most selective element searches, and the elements before it are
+    // matched in reverse
+    compiled_pattern compiled;
+    assert_continue(compile(CODE_UNIT_LITERAL("{arith,c-'a'<26}{str,ERROR}"), &compiled));
+    assert_continue(compiled.pattern.entry == 1);
+    uint64_t begins[] = {3, 14};
+    uint64_t ends[] = {9, 20};
+    check_matches(CODE_UNIT_LITERAL("{arith,c-'a'<26}{str,ERROR}"), CODE_UNIT_LITERAL("ERRxERRORERRORyERRORS ERROR"), 2, begins, ends);
+  }
+  { // a match doesn't overlap the previous one
+    uint64_t begins[] = {0, 7};
+    uint64_t ends[] = {4, 11};
+    check_matches(CODE_UNIT_LITERAL("{arith,c-'a'<26}{str,xyz}"), CODE_UNIT_LITERAL("axyzxyzbxyz"), 2, begins, ends);
+  }
+  { // the most selective element, regardless of position
+    compiled_pattern compiled;
+    assert_continue(compile(CODE_UNIT_LITERAL("ab{str,zzzz}"), &compiled));
+    assert_continue(compiled.pattern.entry == 1); // ab is coalesced
+    assert_continue(compile(CODE_UNIT_LITERAL("{0}z{1}"), &compiled));
+    assert_continue(compiled.pattern.entry == 1);
+  }
+  { // built-in ops and a function called through its definition match the same
+    compiled_pattern compiled;
+    assert_continue(compile(CODE_UNIT_LITERAL("{0}a{str,bc}{arith,c='d'}{str_call,e}"), &compiled));
+    assert_continue(compiled.pattern.num_elements == 5);
+    assert_continue(compiled.pattern.program[0].opcode == FUNCTION_OPCODE_EMPTY);
+    assert_continue(compiled.pattern.program[1].opcode == FUNCTION_OPCODE_LITERAL);
+    assert_continue(compiled.pattern.program[2].opcode == FUNCTION_OPCODE_STR);
+    assert_continue(compiled.pattern.program[3].opcode == FUNCTION_OPCODE_ARITH);
+    assert_continue(compiled.pattern.program[4].opcode == FUNCTION_OPCODE_CALL);
+    uint64_t begins[] = {2, 8};
+    uint64_t ends[] = {7, 13};
+    check_matches(CODE_UNIT_LITERAL("{str_call,ab}c{str_call,de}"), CODE_UNIT_LITERAL("__abcde_abcdeabcd"), 2, begins, ends);
+    check_matches(CODE_UNIT_LITERAL("{str,ab}c{str,de}"), CODE_UNIT_LITERAL("__abcde_abcdeabcd"), 2, begins, ends);
+  }
+  { // the data can be used from a copy
+    compiled_pattern compiled;
+    assert_continue(compile(CODE_UNIT_LITERAL("{str,abc}{arith,c-'0'<10}{str,de}"), &compiled));
+    for (size_t i = 0; i < compiled.pattern.num_elements; ++i) {
+      assert_continue(compiled.presetup_info[i].function_data_offset % sizeof(size_t) == 0);
+    }
+    static char copy[MAX_DATA + FUNCTION_DATA_CACHE_LINE] __attribute__((aligned(FUNCTION_DATA_CACHE_LINE)));
+    char* data = copy + FUNCTION_DATA_ALIGNMENT; // at a different offset within a cache line
+    memcpy(data, compiled.data, sizeof(compiled.data) - FUNCTION_DATA_ALIGNMENT);
+    memset(compiled.data, 0, sizeof(compiled.data));
+    interpret_setup_result setup_result;
+    setup_result.success = true;
+    setup_result.value.ok.max_size_characters = compiled.pattern.max_size_characters;
+    setup_result.value.ok.max_lookbehind_characters = 0;
+    expression_pattern pattern;
+    assert_continue(init_expression_pattern(&pattern, compiled.presetup_info, compiled.pattern.num_elements, data, &setup_result, compiled.program));
+    const CODE_UNIT* subject = CODE_UNIT_LITERAL("abc1deabcxdeabc99de_abc7de");
+    uint64_t begins[MAX_MATCHES];
+    uint64_t ends[MAX_MATCHES];
+    size_t capacity = expression_pattern_min_capacity(&pattern);
+    assert_continue(match_all(&pattern, subject, capacity, begins, ends) == 2);
+    assert_continue(begins[0] == 0 && ends[0] == 6);
+    assert_continue(begins[1] == 20 && ends[1] == 26);
+  }
+  { // overlapping matches
+    uint64_t begins[] = {0, 1, 2, 5};
+    uint64_t ends[] = {2, 3, 4, 7};
+    check_matches_with(CODE_UNIT_LITERAL("aa"), CODE_UNIT_LITERAL("aaaa_aa"), true, 4, begins, ends);
+  }
+  { // overlapping, with elements before and after the entrypoint element
+    uint64_t begins[] = {0, 3, 6};
+    uint64_t ends[] = {4, 7, 10};
+    check_matches_with(CODE_UNIT_LITERAL("{arith,c-'0'<10}{str,xx}{arith,c-'0'<10}"), CODE_UNIT_LITERAL("1xx2xx3xx4"), true, 3, begins, ends);
+  }
+  { // markers, as positions in the entire input
+    compiled_pattern compiled;
+    assert_continue(compile(CODE_UNIT_LITERAL("x{0+1str1-1,abcd}y{2}"), &compiled));
+    assert_continue(compiled.pattern.num_markers == 3);
+    const CODE_UNIT* subject = CODE_UNIT_LITERAL("__xabcdy_xabcdyxabcd");
+    size_t min_capacity = expression_pattern_min_capacity(&compiled.pattern);
+    for (size_t capacity = min_capacity; capacity < min_capacity + 20; ++capacity) {
+      subject_source source = {subject, code_unit_strlen(subject)};
+      CODE_UNIT subject_buffer[capacity];
+      subject_buffer_state buf;
+      init_subject_buffer_callback(&buf, capacity, subject_buffer, compiled.pattern.max_lookbehind_characters, give_subject, &source);
+      expression_match_iterator it;
+      init_expression_match_iterator(&it, &compiled.pattern, &buf, subject_buffer_get_first_input(&buf), false);
+      uint64_t markers[3];
+      it.markers = markers;
+      uint64_t begin, end;
+      assert_continue(expression_match_next(&it, &begin, &end));
+      assert_continue(begin == 2 && end == 8);
+      assert_continue(markers[0] == 4 && markers[1] == 6 && markers[2] == 8);
+      assert_continue(expression_match_next(&it, &begin, &end));
+      assert_continue(begin == 9 && end == 15);
+      assert_continue(markers[0] == 11 && markers[1] == 13 && markers[2] == 15);
+      assert_continue(!expression_match_next(&it, &begin, &end));
+      deinit_subject_buffer(&buf);
+    }
+  }
+  { // the earliest marker of a match is retained while searching for the next
+    compiled_pattern compiled;
+    assert_continue(compile(CODE_UNIT_LITERAL("{0str,ab}c"), &compiled));
+    const CODE_UNIT* subject = CODE_UNIT_LITERAL("_____abc_____abc___");
+    size_t capacity = 12;
+    assert_continue(capacity >= expression_pattern_min_capacity(&compiled.pattern));
+    for (int pin = 0; pin < 2; ++pin) {
+      subject_source source = {subject, code_unit_strlen(subject)};
+      CODE_UNIT subject_buffer[capacity];
+      subject_buffer_state buf;
+      init_subject_buffer_callback(&buf, capacity, subject_buffer, compiled.pattern.max_lookbehind_characters, give_subject, &source);
+      // the first segment doesn't reach the second match
+      assert_continue(capacity < code_unit_strlen(subject));
+      expression_match_iterator it;
+      init_expression_match_iterator(&it, &compiled.pattern, &buf, subject_buffer_get_first_input(&buf), false);
+      uint64_t markers[1];
+      it.markers = markers;
+      it.pin_markers = pin;
+      uint64_t begin, end;
+      assert_continue(expression_match_next(&it, &begin, &end));
+      assert_continue(markers[0] == 5);
+      assert_continue(buf.pin == (pin ? 5 : SUBJECT_BUFFER_NO_PIN));
+      assert_continue(expression_match_next(&it, &begin, &end));
+      assert_continue(begin == 13 && markers[0] == 13);
+      if (pin) {
+        // the first match is still there
+        assert_continue(buf.stream_offset == 5);
+        assert_continue(subject_buffer_start(&buf)[0] == 'a');
+      } else {
+        assert_continue(buf.stream_offset > 5);
+      }
+      deinit_subject_buffer(&buf);
+    }
+  }
+  { // multibyte input from a file, from the minimum capacity
+    compiled_pattern compiled;
+    assert_continue(compile(CODE_UNIT_LITERAL("ab"), &compiled));
+    size_t min_capacity = expression_pattern_min_capacity(&compiled.pattern);
+    for (size_t capacity = min_capacity; capacity < min_capacity + 8; ++capacity) {
+      uint64_t begins[MAX_MATCHES];
+      uint64_t ends[MAX_MATCHES];
+      assert_continue(match_file(&compiled.pattern, "a\xF0\x9F\x98\x80" "ab\xF0\x9F\x98\x80\xF0\x9F\x98\x80" "ab", capacity, begins, ends) == 2);
+#ifdef USE_WCHAR
+      assert_continue(begins[0] == 2 && ends[0] == 4);
+      assert_continue(begins[1] == 6 && ends[1] == 8);
+#else
+      assert_continue(begins[0] == 5 && ends[0] == 7);
+      assert_continue(begins[1] == 15 && ends[1] == 17);
+#endif
+    }
+#if defined(USE_WCHAR) || defined(USE_UTF8)
+    assert_continue(compile(CODE_UNIT_LITERAL("a{arith,c>4096}"), &compiled));
+    min_capacity = expression_pattern_min_capacity(&compiled.pattern);
+    for (size_t capacity = min_capacity; capacity < min_capacity + 8; ++capacity) {
+      uint64_t begins[MAX_MATCHES];
+      uint64_t ends[MAX_MATCHES];
+      size_t num_matches = match_file(&compiled.pattern, "a\xF0\x9F\x98\x80", capacity, begins, ends);
+#ifdef USE_WCHAR
+      assert_continue(num_matches == 1 && begins[0] == 0 && ends[0] == 2);
+#else
+      assert_continue(num_matches == 1 && begins[0] == 0 && ends[0] == 5);
+#endif
+    }
+#endif
+  }
+#ifdef USE_UTF8
+  { // a candidate of a multibyte code point begins at its lead byte, even
+    // though the continuation bytes before the end match on their own
+    uint64_t begins[] = {1, 6};
+    uint64_t ends[] = {5, 9};
+    check_matches(CODE_UNIT_LITERAL("{arith,c>4096}"), CODE_UNIT_LITERAL("x\xF0\x9F\x98\x80" "y\xE2\x9C\x93"), 2, begins, ends);
+  }
+  { // a lone continuation byte is still a candidate on its own
+    uint64_t begins[] = {1};
+    uint64_t ends[] = {2};
+    check_matches(CODE_UNIT_LITERAL("{arith,c>4096}"), CODE_UNIT_LITERAL("x\x80y"), 1, begins, ends);
+  }
+#endif
+  { // a variable length entrypoint element, called through its definition.
+    // the candidate begins where the entrypoint found it, not where a shorter
+    // match would end at the same place
+    uint64_t begins[] = {1, 7};
+    uint64_t ends[] = {6, 11};
+    check_matches(CODE_UNIT_LITERAL("a{digits}b"), CODE_UNIT_LITERAL("xa123b_a12b_a1234b_"), 2, begins, ends);
+  }
+  { // no match
+    check_matches(CODE_UNIT_LITERAL("abc"), CODE_UNIT_LITERAL("ababab"), 0, NULL, NULL);
+    check_matches(CODE_UNIT_LITERAL("abc"), CODE_UNIT_LITERAL(""), 0, NULL, NULL);
+  }
+  { // nothing to search for
+    compiled_pattern compiled;
+    assert_continue(!compile(CODE_UNIT_LITERAL("{0}"), &compiled));
+  }
+  { // the guaranteed length path gives the same result as the checked one
+    compiled_pattern compiled;
+    assert_continue(compile(CODE_UNIT_LITERAL("a{str,bc}d"), &compiled));
+    const CODE_UNIT* subject = CODE_UNIT_LITERAL("abcdabcxabcd______________");
+    uint64_t begins[MAX_MATCHES];
+    uint64_t ends[MAX_MATCHES];
+    assert_continue(match_all(&compiled.pattern, subject, code_unit_strlen(subject), begins, ends) == 2);
+    assert_continue(begins[0] == 0 && ends[0] == 4);
+    assert_continue(begins[1] == 8 && ends[1] == 12);
+  }
+  return has_errors;
+}
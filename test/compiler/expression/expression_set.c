@@ -0,0 +1,156 @@
+#include "compiler/expression/expression_set.h"
+
+#include "test_common.h"
+#include "test_expression.h"
+extern int has_errors;
+
+#define MAX_PATTERNS 8
+#define MAX_MATCHES 32
+
+// the matches of each pattern, as positions within the subject
+typedef struct {
+  size_t num_matches[MAX_PATTERNS];
+  uint64_t begins[MAX_PATTERNS][MAX_MATCHES];
+  uint64_t ends[MAX_PATTERNS][MAX_MATCHES];
+} set_matches;
+
+static void record_match(void* ctx, size_t pattern, const subject_buffer_state* buf, size_t begin) {
+  set_matches* matches = (set_matches*)ctx;
+  size_t i = matches->num_matches[pattern]++;
+  assert(i < MAX_MATCHES);
+  matches->begins[pattern][i] = buf->stream_offset + begin;
+  matches->ends[pattern][i] = buf->stream_offset + buf->offset;
+}
+
+static void match_set(const expression_set* set, const CODE_UNIT* subject, size_t capacity, set_matches* matches) {
+  memset(matches, 0, sizeof(*matches));
+  subject_source source = {subject, code_unit_strlen(subject)};
+  CODE_UNIT subject_buffer[capacity];
+  subject_buffer_state buf;
+  init_subject_buffer_callback(&buf, capacity, subject_buffer, set->max_lookbehind_characters, give_subject, &source);
+  bool input_complete = subject_buffer_get_first_input(&buf);
+  size_t num_matches = expression_set_match(set, &buf, input_complete, record_match, matches);
+  size_t total = 0;
+  for (size_t i = 0; i < set->num_patterns; ++i) {
+    total += matches->num_matches[i];
+  }
+  assert_continue(num_matches == total);
+  deinit_subject_buffer(&buf);
+}
+
+// the same matches as each pattern on its own
+static void match_each(const expression_pattern* patterns, size_t num_patterns, const CODE_UNIT* subject, set_matches* matches) {
+  memset(matches, 0, sizeof(*matches));
+  size_t subject_len = code_unit_strlen(subject);
+  for (size_t i = 0; i < num_patterns; ++i) {
+    size_t capacity = expression_pattern_min_capacity(&patterns[i]) + subject_len;
+    CODE_UNIT subject_buffer[capacity];
+    subject_buffer_state buf;
+    subject_source source = {subject, subject_len};
+    init_subject_buffer_callback(&buf, capacity, subject_buffer, patterns[i].max_lookbehind_characters, give_subject, &source);
+    bool input_complete = subject_buffer_get_first_input(&buf);
+    size_t begin;
+    while (expression_match(&patterns[i], &buf, &input_complete, &begin)) {
+      record_match(matches, i, &buf, begin);
+    }
+    deinit_subject_buffer(&buf);
+  }
+}
+
+// the set gives the same matches as each pattern on its own, for every buffer
+// capacity
+static void check_set(const CODE_UNIT* const* programs, size_t num_patterns, const CODE_UNIT* subject, size_t num_unanchored) {
+  static compiled_pattern compiled[MAX_PATTERNS];
+  static expression_pattern patterns[MAX_PATTERNS];
+  for (size_t i = 0; i < num_patterns; ++i) {
+    if (!compile(programs[i], &compiled[i])) {
+      assert_continue(false);
+      return;
+    }
+    patterns[i] = compiled[i].pattern;
+  }
+
+  expression_set_node nodes[expression_set_max_nodes(patterns, num_patterns)];
+  uint32_t next_output[num_patterns];
+  uint32_t unanchored[num_patterns];
+  expression_set set;
+  init_expression_set(&set, patterns, num_patterns, nodes, next_output, unanchored);
+  assert_continue(set.num_unanchored == num_unanchored);
+
+  set_matches expected;
+  match_each(patterns, num_patterns, subject, &expected);
+  size_t min_capacity = expression_set_min_capacity(&set);
+  for (size_t capacity = min_capacity; capacity < min_capacity + 20; ++capacity) {
+    set_matches actual;
+    match_set(&set, subject, capacity, &actual);
+    for (size_t i = 0; i < num_patterns; ++i) {
+      assert_continue(actual.num_matches[i] == expected.num_matches[i]);
+      for (size_t j = 0; j < actual.num_matches[i] && j < expected.num_matches[i]; ++j) {
+        assert_continue(actual.begins[i][j] == expected.begins[i][j]);
+        assert_continue(actual.ends[i][j] == expected.ends[i][j]);
+      }
+    }
+  }
+}
+
+int main() {
+  init_definitions();
+  { // needles which are suffixes and prefixes of each other
+    const CODE_UNIT* programs[] = {
+        CODE_UNIT_LITERAL("abc"),
+        CODE_UNIT_LITERAL("bc"),
+        CODE_UNIT_LITERAL("c"),
+        CODE_UNIT_LITERAL("abcabc"),
+        CODE_UNIT_LITERAL("cab"),
+    };
+    check_set(programs, 5, CODE_UNIT_LITERAL("xabcabcabcab_cabc_bcab"), 0);
+  }
+  { // the same needle in many patterns, with elements on either side
+    const CODE_UNIT* programs[] = {
+        CODE_UNIT_LITERAL("{arith,c-'0'<10}abc"),
+        CODE_UNIT_LITERAL("abc{arith,c-'0'<10}"),
+        CODE_UNIT_LITERAL("{0}abc{1}"),
+        CODE_UNIT_LITERAL("abc"),
+    };
+    check_set(programs, 4, CODE_UNIT_LITERAL("1abc2_abc_abc3abc4abc"), 0);
+  }
+  { // unanchored patterns with anchored ones
+    const CODE_UNIT* programs[] = {
+        CODE_UNIT_LITERAL("{arith,c-'0'<10}"),
+        CODE_UNIT_LITERAL("x{arith,c-'0'<10}"),
+        CODE_UNIT_LITERAL("{arith,c-'a'<3}{arith,c-'0'<10}"),
+    };
+    check_set(programs, 3, CODE_UNIT_LITERAL("a1x2__b34x5c"), 2);
+  }
+  { // no matches
+    const CODE_UNIT* programs[] = {
+        CODE_UNIT_LITERAL("zzz"),
+        CODE_UNIT_LITERAL("q"),
+    };
+    check_set(programs, 2, CODE_UNIT_LITERAL("abcabc"), 0);
+  }
+  { // automaton
+    compiled_pattern abc, bc;
+    assert_continue(compile(CODE_UNIT_LITERAL("abc"), &abc));
+    assert_continue(compile(CODE_UNIT_LITERAL("bc"), &bc));
+    expression_pattern patterns[] = {abc.pattern, bc.pattern};
+    assert_continue(expression_set_max_nodes(patterns, 2) == 6);
+    expression_set_node nodes[6];
+    uint32_t next_output[2];
+    uint32_t unanchored[2];
+    expression_set set;
+    init_expression_set(&set, patterns, 2, nodes, next_output, unanchored);
+    assert_continue(set.num_nodes == 6);
+    assert_continue(set.max_needle_len == 3);
+    // a, ab, abc, then b, bc share the suffix
+    uint32_t state = 0;
+    state = expression_set_next(&set, state, 'a');
+    state = expression_set_next(&set, state, 'b');
+    state = expression_set_next(&set, state, 'c');
+    assert_continue(nodes[state].depth == 3);
+    assert_continue(nodes[state].output == 0);
+    assert_continue(nodes[nodes[state].output_link].output == 1);
+    assert_continue(nodes[nodes[state].output_link].depth == 2);
+  }
+  return has_errors;
+}
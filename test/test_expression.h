@@ -0,0 +1,189 @@
+#pragma once
+#include <assert.h>
+#include <string.h>
+#include "compiler/expression/expression_interpret_standardlib/arith.h"
+#include "compiler/expression/expression_interpret_standardlib/empty.h"
+#include "compiler/expression/expression_interpret_standardlib/str.h"
+#include "compiler/expression/expression_match.h"
+
+// compiles patterns and gives subjects, for the tests of patterns
+
+#define MAX_TOKENS 64
+#define MAX_DATA 1024
+
+typedef struct {
+  expr_token literal_tokens[MAX_TOKENS];
+  expr_token tokens[MAX_TOKENS];
+  function_setup_info presetup_info[MAX_TOKENS];
+  size_t num_elements;
+  char data[MAX_DATA] __attribute__((aligned(FUNCTION_DATA_CACHE_LINE)));
+  interpret_setup_result setup_result;
+  expression_op program[MAX_TOKENS];
+  expression_pattern pattern;
+} compiled_pattern;
+
+// ========================== digits (test function) ===========================
+
+// a run of 1 to DIGITS_MAX digits, as many as there are. unlike the built-ins,
+// it's variable length. it's the most selective function, so it's used as the
+// entrypoint element where it can be. it can't be matched in reverse
+#define DIGITS_MAX 3
+
+// private. the length of the run at pos, up to the end of the buffer
+static size_t digits_run(subject_buffer_state* buf, size_t pos) {
+  const CODE_UNIT* start = subject_buffer_start(buf);
+  size_t len = 0;
+  while (len != DIGITS_MAX && pos + len != buf->size && start[pos + len] >= '0' && start[pos + len] <= '9') {
+    ++len;
+  }
+  return len;
+}
+
+static function_presetup_result digits_presetup(const expr_token** function_start, function_setup_info** presetup_info) {
+  function_presetup_result ret;
+  ret.success = true;
+  ret.value.data_size_bytes = 0;
+  (*presetup_info)->function_data_size = 0;
+  (*presetup_info)->num_args = 0;
+  (*presetup_info)->function_start = *function_start;
+  (*presetup_info)++;
+  (*function_start)++;
+  return ret;
+}
+
+static function_setup_result digits_setup(const expr_token** function_start, const function_setup_info** presetup_info, void*, size_t) {
+  function_setup_result ret;
+  ret.success = true;
+  ret.value.ok.max_lookbehind_characters = 0;
+  ret.value.ok.max_size_characters = DIGITS_MAX;
+  (*presetup_info)++;
+  (*function_start)++;
+  return ret;
+}
+
+static bool digits_guaranteed_length_interpret(subject_buffer_state* buf, const void*, size_t) {
+  size_t len = digits_run(buf, buf->offset);
+  buf->offset += len;
+  return len != 0;
+}
+
+static match_status digits_interpret(subject_buffer_state* buf, const void*, size_t) {
+  size_t len = digits_run(buf, buf->offset);
+  if (len != DIGITS_MAX && buf->offset + len == buf->size) {
+    return MATCH_INCOMPLETE; // the run might continue
+  }
+  buf->offset += len;
+  return len != 0 ? MATCH_SUCCESS : MATCH_FAILURE;
+}
+
+static match_status digits_entrypoint_interpret(subject_buffer_state* buf, const void*, size_t, size_t* match_begin) {
+  const CODE_UNIT* start = subject_buffer_start(buf);
+  for (size_t pos = buf->offset; pos != buf->size; ++pos) {
+    if (start[pos] >= '0' && start[pos] <= '9') {
+      size_t len = digits_run(buf, pos);
+      if (len != DIGITS_MAX && pos + len == buf->size) {
+        buf->offset = pos;
+        return MATCH_INCOMPLETE;
+      }
+      *match_begin = pos;
+      buf->offset = pos + len;
+      return MATCH_SUCCESS;
+    }
+  }
+  buf->offset = buf->size;
+  return MATCH_FAILURE;
+}
+
+static size_t digits_selectivity(const void*, size_t) {
+  return SIZE_MAX;
+}
+
+// ptr to static lifetime
+const function_definition* function_definition_for_digits() {
+  static const CODE_UNIT s[] = {'d', 'i', 'g', 'i', 't', 's'};
+  static function_definition ret = {{s, s + sizeof(s) / sizeof(*s)}, //
+                                    digits_presetup,
+                                    digits_setup,
+                                    digits_interpret,
+                                    digits_guaranteed_length_interpret,
+                                    digits_entrypoint_interpret,
+                                    NULL,
+                                    digits_selectivity,
+                                    FUNCTION_OPCODE_CALL};
+  return &ret;
+}
+
+// ================================ compiling ==================================
+
+// the registered functions, sorted. set by init_definitions
+function_definition definitions[5];
+const size_t num_functions = sizeof(definitions) / sizeof(*definitions);
+
+// this must be called before compile
+void init_definitions(void) {
+  definitions[0] = *function_definition_for_arith();
+  definitions[1] = *function_definition_for_empty();
+  definitions[2] = *function_definition_for_str();
+  // the same as str, but called through its definition like any registered
+  // function which isn't built in
+  static const CODE_UNIT str_call[] = {'s', 't', 'r', '_', 'c', 'a', 'l', 'l'};
+  definitions[3] = *function_definition_for_str();
+  definitions[3].name.begin = str_call;
+  definitions[3].name.end = str_call + sizeof(str_call) / sizeof(*str_call);
+  definitions[3].opcode = FUNCTION_OPCODE_CALL;
+  definitions[4] = *function_definition_for_digits();
+  function_definition_sort(definitions, num_functions);
+}
+
+// tokenize, presetup and setup the program, and init its pattern. false on
+// any error
+bool compile(const CODE_UNIT* program, compiled_pattern* out) {
+  expr_tokenize_arg arg = expr_tokenize_arg_init(program, program + code_unit_strlen(program));
+  if (tokenize_expression(&arg).reason != NULL) return false;
+  size_t num_literal_tokens = expr_tokenize_arg_get_cap(&arg);
+  assert(num_literal_tokens <= MAX_TOKENS);
+  expr_tokenize_arg_set_to_fill(&arg, out->literal_tokens);
+  if (tokenize_expression(&arg).reason != NULL) return false;
+  size_t num_tokens = expr_coalesce_literals(out->literal_tokens, out->literal_tokens + num_literal_tokens, function_definition_for_str()->name, NULL);
+  assert(num_tokens <= MAX_TOKENS);
+  expr_coalesce_literals(out->literal_tokens, out->literal_tokens + num_literal_tokens, function_definition_for_str()->name, out->tokens);
+
+  interpret_presetup_arg presetup_arg;
+  presetup_arg.begin = out->tokens;
+  presetup_arg.end = out->tokens + num_tokens;
+  presetup_arg.num_function = num_functions;
+  presetup_arg.registry = NULL;
+  presetup_arg.functions = definitions;
+  presetup_arg.presetup_info_output = out->presetup_info;
+  presetup_arg.error_msg_output = NULL;
+  interpret_presetup_result presetup_result = interpret_presetup(&presetup_arg);
+  if (!presetup_result.success) return false;
+  assert(presetup_result.value.data_size_bytes <= MAX_DATA);
+  out->num_elements = presetup_arg.presetup_info_output - out->presetup_info;
+
+  interpret_setup_arg setup_arg;
+  setup_arg.begin = out->tokens;
+  setup_arg.end = out->tokens + num_tokens;
+  setup_arg.presetup_info = out->presetup_info;
+  setup_arg.data = out->data;
+  setup_arg.error_msg_output = NULL;
+  out->setup_result = interpret_setup(&setup_arg);
+  if (!out->setup_result.success) return false;
+  return init_expression_pattern(&out->pattern, out->presetup_info, out->num_elements, out->data, &out->setup_result, out->program);
+}
+
+// the ctx of give_subject
+typedef struct {
+  const CODE_UNIT* subject;
+  size_t remaining;
+} subject_source;
+
+// subject_buffer_input_callback
+size_t give_subject(void* ctx, CODE_UNIT* dst, size_t n) {
+  subject_source* source = (subject_source*)ctx;
+  if (n > source->remaining) n = source->remaining;
+  memcpy(dst, source->subject, n * sizeof(CODE_UNIT));
+  source->subject += n;
+  source->remaining -= n;
+  return n;
+}